@@ -0,0 +1,137 @@
+/* Description: This file implements the branch cache (.brc) writer and the
+ * mmap-based branch cache reader.
+*/
+
+#include "branch_cache.h"
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cbp_fatal.h"
+#include "op_state.h"
+
+using namespace std;
+
+static const char g_branch_cache_magic[8] = {'C', 'B', 'P', 'B', 'R', 'C', 0, 0};
+
+branch_cache_writer_c::branch_cache_writer_c(const char *file_name){
+    file = fopen(file_name, "wb");
+    if(!file){
+        CBP_FATAL("cannot create branch cache \"%s\"", file_name);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, g_branch_cache_magic, sizeof(header.magic));
+    header.version     = g_branch_cache_version;
+    header.record_size = sizeof(branch_cache_record_c);
+    // the header is rewritten with the final counts by close()
+    if(fwrite(&header, sizeof(header), 1, file) != 1){
+        CBP_FATAL("cannot write branch cache header");
+    }
+}
+branch_cache_writer_c::~branch_cache_writer_c(){
+    assert(!file);
+}
+void branch_cache_writer_c::write(const branch_record_c *branch_record, bool taken, uint num_insts){
+    if(num_insts > g_branch_cache_max_insts){
+        CBP_FATAL("%u instructions between branches is too many for a branch cache record", num_insts);
+    }
+    branch_cache_record_c record;
+    record.instruction_addr      = branch_record->instruction_addr;
+    record.branch_target         = branch_record->branch_target;
+    record.instruction_next_addr = branch_record->instruction_next_addr;
+    record.info                  = num_insts << branch_cache_record_c::INSTS_SHIFT;
+    if(taken)                         record.info |= branch_cache_record_c::TAKEN;
+    if(branch_record->is_indirect)    record.info |= branch_cache_record_c::INDIRECT;
+    if(branch_record->is_conditional) record.info |= branch_cache_record_c::CONDITIONAL;
+    if(branch_record->is_call)        record.info |= branch_cache_record_c::CALL;
+    if(branch_record->is_return)      record.info |= branch_cache_record_c::RETURN;
+    if(fwrite(&record, sizeof(record), 1, file) != 1){
+        CBP_FATAL("cannot write branch cache record");
+    }
+    header.num_branches++;
+    header.num_insts += num_insts;
+}
+void branch_cache_writer_c::close(uint num_trailing_insts){
+    header.num_trailing_insts = num_trailing_insts;
+    header.num_insts         += num_trailing_insts;
+    if((fseek(file, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(header), 1, file) != 1) || (fclose(file) != 0)){
+        CBP_FATAL("cannot finish branch cache");
+    }
+    file = 0;
+}
+
+branch_cache_reader_c::branch_cache_reader_c(char *trace_name){
+    assert(trace_name);
+    string cache_file_name = string(trace_name) + ".brc";
+    int fd = open(cache_file_name.c_str(), O_RDONLY);
+    if(fd < 0){
+        CBP_FATAL("cannot open branch cache \"%s\"; create it with trace_convert", cache_file_name.c_str());
+    }
+    struct stat file_stat;
+    if((fstat(fd, &file_stat) != 0) || (size_t(file_stat.st_size) < sizeof(branch_cache_header_c))){
+        CBP_FATAL("branch cache \"%s\" is truncated", cache_file_name.c_str());
+    }
+    map_size = file_stat.st_size;
+    map      = mmap(0, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        CBP_FATAL("cannot mmap branch cache \"%s\"", cache_file_name.c_str());
+    }
+    madvise(map, map_size, MADV_SEQUENTIAL);
+    header = (const branch_cache_header_c *)map;
+    if((memcmp(header->magic, g_branch_cache_magic, sizeof(header->magic)) != 0) ||
+       (header->version != g_branch_cache_version) ||
+       (header->record_size != sizeof(branch_cache_record_c)) ||
+       (map_size != sizeof(branch_cache_header_c) + header->num_branches * sizeof(branch_cache_record_c))){
+        CBP_FATAL("\"%s\" is not a version %u branch cache", cache_file_name.c_str(), g_branch_cache_version);
+    }
+    next_record         = (const branch_cache_record_c *)(header + 1);
+    end_record          = next_record + header->num_branches;
+    trailing_insts_read = false;
+    // a branch cache has no instruction state; give the predictor an empty op_state
+    osptr = new op_state_c();
+    osptr->init(osptr);
+}
+
+branch_cache_reader_c::~branch_cache_reader_c(){
+    if(report && report_stats){
+        printf("*********************************************************\n");
+        stats.print();
+        printf("*********************************************************\n");
+    }
+    munmap(map, map_size);
+    delete osptr;
+}
+
+bool branch_cache_reader_c::decode_branch_record(branch_record_c *branch_record, bool *taken, uint *num_insts){
+    if(next_record == end_record){
+        if(!trailing_insts_read){
+            *num_insts          += header->num_trailing_insts;
+            trailing_insts_read  = true;
+        }
+        return false;
+    }
+    const branch_cache_record_c *record = next_record++;
+    uint info = record->info;
+    branch_record->instruction_addr      = record->instruction_addr;
+    branch_record->branch_target         = record->branch_target;
+    branch_record->instruction_next_addr = record->instruction_next_addr;
+    branch_record->is_indirect           = (info & branch_cache_record_c::INDIRECT) != 0;
+    branch_record->is_conditional        = (info & branch_cache_record_c::CONDITIONAL) != 0;
+    branch_record->is_call               = (info & branch_cache_record_c::CALL) != 0;
+    branch_record->is_return             = (info & branch_cache_record_c::RETURN) != 0;
+    *taken                               = (info & branch_cache_record_c::TAKEN) != 0;
+    *num_insts                          += info >> branch_cache_record_c::INSTS_SHIFT;
+    return true;
+}
+
+bool branch_cache_reader_c::skip_branches(uint64_t num_branches){
+    if(num_branches > uint64_t(end_record - next_record)){
+        return false;
+    }
+    next_record += num_branches;
+    return true;
+}
@@ -0,0 +1,91 @@
+/* Description: This file defines the branch cache (.brc) file format, a
+ * pre-decoded copy of a trace that keeps only its branches.  For every branch
+ * it stores the branch_record_c fields, the taken bit, and the number of
+ * instructions read from the trace up to and including the branch, which is all
+ * a predictor that ignores op_state_c needs and all the statistics need.
+ * branch_cache_writer_c writes the file (see trace_convert.cc) and
+ * branch_cache_reader_c mmaps it and replays it through the same interface as
+ * cbp_trace_reader_c (branch_reader_c), with identical statistics.
+*/
+
+#ifndef BRANCH_CACHE_H_SEEN
+#define BRANCH_CACHE_H_SEEN
+
+#include <cstdio>
+#include <inttypes.h>
+#include "tread.h"
+
+// file layout: one branch_cache_header_c, then num_branches branch_cache_record_c's,
+// all in the host's (little-endian) byte order
+struct branch_cache_header_c
+{
+    char     magic[8];             // "CBPBRC\0\0"
+    uint32_t version;              // g_branch_cache_version
+    uint32_t record_size;          // sizeof(branch_cache_record_c)
+    uint64_t num_branches;         // number of records
+    uint64_t num_trailing_insts;   // instructions after the last branch
+    uint64_t num_insts;            // instructions in the whole trace
+};
+
+struct branch_cache_record_c
+{
+    enum{
+        TAKEN       = 0x01,
+        INDIRECT    = 0x02,
+        CONDITIONAL = 0x04,
+        CALL        = 0x08,
+        RETURN      = 0x10,
+        INSTS_SHIFT = 8            // info >> INSTS_SHIFT is the instruction count
+    };
+    uint32_t instruction_addr;
+    uint32_t branch_target;
+    uint32_t instruction_next_addr;
+    uint32_t info;                 // flags in the low byte, instruction count in the upper 24 bits
+};
+
+const uint32_t g_branch_cache_version   = 2;
+const uint32_t g_branch_cache_max_insts = (1 << 24) - 1;
+
+// writes a branch cache file, one branch at a time
+class branch_cache_writer_c
+{
+private:
+    FILE *file;
+    branch_cache_header_c header;
+public:
+    branch_cache_writer_c(const char *file_name);
+    ~branch_cache_writer_c();
+    // append a branch and its outcome; num_insts counts the instructions since the previous branch,
+    // including this one
+    void write(const branch_record_c *branch_record, bool taken, uint num_insts);
+    // finish the file; num_trailing_insts counts the instructions after the last branch
+    void close(uint num_trailing_insts);
+};
+
+// replays a branch cache file
+class branch_cache_reader_c : public branch_reader_c
+{
+private:
+    void *map;                                      // the mmapped file
+    size_t map_size;
+    const branch_cache_header_c *header;
+    const branch_cache_record_c *next_record;
+    const branch_cache_record_c *end_record;
+    bool trailing_insts_read;                       // the instructions after the last branch have been counted
+
+protected:
+    // the records are fixed size, so skipping is a seek
+    bool skip_branches(uint64_t num_branches);
+
+public:
+    // branch_cache_reader_c is passed the name of the trace; it reads the trace's ".brc" file.  A branch
+    // cache has no instruction state, so osptr is always empty.
+    branch_cache_reader_c(char *trace_name);
+    ~branch_cache_reader_c();
+    bool decode_branch_record(branch_record_c *branch_record, bool *taken, uint *num_insts);
+    uint64_t get_trace_insts() const{
+        return header->num_insts;
+    }
+};
+
+#endif // BRANCH_CACHE_H_SEEN
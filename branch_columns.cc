@@ -0,0 +1,264 @@
+/* Description: This file implements the columnar branch trace (.bct) writer
+ * and the mmap-based columnar branch trace reader.
+*/
+
+#include "branch_columns.h"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cbp_fatal.h"
+#include "op_state.h"
+
+using namespace std;
+
+static const char g_branch_columns_magic[8] = {'C', 'B', 'P', 'B', 'C', 'T', 0, 0};
+
+// LEB128: 7 bits per byte, low bits first, high bit set on all but the last byte
+static void put_varint(vector<uint8_t> *column, uint64_t value){
+    while(value >= 0x80){
+        column->push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    column->push_back(uint8_t(value));
+}
+static uint64_t get_varint(const uint8_t **ptr, const uint8_t *end){
+    uint64_t value = 0;
+    for(uint shift = 0; ; shift += 7){
+        if((*ptr == end) || (shift > 63)){
+            CBP_FATAL("corrupt columnar branch trace");
+        }
+        uint8_t byte = *(*ptr)++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if(!(byte & 0x80)){
+            return value;
+        }
+    }
+}
+static uint32_t zigzag(int32_t value){
+    return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+static int32_t unzigzag(uint32_t value){
+    return int32_t(value >> 1) ^ -int32_t(value & 1);
+}
+
+// model methods
+branch_columns_model_c::branch_columns_model_c(){
+    memset(ras, 0, sizeof(ras));
+    ras_top = 0;
+    resize(0);
+}
+void branch_columns_model_c::resize(uint num_statics){
+    static_edges.resize(2 * (num_statics + 1));
+    last_target.resize(num_statics, 0);
+}
+
+// writer methods
+branch_columns_writer_c::branch_columns_writer_c(const char *file_name_arg){
+    file_name = file_name_arg;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, g_branch_columns_magic, sizeof(header.magic));
+    header.version   = g_branch_columns_version;
+    prev_edge        = model.start_edge();
+    last_edge_miss   = 0;
+    last_target_miss = 0;
+}
+branch_columns_writer_c::~branch_columns_writer_c(){
+}
+void branch_columns_writer_c::write(const branch_record_c *branch_record, bool branch_taken, uint num_insts){
+    // find or add the static branch
+    branch_columns_static_c info;
+    info.instruction_addr      = branch_record->instruction_addr;
+    info.instruction_next_addr = branch_record->instruction_next_addr;
+    info.branch_target         = branch_record->is_indirect ? 0 : branch_record->branch_target;
+    info.flags                 = 0;
+    if(branch_record->is_indirect)    info.flags |= branch_columns_static_c::INDIRECT;
+    if(branch_record->is_conditional) info.flags |= branch_columns_static_c::CONDITIONAL;
+    if(branch_record->is_call)        info.flags |= branch_columns_static_c::CALL;
+    if(branch_record->is_return)      info.flags |= branch_columns_static_c::RETURN;
+    pair<uint64_t, uint64_t> key((uint64_t(info.instruction_addr) << 32) | info.instruction_next_addr,
+                                 (uint64_t(info.branch_target) << 32) | info.flags);
+    map<pair<uint64_t, uint64_t>, uint32_t>::iterator found = static_index.find(key);
+    uint32_t index;
+    if(found != static_index.end()){
+        index = found->second;
+    }
+    else{
+        index = statics.size();
+        static_index[key] = index;
+        statics.push_back(info);
+        model.resize(statics.size());
+    }
+    // the edge into this branch
+    if((prev_edge->next != index) || (prev_edge->insts != num_insts)){
+        put_varint(&edge_misses, header.num_branches - last_edge_miss);
+        put_varint(&edge_misses, index);
+        put_varint(&edge_misses, num_insts);
+        prev_edge->next  = index;
+        prev_edge->insts = num_insts;
+        last_edge_miss   = header.num_branches + 1;
+    }
+    // the direction
+    if(branch_record->is_conditional){
+        if((header.num_conditional % 64) == 0){
+            taken.push_back(0);
+        }
+        if(branch_taken){
+            taken.back() |= uint64_t(1) << (header.num_conditional % 64);
+        }
+        header.num_conditional++;
+    }
+    else if(!branch_taken){
+        // the format has no bit for it: the reader takes every non-conditional branch
+        CBP_FATAL("non-conditional branch at 0x%x is not taken; it can't be written to a columnar branch trace",
+                  branch_record->instruction_addr);
+    }
+    // the target
+    if(branch_record->is_indirect){
+        if(model.predict_target(index, &info) != branch_record->branch_target){
+            put_varint(&target_misses, header.num_indirect - last_target_miss);
+            put_varint(&target_misses, zigzag(int32_t(branch_record->branch_target - branch_record->instruction_addr)));
+            last_target_miss = header.num_indirect + 1;
+        }
+        model.update_target(index, branch_record->branch_target);
+        header.num_indirect++;
+    }
+    model.update_calls(&info);
+    prev_edge = model.next_edge(index, &info, branch_taken, branch_record->branch_target);
+    header.num_branches++;
+    header.num_insts += num_insts;
+}
+void branch_columns_writer_c::close(uint num_trailing_insts){
+    header.num_statics        = statics.size();
+    header.num_trailing_insts = num_trailing_insts;
+    header.num_insts         += num_trailing_insts;
+    header.edge_miss_bytes    = edge_misses.size();
+    header.target_miss_bytes  = target_misses.size();
+    FILE *file = fopen(file_name.c_str(), "wb");
+    if(!file){
+        CBP_FATAL("cannot create columnar branch trace \"%s\"", file_name.c_str());
+    }
+    bool ok = (fwrite(&header, sizeof(header), 1, file) == 1);
+    ok = ok && (fwrite(statics.data(), sizeof(statics[0]), statics.size(), file) == statics.size());
+    ok = ok && (fwrite(taken.data(), sizeof(taken[0]), taken.size(), file) == taken.size());
+    ok = ok && (fwrite(edge_misses.data(), 1, edge_misses.size(), file) == edge_misses.size());
+    ok = ok && (fwrite(target_misses.data(), 1, target_misses.size(), file) == target_misses.size());
+    if(!ok || (fclose(file) != 0)){
+        CBP_FATAL("cannot write columnar branch trace \"%s\"", file_name.c_str());
+    }
+}
+
+// reader methods
+branch_columns_reader_c::branch_columns_reader_c(char *trace_name){
+    assert(trace_name);
+    string columns_file_name = string(trace_name) + ".bct";
+    int fd = open(columns_file_name.c_str(), O_RDONLY);
+    if(fd < 0){
+        CBP_FATAL("cannot open columnar branch trace \"%s\"; create it with trace_convert -f bct", columns_file_name.c_str());
+    }
+    struct stat file_stat;
+    if((fstat(fd, &file_stat) != 0) || (size_t(file_stat.st_size) < sizeof(branch_columns_header_c))){
+        CBP_FATAL("columnar branch trace \"%s\" is truncated", columns_file_name.c_str());
+    }
+    map_size = file_stat.st_size;
+    map      = mmap(0, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        CBP_FATAL("cannot mmap columnar branch trace \"%s\"", columns_file_name.c_str());
+    }
+    header = (const branch_columns_header_c *)map;
+    uint64_t num_taken_words = (header->num_conditional + 63) / 64;
+    if((memcmp(header->magic, g_branch_columns_magic, sizeof(header->magic)) != 0) ||
+       (header->version != g_branch_columns_version) ||
+       (map_size != sizeof(branch_columns_header_c) + header->num_statics * sizeof(branch_columns_static_c) +
+                    num_taken_words * sizeof(uint64_t) + header->edge_miss_bytes + header->target_miss_bytes)){
+        CBP_FATAL("\"%s\" is not a version %u columnar branch trace", columns_file_name.c_str(), g_branch_columns_version);
+    }
+    statics         = (const branch_columns_static_c *)(header + 1);
+    taken_words     = (const uint64_t *)(statics + header->num_statics);
+    edge_miss_ptr   = (const uint8_t *)(taken_words + num_taken_words);
+    edge_miss_end   = edge_miss_ptr + header->edge_miss_bytes;
+    target_miss_ptr = edge_miss_end;
+    target_miss_end = target_miss_ptr + header->target_miss_bytes;
+    model.resize(header->num_statics);
+    prev_edge           = model.start_edge();
+    branch_num          = 0;
+    conditional_num     = 0;
+    indirect_num        = 0;
+    taken_word          = 0;
+    trailing_insts_read = false;
+    next_edge_miss      = (edge_miss_ptr == edge_miss_end) ? ~uint64_t(0) : get_varint(&edge_miss_ptr, edge_miss_end);
+    next_target_miss    = (target_miss_ptr == target_miss_end) ? ~uint64_t(0) : get_varint(&target_miss_ptr, target_miss_end);
+    // the format has no instruction state; give the predictor an empty op_state
+    osptr = new op_state_c();
+    osptr->init(osptr);
+}
+
+branch_columns_reader_c::~branch_columns_reader_c(){
+    if(report && report_stats){
+        printf("*********************************************************\n");
+        stats.print();
+        printf("*********************************************************\n");
+    }
+    munmap(map, map_size);
+    delete osptr;
+}
+
+bool branch_columns_reader_c::decode_branch_record(branch_record_c *branch_record, bool *taken, uint *num_insts){
+    if(branch_num == header->num_branches){
+        if(!trailing_insts_read){
+            *num_insts          += header->num_trailing_insts;
+            trailing_insts_read  = true;
+        }
+        return false;
+    }
+    // the edge into this branch
+    if(branch_num == next_edge_miss){
+        prev_edge->next  = get_varint(&edge_miss_ptr, edge_miss_end);
+        prev_edge->insts = get_varint(&edge_miss_ptr, edge_miss_end);
+        next_edge_miss = (edge_miss_ptr == edge_miss_end) ? ~uint64_t(0) : branch_num + 1 + get_varint(&edge_miss_ptr, edge_miss_end);
+    }
+    uint32_t index = prev_edge->next;
+    if(index >= header->num_statics){
+        CBP_FATAL("corrupt columnar branch trace");
+    }
+    *num_insts    += prev_edge->insts;
+    const branch_columns_static_c *info = statics + index;
+    // the direction
+    bool branch_taken = true;
+    if(info->flags & branch_columns_static_c::CONDITIONAL){
+        if((conditional_num % 64) == 0){
+            taken_word = taken_words[conditional_num / 64];
+        }
+        branch_taken   = taken_word & 1;
+        taken_word   >>= 1;
+        conditional_num++;
+    }
+    // the target
+    uint32_t target = info->branch_target;
+    if(info->flags & branch_columns_static_c::INDIRECT){
+        target = model.predict_target(index, info);
+        if(indirect_num == next_target_miss){
+            target           = info->instruction_addr + unzigzag(get_varint(&target_miss_ptr, target_miss_end));
+            next_target_miss = (target_miss_ptr == target_miss_end) ? ~uint64_t(0) : indirect_num + 1 + get_varint(&target_miss_ptr, target_miss_end);
+        }
+        model.update_target(index, target);
+        indirect_num++;
+    }
+    model.update_calls(info);
+    prev_edge = model.next_edge(index, info, branch_taken, target);
+    branch_num++;
+
+    branch_record->instruction_addr      = info->instruction_addr;
+    branch_record->branch_target         = target;
+    branch_record->instruction_next_addr = info->instruction_next_addr;
+    branch_record->is_indirect           = (info->flags & branch_columns_static_c::INDIRECT) != 0;
+    branch_record->is_conditional        = (info->flags & branch_columns_static_c::CONDITIONAL) != 0;
+    branch_record->is_call               = (info->flags & branch_columns_static_c::CALL) != 0;
+    branch_record->is_return             = (info->flags & branch_columns_static_c::RETURN) != 0;
+    *taken                               = branch_taken;
+    return true;
+}
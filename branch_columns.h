@@ -0,0 +1,177 @@
+/* Description: This file defines the columnar branch trace (.bct) format, a
+ * compact structure-of-arrays encoding of the same branch stream a branch
+ * cache (.brc) holds.  The static branches are stored once, in a dictionary,
+ * and each dynamic branch is coded against a model that both the writer and
+ * the reader keep:
+ *   - which static branch comes next, and how many instructions it takes to
+ *     get there, is predicted to be whatever followed the same edge last
+ *     time, where the edge out of a direct branch is the branch and its
+ *     direction, and the edge out of an indirect branch is its target; only
+ *     the mispredicted edges are stored;
+ *   - the taken bits of the conditional branches are bit-packed, 64 to a
+ *     word (every other branch is taken);
+ *   - the targets of indirect branches are predicted from a return stack
+ *     (returns) or the branch's last target (others); only the mispredicted
+ *     targets are stored, as deltas from the branch's PC.
+ * The mispredicted edges and targets are LEB128 varint columns, each entry
+ * led by its distance from the previous one.  A whole trace takes roughly
+ * one bit per conditional branch.
+*/
+
+#ifndef BRANCH_COLUMNS_H_SEEN
+#define BRANCH_COLUMNS_H_SEEN
+
+#include <deque>
+#include <inttypes.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "tread.h"
+
+// file layout: one branch_columns_header_c, then the columns, in this order:
+//   statics:        num_statics branch_columns_static_c's
+//   taken:          (num_conditional + 63) / 64 uint64_t's, branch i in bit (i % 64) of word (i / 64)
+//   edge misses:    edge_miss_bytes bytes of (gap, static index, instruction count) varint triples
+//   target misses:  target_miss_bytes bytes of (gap, zigzag(target - PC)) varint pairs
+// all in the host's (little-endian) byte order
+struct branch_columns_header_c
+{
+    char     magic[8];             // "CBPBCT\0\0"
+    uint32_t version;              // g_branch_columns_version
+    uint32_t num_statics;
+    uint64_t num_branches;
+    uint64_t num_conditional;
+    uint64_t num_indirect;
+    uint64_t num_trailing_insts;   // instructions after the last branch
+    uint64_t num_insts;            // instructions in the whole trace
+    uint64_t edge_miss_bytes;
+    uint64_t target_miss_bytes;
+};
+
+// a static branch: everything about a branch but its direction, and, for indirect branches, its target
+struct branch_columns_static_c
+{
+    enum{
+        INDIRECT    = 0x1,
+        CONDITIONAL = 0x2,
+        CALL        = 0x4,
+        RETURN      = 0x8
+    };
+    uint32_t instruction_addr;
+    uint32_t instruction_next_addr;
+    uint32_t branch_target;        // 0 for indirect branches
+    uint32_t flags;
+};
+
+const uint32_t g_branch_columns_version = 2;
+
+// the prediction model shared by the writer and the reader; both drive it with the same calls in the
+// same order, so the reader reproduces every prediction the writer made
+class branch_columns_model_c
+{
+public:
+    // what followed an edge last time
+    struct edge_c
+    {
+        edge_c() : next(~uint32_t(0)), insts(0) { }
+        uint32_t next;                              // static index of the next branch (none: ~0)
+        uint32_t insts;                             // instructions up to and including the next branch
+    };
+private:
+    enum{ RAS_SIZE = 64 };
+    std::deque<edge_c> static_edges;                // the start edge, then two per static branch
+    std::unordered_map<uint32_t, edge_c> target_edges;  // per indirect target
+    std::vector<uint32_t> last_target;              // per static: last target
+    uint32_t ras[RAS_SIZE];
+    uint ras_top;
+public:
+    branch_columns_model_c();
+    void resize(uint num_statics);
+    // the edge into the first branch
+    edge_c *start_edge(){
+        return &static_edges[0];
+    }
+    // the edge out of static branch index; edge_c pointers stay valid across resize()
+    edge_c *next_edge(uint32_t index, const branch_columns_static_c *info, bool taken, uint32_t target){
+        if(info->flags & branch_columns_static_c::INDIRECT){
+            return &target_edges[target];
+        }
+        return &static_edges[((index + 1) << 1) | (taken ? 1 : 0)];
+    }
+    // the predicted target of an indirect branch; must be followed by update_target()
+    uint32_t predict_target(uint32_t index, const branch_columns_static_c *info){
+        if((info->flags & branch_columns_static_c::RETURN) && ras_top){
+            return ras[--ras_top % RAS_SIZE];
+        }
+        return last_target[index];
+    }
+    void update_target(uint32_t index, uint32_t target){
+        last_target[index] = target;
+    }
+    // called for every branch, after its target is known
+    void update_calls(const branch_columns_static_c *info){
+        if(info->flags & branch_columns_static_c::CALL){
+            ras[ras_top++ % RAS_SIZE] = info->instruction_next_addr;
+        }
+    }
+};
+
+// collects a branch stream in memory and writes it as a columnar branch trace
+class branch_columns_writer_c
+{
+private:
+    std::string file_name;
+    branch_columns_header_c header;
+    std::vector<branch_columns_static_c> statics;
+    std::vector<uint64_t> taken;
+    std::vector<uint8_t> edge_misses;
+    std::vector<uint8_t> target_misses;
+    std::map<std::pair<uint64_t, uint64_t>, uint32_t> static_index;  // (PC:next PC, target:flags) -> index
+    branch_columns_model_c model;
+    branch_columns_model_c::edge_c *prev_edge;     // the edge into the next branch
+    uint64_t last_edge_miss;                        // branch number of the last edge miss, plus one
+    uint64_t last_target_miss;                      // indirect branch number of the last target miss, plus one
+public:
+    branch_columns_writer_c(const char *file_name);
+    ~branch_columns_writer_c();
+    // see branch_cache_writer_c
+    void write(const branch_record_c *branch_record, bool taken, uint num_insts);
+    void close(uint num_trailing_insts);
+};
+
+// replays a columnar branch trace; the interface matches cbp_trace_reader_c
+class branch_columns_reader_c : public branch_reader_c
+{
+private:
+    void *map;                                      // the mmapped file
+    size_t map_size;
+    const branch_columns_header_c *header;
+    const branch_columns_static_c *statics;
+    const uint64_t *taken_words;
+    const uint8_t *edge_miss_ptr;                   // next unread edge miss
+    const uint8_t *edge_miss_end;
+    const uint8_t *target_miss_ptr;                 // next unread target miss
+    const uint8_t *target_miss_end;
+    branch_columns_model_c model;
+    branch_columns_model_c::edge_c *prev_edge;     // the edge into the next branch
+    uint64_t branch_num;                            // branches read so far
+    uint64_t conditional_num;                       // conditional branches read so far
+    uint64_t indirect_num;                          // indirect branches read so far
+    uint64_t next_edge_miss;                        // branch number of the next edge miss
+    uint64_t next_target_miss;                      // indirect branch number of the next target miss
+    uint64_t taken_word;                            // unread taken bits of the current word
+    bool trailing_insts_read;                       // the instructions after the last branch have been counted
+public:
+    // branch_columns_reader_c is passed the name of the trace; it reads the trace's ".bct" file.  The
+    // format has no instruction state, so osptr is always empty.
+    branch_columns_reader_c(char *trace_name);
+    ~branch_columns_reader_c();
+    bool decode_branch_record(branch_record_c *branch_record, bool *taken, uint *num_insts);
+    uint64_t get_trace_insts() const{
+        return header->num_insts;
+    }
+};
+
+#endif // BRANCH_COLUMNS_H_SEEN
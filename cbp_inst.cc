@@ -12,12 +12,14 @@
 #include <inttypes.h>
 #include <sstream>
 #include <string>
+#include <vector>
 #include "cbp_assert.h"
 #include "cbp_fatal.h"
 #include "cond_pred.h"
 #include "finite_stack.h"
 #include "indirect_pred.h"
 #include "stride_pred.h"
+#include "trace_source.h"
 #include "value_cache.h"
 
 #define NBYTE(arg)   (sizeof(arg) / sizeof(uint8_t))
@@ -251,13 +253,23 @@ namespace cbp
         explicit CBP_INST_STREAM(const CBP_INST_STREAM&);
         CBP_INST_STREAM& operator=(const CBP_INST_STREAM&);
     
-        // the underlying stream
+        // the underlying stream; input is read through 'source', which is owned
+        // by this object only when it was constructed from a std::FILE*
         FILE* stream;
+        TRACE_SOURCE* source;
+        FILE_SOURCE* file_source;
     
-        // input or output buffer
+        // output buffer
         enum { BUFFER_SIZE = 50 };     // size of largest io format CBP_INST
         uint8_t buffer[BUFFER_SIZE];
-        uint8_t* buffer_tail;
+        uint8_t* buffer_tail;          // next byte to get or put; points into window on input
+        // input window: read() parses each CBP_INST directly out of this
+        // window, which is refilled from 'source' in large blocks
+        enum { WINDOW_SIZE = (1 << 20) };
+        uint8_t* window;
+        uint8_t* window_head;          // first unconsumed byte
+        uint8_t* window_tail;          // one past the last valid byte
+        bool fill_window(size_t bytes_needed);
         template <class Type> void get_buffer(Type* ptr);
         template <class Type> void put_buffer(const Type* ptr);
     
@@ -299,6 +311,42 @@ namespace cbp
         static const KEY_TYPE UNUSED_KEY_BIT1       = (KEY_TYPE(0x1) << 13);
         static const KEY_TYPE UNUSED_KEY_BIT2       = (KEY_TYPE(0x1) << 14);
         static const KEY_TYPE UNUSED_KEY_BIT3       = (KEY_TYPE(0x1) << 15);
+
+        // The fields of an io format CBP_INST, in the order they appear in it.
+        // Each field is present, and its size is fixed, as soon as the key is
+        // known, so read() looks up the size of every field for each key byte
+        // in a precomputed table instead of decoding the key bit by bit.  The
+        // get functions then read their field at its offset in the record.
+        enum FIELD
+        {
+            FIELD_KEY,                 // 1 or 2 bytes
+            FIELD_INSTRUCTION_ADDR,
+            FIELD_STATIC_INFO,
+            FIELD_SRC1_VAL,
+            FIELD_SRC2_VAL,
+            FIELD_DST_VAL,
+            FIELD_VADDR1,
+            FIELD_VADDR2,
+            FIELD_BRANCH_TARGET,
+            NUM_FIELDS
+        };
+        struct KEY_LAYOUT
+        {
+            uint8_t size;                       // sum of field_size
+            uint8_t field_size[NUM_FIELDS];     // bytes of each field selected by this key byte
+            uint8_t field_offset[NUM_FIELDS];   // offsets if no other key byte selects a field
+        };
+        struct KEY_TABLES
+        {
+            KEY_TABLES(void);
+            KEY_LAYOUT byte0[256];              // indexed by the first byte of the key
+            KEY_LAYOUT byte1[256];              // indexed by the second byte of the key
+        };
+        static const KEY_TABLES key_tables;
+        const uint8_t* record;                  // the record being read
+        const uint8_t* field_offset;            // offset of each field in record
+        uint8_t two_byte_key_offset[NUM_FIELDS];
+        template <class Type> void get_field(FIELD field, Type* ptr);
     
         // For each CBP_INST member, there is a pair of functions: a get function and
         // a put function.  When a CBP_INST is read, the get functions are called to
@@ -396,11 +444,29 @@ namespace cbp
         EVENT_COUNTER stat_read_branch_target;
         EVENT_COUNTER stat_read_src1_val;
         EVENT_COUNTER stat_read_vaddr2;
+        EVENT_COUNTER stat_bytes;      // bytes read or written, keys included
         void update_statistics(void);
+
+        // The members a decoder checkpoint holds: the last CBP_INST and its
+        // static info entry, which the get functions predict the next one
+        // from, the static info cache, the register file, the predictors, the
+        // value caches, and the statistics.  The checkpoint's image of them is
+        // these blocks back to back.
+        struct STATE_BLOCK
+        {
+            uint8_t* data;
+            size_t size;
+        };
+        enum { NUM_STATE_BLOCKS = 16 };
+        enum { MIN_ZERO_RUN = 8 };     // shorter runs of zeros are left in the literals
+        void get_state_blocks(STATE_BLOCK* blocks, uint32_t* static_info_index);
+        void get_state_image(vector<uint8_t>* image);
+        void set_state_image(const vector<uint8_t>& image);
     
       public:
         CBP_INST_STREAM(FILE* stream_arg);
-        // uses compiler generated destructor
+        CBP_INST_STREAM(TRACE_SOURCE* source_arg);
+        ~CBP_INST_STREAM(void) { delete file_source; delete [] window; }
     
         FILE* get_stream(void) { return stream; }
     
@@ -408,7 +474,11 @@ namespace cbp
         bool read(CBP_INST* inst_arg);
         bool write(const CBP_INST* inst_arg);
     
+        void save_state(vector<uint8_t>* state);
+        bool restore_state(const uint8_t* state, size_t size);
+    
         string get_statistics_string(void) const;
+        EVENT_COUNTER get_bytes(void) const { return stat_bytes; }
     };
     
     template <class Type>
@@ -419,6 +489,13 @@ namespace cbp
         buffer_tail += NBYTE(Type);
     }
     
+    template <class Type>
+    inline void
+    CBP_INST_STREAM::get_field(FIELD field, Type* ptr)
+    {
+        memcpy(ptr, (record + field_offset[field]), (sizeof(uint8_t) * NBYTE(Type)));
+    }
+    
     template <class Type>
     inline void
     CBP_INST_STREAM::put_buffer(const Type* ptr)
@@ -444,7 +521,7 @@ namespace cbp
         uint32_t instruction_addr = get_instruction_addr_prediction();
         if (key & READ_INSTRUCTION_ADDR) {
             uint32_t patch;
-            get_buffer(&patch);
+            get_field(FIELD_INSTRUCTION_ADDR, &patch);
             instruction_addr ^= patch;
         }
         inst.instruction_addr = instruction_addr;
@@ -486,6 +563,7 @@ namespace cbp
     {
         static_info = get_static_info_prediction(inst.instruction_addr);
         if (key & READ_STATIC_INFO) {
+            buffer_tail = const_cast<uint8_t*>(record + field_offset[FIELD_STATIC_INFO]);
             get_buffer(&static_info->src1);
             get_buffer(&static_info->src2);
             get_buffer(&static_info->dst);
@@ -533,7 +611,7 @@ namespace cbp
         uint32_t* src1_val = &register_file[inst.src1];
         if (key & READ_SRC1_VAL) {
             uint32_t patch;
-            get_buffer(&patch);
+            get_field(FIELD_SRC1_VAL, &patch);
             *src1_val ^= patch;
         }
         inst.src1_val = *src1_val;
@@ -560,7 +638,7 @@ namespace cbp
         uint32_t* src2_val = &register_file[inst.src2];
         if (key & READ_SRC2_VAL) {
             uint32_t patch;
-            get_buffer(&patch);
+            get_field(FIELD_SRC2_VAL, &patch);
             *src2_val ^= patch;
         }
         inst.src2_val = *src2_val;
@@ -594,15 +672,15 @@ namespace cbp
                 dst_val = dst_val_stride_pred.get_prediction(inst.instruction_addr);
             break;
           case TYPE1_DST_VAL:   // 1 byte encoding
-            get_buffer(&output_l0_id);
+            get_field(FIELD_DST_VAL, &output_l0_id);
             dst_val = dst_val_l0[output_l0_id];
             break;
           case TYPE2_DST_VAL:   // 2 byte encoding
-            get_buffer(&output_l1_id);
+            get_field(FIELD_DST_VAL, &output_l1_id);
             dst_val = dst_val_l1[output_l1_id];
             break;
           case READ_DST_VAL:    // 4 byte encoding
-            get_buffer(&dst_val);
+            get_field(FIELD_DST_VAL, &dst_val);
             break;
           default:
             CBP_FATAL("invalid key");
@@ -691,15 +769,15 @@ namespace cbp
             vaddr1 = vaddr1_stride_pred.get_prediction(inst.instruction_addr);
             break;
           case TYPE1_VADDR1:   // 1 byte encoding
-            get_buffer(&output_l0_id);
+            get_field(FIELD_VADDR1, &output_l0_id);
             vaddr1 = vaddr1_l0[output_l0_id];
             break;
           case TYPE2_VADDR1:   // 2 byte encoding
-            get_buffer(&output_l1_id);
+            get_field(FIELD_VADDR1, &output_l1_id);
             vaddr1 = vaddr1_l1[output_l1_id];
             break;
           case READ_VADDR1:    // 4 byte encoding
-            get_buffer(&vaddr1);
+            get_field(FIELD_VADDR1, &vaddr1);
             break;
           default:
             CBP_FATAL("invalid key");
@@ -768,7 +846,7 @@ namespace cbp
         uint32_t vaddr2 = /* vaddr1 */ inst.src_vaddr;
         if (key & READ_VADDR2) {
             uint32_t patch;
-            get_buffer(&patch);
+            get_field(FIELD_VADDR2, &patch);
             vaddr2 ^= patch;
         }
         return vaddr2;
@@ -917,15 +995,15 @@ namespace cbp
             branch_target = get_branch_target_prediction();
             break;
           case TYPE1_BRANCH_TARGET:   // 1 byte encoding
-            get_buffer(&output_l0_id);
+            get_field(FIELD_BRANCH_TARGET, &output_l0_id);
             branch_target = branch_target_l0[output_l0_id];
             break;
           case TYPE2_BRANCH_TARGET:   // 2 byte encoding
-            get_buffer(&output_l1_id);
+            get_field(FIELD_BRANCH_TARGET, &output_l1_id);
             branch_target = branch_target_l1[output_l1_id];
             break;
           case READ_BRANCH_TARGET:    // 4 byte encoding
-            get_buffer(&patch);
+            get_field(FIELD_BRANCH_TARGET, &patch);
             branch_target = (inst.instruction_addr ^ patch);
             break;
           default:
@@ -1058,7 +1136,18 @@ namespace cbp
     
     inline
     CBP_INST_STREAM::CBP_INST_STREAM(FILE* stream_arg)
-        : stream(stream_arg),
+        : CBP_INST_STREAM(static_cast<TRACE_SOURCE*>(0))
+    {
+        stream = stream_arg;
+        file_source = new FILE_SOURCE(stream_arg);
+        source = file_source;
+    }
+
+    inline
+    CBP_INST_STREAM::CBP_INST_STREAM(TRACE_SOURCE* source_arg)
+        : stream(0),
+          source(source_arg),
+          file_source(0),
           stat_cbp_inst(0),
           stat_two_byte_key(0),
           stat_type0_dst_val(0),
@@ -1078,7 +1167,8 @@ namespace cbp
           stat_type2_branch_target(0),
           stat_read_branch_target(0),
           stat_read_src1_val(0),
-          stat_read_vaddr2(0)
+          stat_read_vaddr2(0),
+          stat_bytes(0)
     {
         inst.instruction_addr = 0;
         inst.instruction_next_addr = 0;
@@ -1111,109 +1201,106 @@ namespace cbp
         inst.taken = false;
         static_info = get_static_info_prediction(inst.instruction_addr);
         fill_n(register_file, static_cast<size_t>(REG_MAX), 0);
+        window = new uint8_t[WINDOW_SIZE];
+        window_head = window;
+        window_tail = window;
     }
     
+    // Makes at least 'bytes_needed' unconsumed bytes available in the window,
+    // moving the tail of a record that straddles the end of the window to its
+    // front and refilling the rest from the source.  Returns false if the
+    // source ends first.
+    bool
+    CBP_INST_STREAM::fill_window(size_t bytes_needed)
+    {
+        size_t bytes_left = (window_tail - window_head);
+        if (bytes_left >= bytes_needed)
+            return true;
+        memmove(window, window_head, bytes_left);
+        window_head = window;
+        window_tail = (window + bytes_left);
+        window_tail += source->read(window_tail, (WINDOW_SIZE - bytes_left));
+        return (static_cast<size_t>(window_tail - window_head) >= bytes_needed);
+    }
+
+    const CBP_INST_STREAM::KEY_TABLES CBP_INST_STREAM::key_tables;
+
+    CBP_INST_STREAM::KEY_TABLES::KEY_TABLES(void)
+    {
+        static const uint8_t TYPE_SIZE[4] = { 0, NBYTE(uint8_t), NBYTE(uint16_t), NBYTE(uint32_t) };
+        static const uint8_t STATIC_INFO_SIZE = (0
+            + NBYTE(uint8_t)                      // src1
+            + NBYTE(uint8_t)                      // src2
+            + NBYTE(uint8_t)                      // dst
+            + NBYTE(uint8_t)                      // mem_src1
+            + NBYTE(uint8_t)                      // mem_src2
+            + NBYTE(uint8_t)                      // mem_src3
+            + NBYTE(STATIC_INFO::BIT_FIELD_TYPE)
+            + NBYTE(uint32_t)                     // instruction_addr
+            + NBYTE(uint32_t)                     // instruction_next_addr
+            + NBYTE(uint32_t));                   // branch_target
+
+        for (int byte = 0; byte < 256; ++byte) {
+            KEY_TYPE key0 = KEY_TYPE(byte);
+            KEY_LAYOUT& layout0 = byte0[byte];
+            fill_n(layout0.field_size, static_cast<size_t>(NUM_FIELDS), 0);
+            layout0.field_size[FIELD_KEY]         = ((key0 & TWO_BYTE_KEY) ? 2 : 1);
+            layout0.field_size[FIELD_STATIC_INFO] = ((key0 & READ_STATIC_INFO) ? STATIC_INFO_SIZE : 0);
+            layout0.field_size[FIELD_SRC2_VAL]    = ((key0 & READ_SRC2_VAL) ? NBYTE(uint32_t) : 0);
+            layout0.field_size[FIELD_DST_VAL]     = TYPE_SIZE[(key0 & MASK_DST_VAL) >> 1];
+            layout0.field_size[FIELD_VADDR1]      = TYPE_SIZE[(key0 & MASK_VADDR1) >> 3];
+
+            KEY_TYPE key1 = (KEY_TYPE(byte) << 8);
+            KEY_LAYOUT& layout1 = byte1[byte];
+            fill_n(layout1.field_size, static_cast<size_t>(NUM_FIELDS), 0);
+            layout1.field_size[FIELD_INSTRUCTION_ADDR] = ((key1 & READ_INSTRUCTION_ADDR) ? NBYTE(uint32_t) : 0);
+            layout1.field_size[FIELD_SRC1_VAL]         = ((key1 & READ_SRC1_VAL) ? NBYTE(uint32_t) : 0);
+            layout1.field_size[FIELD_VADDR2]           = ((key1 & READ_VADDR2) ? NBYTE(uint32_t) : 0);
+            layout1.field_size[FIELD_BRANCH_TARGET]    = TYPE_SIZE[(key1 & MASK_BRANCH_TARGET) >> 9];
+
+            layout0.size = 0;
+            layout1.size = 0;
+            for (int field = 0; field < NUM_FIELDS; ++field) {
+                layout0.field_offset[field] = layout0.size;
+                layout1.field_offset[field] = layout1.size;
+                layout0.size += layout0.field_size[field];
+                layout1.size += layout1.field_size[field];
+            }
+        }
+    }
+
     inline bool
     CBP_INST_STREAM::read(CBP_INST* inst_arg)
     {
-        size_t bytes_needed;
-    
-        // read the first byte
-        if (fread(&buffer[0], sizeof(uint8_t), 1, stream) != 1)
+        // make the first byte available
+        if ((window_head == window_tail) && !fill_window(1))
             return /* failure */ false;
     
-        // get the first byte of the key
-        key = buffer[0];
-    
-        // compute the number of extra bytes needed for the first byte of the key
-        bytes_needed = ((key & TWO_BYTE_KEY) ? 1 : 0);
-        switch (MASK_DST_VAL & key) {
-          case TYPE0_DST_VAL:   // 0 byte encoding
-            break;
-          case TYPE1_DST_VAL:   // 1 byte encoding
-            bytes_needed += NBYTE(uint8_t);
-            break;
-          case TYPE2_DST_VAL:   // 2 byte encoding
-            bytes_needed += NBYTE(uint16_t);
-            break;
-          case READ_DST_VAL:    // 4 byte encoding
-            bytes_needed += NBYTE(inst.dst_val);
-            break;
-          default:
-            CBP_FATAL("invalid key");
-            break;
-        }
-        switch (MASK_VADDR1 & key) {
-          case TYPE0_VADDR1:   // 0 byte encoding
-            break;
-          case TYPE1_VADDR1:   // 1 byte encoding
-            bytes_needed += NBYTE(uint8_t);
-            break;
-          case TYPE2_VADDR1:   // 2 byte encoding
-            bytes_needed += NBYTE(uint16_t);
-            break;
-          case READ_VADDR1:    // 4 byte encoding
-            bytes_needed += NBYTE(inst.src_vaddr);
-            break;
-          default:
-            CBP_FATAL("invalid key");
-            break;
-        }
-        bytes_needed += ((READ_SRC2_VAL & key) ? NBYTE(inst.src2_val) : 0);
-        static const size_t STATIC_INFO_SIZE = (0
-            + NBYTE(static_info->src1)
-            + NBYTE(static_info->src2)
-            + NBYTE(static_info->dst)
-            + NBYTE(static_info->mem_src1)
-            + NBYTE(static_info->mem_src2)
-            + NBYTE(static_info->mem_src3)
-            + NBYTE(STATIC_INFO::BIT_FIELD_TYPE)
-            + NBYTE(static_info->instruction_addr)
-            + NBYTE(static_info->instruction_next_addr)
-            + NBYTE(static_info->branch_target));
-        bytes_needed += ((key & READ_STATIC_INFO) ? STATIC_INFO_SIZE : 0);
-    
-        // read the extra bytes needed for the first byte of the key
-        if (fread(&buffer[1], sizeof(uint8_t), bytes_needed, stream) != bytes_needed)
+        // make the key and the fields selected by its first byte available
+        const KEY_LAYOUT* layout0 = &key_tables.byte0[window_head[0]];
+        if (!fill_window(layout0->size))
             return /* failure */ false;
     
-        // if the key is only one byte, we're done--go get the instruction
-        if (/* 1-byte key */ (0 == (TWO_BYTE_KEY & key)))
-            goto get_cbp_inst; 
+        // get the key; a 1-byte key selects none of the second byte's fields
+        key = window_head[0];
+        uint8_t key_byte_1 = ((TWO_BYTE_KEY & key) ? window_head[1] : 0);
+        key |= (KEY_TYPE(key_byte_1) << 8);
+        const KEY_LAYOUT* layout1 = &key_tables.byte1[key_byte_1];
     
-        // get the second byte of the key
-        key |= (KEY_TYPE(buffer[1]) << 8);
-    
-        // store the current buffer position in buffer_tail
-        buffer_tail = (&buffer[1] + bytes_needed);
-    
-        // compute the number of extra bytes needed for the second byte of the key
-        bytes_needed = ((READ_INSTRUCTION_ADDR & key) ? NBYTE(inst.instruction_addr) : 0);
-        switch (MASK_BRANCH_TARGET & key) {
-          case TYPE0_BRANCH_TARGET:   // 0 byte encoding
-            break;
-          case TYPE1_BRANCH_TARGET:   // 1 byte encoding
-            bytes_needed += NBYTE(uint8_t);
-            break;
-          case TYPE2_BRANCH_TARGET:   // 2 byte encoding
-            bytes_needed += NBYTE(uint16_t);
-            break;
-          case READ_BRANCH_TARGET:    // 4 byte encoding
-            bytes_needed += NBYTE(inst.branch_target);
-            break;
-          default:
-            CBP_FATAL("invalid key");
-            break;
-        }
-        bytes_needed += ((READ_SRC1_VAL & key) ? NBYTE(inst.src1_val) : 0);
-        bytes_needed += ((READ_VADDR2 & key) ? NBYTE(inst.dst_vaddr) : 0);
-    
-        // read the extra bytes needed for the second byte of the key
-        if (fread(buffer_tail, sizeof(uint8_t), bytes_needed, stream) != bytes_needed)
+        // make the fields selected by the second byte of the key available
+        size_t record_size = (layout0->size + layout1->size);
+        if (!fill_window(record_size))
             return /* failure */ false;
     
-      get_cbp_inst:
-        buffer_tail = ((TWO_BYTE_KEY & key) ? &buffer[2] : &buffer[1]);
+        // lay out the record; the first byte's table row already holds the
+        // offsets for a 1-byte key
+        record = window_head;
+        field_offset = layout0->field_offset;
+        if (TWO_BYTE_KEY & key) {
+            for (int field = 0; field < NUM_FIELDS; ++field)
+                two_byte_key_offset[field] = (layout0->field_offset[field] + layout1->field_offset[field]);
+            field_offset = two_byte_key_offset;
+        }
     
         get_instruction_addr();
         get_static_info();
@@ -1225,6 +1312,9 @@ namespace cbp
         get_taken();
         get_branch_target();
     
+        window_head += record_size;
+        stat_bytes += record_size;
+
         *inst_arg = inst;
     
         update_statistics();
@@ -1270,12 +1360,144 @@ namespace cbp
         // write the buffer
         size_t buffer_size = (buffer_tail - buffer_head);
         bool success = (fwrite(buffer_head, sizeof(uint8_t), buffer_size, stream) == buffer_size);
+        stat_bytes += buffer_size;
     
         update_statistics();
     
         return success;
     }
     
+    void
+    CBP_INST_STREAM::get_state_blocks(STATE_BLOCK* blocks, uint32_t* static_info_index)
+    {
+        STATE_BLOCK* block = blocks;
+        block->data = reinterpret_cast<uint8_t*>(&inst);                   block->size = sizeof(inst);                   ++block;
+        block->data = reinterpret_cast<uint8_t*>(static_info_index);       block->size = sizeof(*static_info_index);     ++block;
+        block->data = reinterpret_cast<uint8_t*>(static_info_cache);       block->size = sizeof(static_info_cache);      ++block;
+        block->data = reinterpret_cast<uint8_t*>(register_file);           block->size = sizeof(register_file);          ++block;
+        block->data = reinterpret_cast<uint8_t*>(&dst_val_stride_pred);    block->size = sizeof(dst_val_stride_pred);    ++block;
+        block->data = reinterpret_cast<uint8_t*>(&dst_val_l0);             block->size = sizeof(dst_val_l0);             ++block;
+        block->data = reinterpret_cast<uint8_t*>(&dst_val_l1);             block->size = sizeof(dst_val_l1);             ++block;
+        block->data = reinterpret_cast<uint8_t*>(&vaddr1_stride_pred);     block->size = sizeof(vaddr1_stride_pred);     ++block;
+        block->data = reinterpret_cast<uint8_t*>(&vaddr1_l0);              block->size = sizeof(vaddr1_l0);              ++block;
+        block->data = reinterpret_cast<uint8_t*>(&vaddr1_l1);              block->size = sizeof(vaddr1_l1);              ++block;
+        block->data = reinterpret_cast<uint8_t*>(&taken_cond_pred);        block->size = sizeof(taken_cond_pred);        ++block;
+        block->data = reinterpret_cast<uint8_t*>(&branch_target_ret_pred); block->size = sizeof(branch_target_ret_pred); ++block;
+        block->data = reinterpret_cast<uint8_t*>(&branch_target_ind_pred); block->size = sizeof(branch_target_ind_pred); ++block;
+        block->data = reinterpret_cast<uint8_t*>(&branch_target_l0);       block->size = sizeof(branch_target_l0);       ++block;
+        block->data = reinterpret_cast<uint8_t*>(&branch_target_l1);       block->size = sizeof(branch_target_l1);       ++block;
+        // the statistics are declared back to back, from stat_cbp_inst to stat_bytes
+        block->data = reinterpret_cast<uint8_t*>(&stat_cbp_inst);
+        block->size = (((&stat_bytes - &stat_cbp_inst) + 1) * sizeof(EVENT_COUNTER));
+        ++block;
+        CBP_ASSERT(block == (blocks + NUM_STATE_BLOCKS));
+    }
+
+    void
+    CBP_INST_STREAM::get_state_image(vector<uint8_t>* image)
+    {
+        STATE_BLOCK blocks[NUM_STATE_BLOCKS];
+        uint32_t static_info_index = static_cast<uint32_t>(static_info - static_info_cache);
+        get_state_blocks(blocks, &static_info_index);
+        image->clear();
+        for (int i = 0; i < NUM_STATE_BLOCKS; ++i)
+            image->insert(image->end(), blocks[i].data, (blocks[i].data + blocks[i].size));
+    }
+
+    void
+    CBP_INST_STREAM::set_state_image(const vector<uint8_t>& image)
+    {
+        STATE_BLOCK blocks[NUM_STATE_BLOCKS];
+        uint32_t static_info_index = 0;
+        get_state_blocks(blocks, &static_info_index);
+        const uint8_t* data = &image[0];
+        for (int i = 0; i < NUM_STATE_BLOCKS; ++i) {
+            memcpy(blocks[i].data, data, blocks[i].size);
+            data += blocks[i].size;
+        }
+        if (static_info_index >= STATIC_INFO_CACHE_SIZE)
+            CBP_FATAL("corrupt decoder state");
+        static_info = (static_info_cache + static_info_index);
+    }
+
+    // The state is the size of the image, then runs, each of which is the
+    // number of zero bytes, the number of literal bytes, and the literal
+    // bytes, of the image xor the image of a new stream.
+    void
+    CBP_INST_STREAM::save_state(vector<uint8_t>* state)
+    {
+        vector<uint8_t> image;
+        get_state_image(&image);
+        CBP_INST_STREAM* new_stream = new CBP_INST_STREAM(static_cast<TRACE_SOURCE*>(0));
+        vector<uint8_t> new_image;
+        new_stream->get_state_image(&new_image);
+        delete new_stream;
+        for (size_t i = 0; i < image.size(); ++i)
+            image[i] ^= new_image[i];
+
+        state->clear();
+        uint64_t image_size = image.size();
+        state->insert(state->end(), reinterpret_cast<uint8_t*>(&image_size),
+                      (reinterpret_cast<uint8_t*>(&image_size) + sizeof(image_size)));
+        size_t i = 0;
+        while (i < image.size()) {
+            size_t zeros_start = i;
+            while ((i < image.size()) && (0 == image[i]))
+                ++i;
+            // the literals end at the next run of MIN_ZERO_RUN zeros, or at the end
+            size_t literals_start = i;
+            size_t zeros = 0;
+            while ((i < image.size()) && (zeros < MIN_ZERO_RUN)) {
+                zeros = ((0 == image[i]) ? (zeros + 1) : 0);
+                ++i;
+            }
+            i -= zeros;
+            uint32_t run[2] = { static_cast<uint32_t>(literals_start - zeros_start),
+                                static_cast<uint32_t>(i - literals_start) };
+            state->insert(state->end(), reinterpret_cast<uint8_t*>(run),
+                          (reinterpret_cast<uint8_t*>(run) + sizeof(run)));
+            state->insert(state->end(), (image.begin() + literals_start), (image.begin() + i));
+        }
+    }
+
+    bool
+    CBP_INST_STREAM::restore_state(const uint8_t* state, size_t size)
+    {
+        if ((0 != stat_bytes) || (window_head != window_tail))
+            CBP_FATAL("a decoder state can only be restored into a new stream");
+
+        vector<uint8_t> image;
+        get_state_image(&image);
+        uint64_t image_size;
+        if (size < sizeof(image_size))
+            return false;
+        memcpy(&image_size, state, sizeof(image_size));
+        if (image_size != image.size())
+            return false;
+        size_t offset = 0;
+        const uint8_t* head = (state + sizeof(image_size));
+        const uint8_t* tail = (state + size);
+        while (offset < image.size()) {
+            uint32_t run[2];
+            if (static_cast<size_t>(tail - head) < sizeof(run))
+                return false;
+            memcpy(run, head, sizeof(run));
+            head += sizeof(run);
+            if ((run[0] > (image.size() - offset)) || (run[1] > (image.size() - offset - run[0]))
+                || (run[1] > static_cast<size_t>(tail - head)))
+                return false;
+            offset += run[0];
+            for (uint32_t i = 0; i < run[1]; ++i)
+                image[offset + i] ^= head[i];
+            offset += run[1];
+            head += run[1];
+        }
+        if (head != tail)
+            return false;
+        set_state_image(image);
+        return true;
+    }
+    
     inline string
     CBP_INST_STREAM::get_statistics_string(void) const
     {
@@ -1303,6 +1525,9 @@ namespace cbp
         stream << "READ_BRANCH_TARGET    " << stat_read_branch_target << "\n";
         stream << "READ_SRC1_VAL         " << stat_read_src1_val << "\n";
         stream << "READ_VADDR2           " << stat_read_vaddr2 << "\n";
+        stream << "BYTES                 " << stat_bytes << "\n";
+        stream << "BYTES_PER_CBP_INST    "
+               << (stat_cbp_inst ? (double(stat_bytes) / stat_cbp_inst) : 0.0) << "\n";
         stream << "----------------------------------------";
         stream << "----------------------------------------\n";
 
@@ -1317,6 +1542,12 @@ namespace cbp
         return new CBP_INST_STREAM(stream);
     }
     
+    CBP_INST_STREAM*
+    cbp_inst_open(TRACE_SOURCE* source)
+    {
+        return new CBP_INST_STREAM(source);
+    }
+    
     FILE*
     cbp_inst_close(CBP_INST_STREAM* stream)
     {
@@ -1337,6 +1568,26 @@ namespace cbp
         return stream->write(inst);
     }
     
+    uint64_t
+    cbp_inst_get_bytes(const CBP_INST_STREAM* stream)
+    {
+        return stream->get_bytes();
+    }
+    
+    void
+    cbp_inst_save_state(const CBP_INST_STREAM* stream, vector<uint8_t>* state)
+    {
+        // saving only reads the stream's state, but gathers it with the
+        // functions restoring uses to scatter it
+        const_cast<CBP_INST_STREAM*>(stream)->save_state(state);
+    }
+    
+    bool
+    cbp_inst_restore_state(CBP_INST_STREAM* stream, const uint8_t* state, size_t size)
+    {
+        return stream->restore_state(state, size);
+    }
+    
     bool
     cbp_inst_print_statistics(FILE* stream, const CBP_INST_STREAM* cbp_inst_stream)
     {
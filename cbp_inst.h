@@ -7,8 +7,10 @@
 #ifndef CBP_INST_H_SEEN
 #define CBP_INST_H_SEEN
 
+#include <cstddef>
 #include <cstdio>
 #include <inttypes.h>
+#include <vector>
 
 namespace cbp
 {
@@ -79,7 +81,14 @@ namespace cbp
     // pointer to it.
     CBP_INST_STREAM* cbp_inst_open(std::FILE* stream);
     
-    // Destructs 'stream'.  Returns the std::FILE* that was used to construct 'stream'.
+    // Constructs an input-only CBP_INST_STREAM that reads from 'source' (see
+    // trace_source.h) and returns a pointer to it.  It is the client's
+    // responsibility to delete 'source' after the stream is closed.
+    class TRACE_SOURCE;
+    CBP_INST_STREAM* cbp_inst_open(TRACE_SOURCE* source);
+    
+    // Destructs 'stream'.  Returns the std::FILE* that was used to construct 'stream',
+    // or 0 if it was constructed from a TRACE_SOURCE.
     // It is the client's responsibility to close this std::FILE*.
     std::FILE* cbp_inst_close(CBP_INST_STREAM* stream);
     
@@ -89,6 +98,21 @@ namespace cbp
     // Writes 'inst' to 'stream'.  Returns true on success and false on failure.
     bool cbp_inst_write(CBP_INST_STREAM* stream, const CBP_INST* inst);
     
+    // Returns the number of bytes read from or written to 'stream' so far.
+    uint64_t cbp_inst_get_bytes(const CBP_INST_STREAM* stream);
+    
+    // Decoder checkpoints (see trace_index.h).  cbp_inst_save_state() stores
+    // the state of input stream 'stream' -- everything its predictors and
+    // caches have learned, and its statistics -- in 'state'.  The state is
+    // encoded as its difference from the state of a newly opened stream, which
+    // is mostly zeros, with the zeros run-length coded.
+    // cbp_inst_restore_state() restores such a state into 'stream', which must
+    // be newly opened, on a source that starts where the saved stream was
+    // (cbp_inst_get_bytes() bytes into the trace).  Returns false if 'state'
+    // was not saved by this build.
+    void cbp_inst_save_state(const CBP_INST_STREAM* stream, std::vector<uint8_t>* state);
+    bool cbp_inst_restore_state(CBP_INST_STREAM* stream, const uint8_t* state, std::size_t size);
+    
     // Writes the statistics for 'cbp_inst_stream' to 'stream'.  Returns true on success and
     // false on failure.  This function is used for debugging.
     bool cbp_inst_print_statistics(std::FILE* stream, const CBP_INST_STREAM* cbp_inst_stream);
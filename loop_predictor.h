@@ -0,0 +1,298 @@
+/* Description: This file defines the loop predictor of L-TAGE, shared by the
+ * GEHL predictor in predictor.h and the TAGE predictor in tage_predictor.h: a
+ * small skewed associative table of loop_entry's, each of which learns the
+ * iteration count of a loop and predicts its exit.
+ */
+
+#ifndef LOOP_PREDICTOR_H_SEEN
+#define LOOP_PREDICTOR_H_SEEN
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <inttypes.h>
+
+class loop_entry {
+public:
+  uint16_t PastIter;		// 10 bits
+  uint8_t conf;		      // 2 bits
+  uint16_t CurIter;		  // 10 bits
+
+  uint16_t TAG;			    // 12 bits
+  uint8_t age;			    // 4 bits
+  bool dir;			        // 1 bit
+
+  // 39 bits per entry
+  static const int BITS = 39;
+  loop_entry () {
+    conf = 0;
+    CurIter = 0;
+    PastIter = 0;
+    TAG = 0;
+    age = 0;
+    dir = false;
+  }
+
+};
+
+// The loop predictor's table of ENTRIES loop_entry's, kept as structs or, if
+// PACKED, in exactly loop_entry::BITS bits each.  Entries are read and
+// written whole, with get() and set(); packed entries, like packed counters
+// (see PHT_STORAGE), take one unaligned 64-bit access on a little-endian
+// machine.
+template <int ENTRIES, bool PACKED>
+class LOOP_TABLE {
+public:
+  // The bits the entries take
+  static constexpr std::size_t BITS = PACKED ? std::size_t(ENTRIES) * loop_entry::BITS
+                                             : 8 * sizeof(loop_entry) * ENTRIES;
+
+private:
+  // A packed entry: PastIter, conf, CurIter, TAG, age, then dir, from bit 0 up
+  static const int CONF_SHIFT = 10;
+  static const int CURITER_SHIFT = 12;
+  static const int TAG_SHIFT = 22;
+  static const int AGE_SHIFT = 34;
+  static const int DIR_SHIFT = 38;
+
+  std::array<loop_entry, PACKED ? 0 : ENTRIES> entries;
+  std::array<uint8_t, PACKED ? (BITS + 7) / 8 + 8 : 0> packed;
+
+  static uint64_t field(uint64_t bits, int shift, int width) {
+    return (bits >> shift) & ((uint64_t(1) << width) - 1);
+  }
+
+public:
+  LOOP_TABLE(void) {
+    packed.fill(0);
+  }
+  // uses compiler generated copy constructor
+  // uses compiler generated destructor
+  // uses compiler generated assignment operator
+
+  loop_entry get(int index) const {
+    if constexpr (!PACKED) {
+      return entries[index];
+    } else {
+      std::size_t bit = std::size_t(index) * loop_entry::BITS;
+      uint64_t bits;
+      memcpy(&bits, &packed[bit / 8], sizeof(bits));
+      bits >>= bit % 8;
+      loop_entry entry;
+      entry.PastIter = field(bits, 0, 10);
+      entry.conf = field(bits, CONF_SHIFT, 2);
+      entry.CurIter = field(bits, CURITER_SHIFT, 10);
+      entry.TAG = field(bits, TAG_SHIFT, 12);
+      entry.age = field(bits, AGE_SHIFT, 4);
+      entry.dir = field(bits, DIR_SHIFT, 1);
+      return entry;
+    }
+  }
+  void prefetch(int index) const {
+    if constexpr (!PACKED)
+      __builtin_prefetch(&entries[index]);
+    else
+      __builtin_prefetch(&packed[std::size_t(index) * loop_entry::BITS / 8]);
+  }
+  void set(int index, const loop_entry& entry) {
+    if constexpr (!PACKED) {
+      entries[index] = entry;
+    } else {
+      std::size_t bit = std::size_t(index) * loop_entry::BITS;
+      uint64_t bits = field(entry.PastIter, 0, 10) | (field(entry.conf, 0, 2) << CONF_SHIFT) |
+                      (field(entry.CurIter, 0, 10) << CURITER_SHIFT) | (field(entry.TAG, 0, 12) << TAG_SHIFT) |
+                      (field(entry.age, 0, 4) << AGE_SHIFT) | (uint64_t(entry.dir) << DIR_SHIFT);
+      uint64_t word;
+      memcpy(&word, &packed[bit / 8], sizeof(word));
+      uint64_t mask = ((uint64_t(1) << loop_entry::BITS) - 1) << (bit % 8);
+      word = (word & ~mask) | (bits << (bit % 8));
+      memcpy(&packed[bit / 8], &word, sizeof(word));
+    }
+  }
+};
+
+// The loop predictor: 1 << LOG_ENTRIES loop_entry's, 4 ways of a set.  Its
+// prediction is only worth using when valid(); the predictor that owns it
+// decides (WITHLOOP, in L-TAGE) whether to use it.
+template <int LOG_ENTRIES, bool PACKED>
+class LOOP_PREDICTOR {
+public:
+  typedef uint32_t address_t;
+
+  static const int WIDTH_ITER_LOOP = 10; // we predict only loops with less than 1K iterations
+  static const int LOOP_TAG_WIDTH  = 12; // tag width in the loop predictor
+  static const int LOOP_CONFIDENCE = 3;  // Max Confidence in a loop prediction
+  static const int MAX_AGE         = 15; // Max Age of a loop prediction
+
+  // The bits the table is budgeted
+  static constexpr std::size_t BUDGET_BITS = (std::size_t(1) << LOG_ENTRIES) * loop_entry::BITS;
+
+private:
+  // Loop Predictor Table
+  LOOP_TABLE<1 << LOG_ENTRIES, PACKED> ltable;
+
+  // Per Branch Variables used in both getting and updating prediction
+  bool LVALID;			          // validity of the loop predictor prediction
+  bool predloop;			        // loop predictor prediction
+  int LIB;
+  int LI;
+  int LHIT;			      // hitting way in the loop predictor
+  int LTAG;			      // tag on the loop predictor
+
+  static int lindex(address_t pc) {
+    return (((pc ^ (pc >> 2)) & ((1 << (LOG_ENTRIES - 2)) - 1)) << 2);
+  }
+
+  static int lbank(address_t pc) {
+    return ((pc >> (LOG_ENTRIES - 2)) & ((1 << (LOG_ENTRIES - 2)) - 1));
+  }
+
+  // loop prediction: only used if high confidence
+  // skewed associative 4-way
+  // At fetch time: speculative
+  bool get_loop_pred(address_t pc) {
+      LHIT = -1;
+
+      LI = lindex (pc);
+      LIB = lbank(pc);
+      LTAG = (pc >> (LOG_ENTRIES - 2)) & ((1 << 2 * LOOP_TAG_WIDTH) - 1);
+      LTAG ^= (LTAG >> LOOP_TAG_WIDTH);
+      LTAG = (LTAG & ((1 << LOOP_TAG_WIDTH) - 1));
+
+      for (int i = 0; i < 4; i++) {
+        int index = (LI ^ ((LIB >> i) << 2)) + i;
+        loop_entry entry = ltable.get(index);
+        if (entry.TAG == LTAG) {
+          LHIT = i;
+          LVALID = ((entry.conf == LOOP_CONFIDENCE)
+                    || (entry.conf * entry.PastIter > 128));
+          if (entry.CurIter + 1 == entry.PastIter) {
+            return !(entry.dir);
+          }
+          return entry.dir;
+        }
+      }
+      LVALID = false;
+      return false;
+  }
+
+public:
+  LOOP_PREDICTOR(void)
+    : LVALID(false)
+    , predloop(false)
+    , LIB(0)
+    , LI(0)
+    , LHIT(-1)
+    , LTAG(0)
+  {
+  }
+  // uses compiler generated copy constructor
+  // uses compiler generated destructor
+  // uses compiler generated assignment operator
+
+  // Predicts the branch at pc
+  bool get_prediction(address_t pc) {
+    predloop = get_loop_pred(pc);
+    return predloop;
+  }
+  // Whether the last prediction is confident enough to use, and what it was
+  bool valid(void) const {
+    return LVALID;
+  }
+  bool prediction(void) const {
+    return predloop;
+  }
+
+  // Updates the entry of the last prediction with the branch's outcome
+  // (taken); alloc asks for an entry if there wasn't one.  base_prediction is
+  // the prediction the loop predictor would override; random() returns the
+  // owner's random numbers.
+  template <class RANDOM>
+  void update(bool taken, bool alloc, bool base_prediction, RANDOM random) {
+    if (LHIT >= 0) {
+      int index = (LI ^ ((LIB >> LHIT) << 2)) + LHIT;
+      loop_entry entry = ltable.get(index);
+      //already a hit
+      if (LVALID) {
+        if (taken != predloop) {
+          // free the entry
+          entry.PastIter = 0;
+          entry.age = 0;
+          entry.conf = 0;
+          entry.CurIter = 0;
+          ltable.set(index, entry);
+          return;
+	      }	else if ((predloop != base_prediction) || ((random () & 7) == 0))
+          if (entry.age < MAX_AGE)
+            entry.age++;
+      }
+
+      entry.CurIter++;
+      entry.CurIter &= ((1 << WIDTH_ITER_LOOP) - 1);
+      // loop with more than 2** WIDTH_ITER_LOOP iterations are not treated correctly; but who cares :-)
+      if (entry.CurIter > entry.PastIter) {
+        entry.conf = 0;
+        entry.PastIter = 0;
+        // treat like the 1st encounter of the loop
+      }
+      if (taken != entry.dir) {
+        if (entry.CurIter == entry.PastIter) {
+          if (entry.conf < LOOP_CONFIDENCE)
+            entry.conf++;
+          //just do not predict when the loop count is 1 or 2
+          if (entry.PastIter < 3) {
+            // free the entry
+            entry.dir = taken;
+            entry.PastIter = 0;
+            entry.age = 0;
+            entry.conf = 0;
+          }
+	      }	else {
+          if (entry.PastIter == 0) {
+            // first complete nest;
+            entry.conf = 0;
+            entry.PastIter = entry.CurIter;
+          }	else {
+            //not the same number of iterations as last time: free the entry
+            entry.PastIter = 0;
+            entry.conf = 0;
+          }
+	      }
+        entry.CurIter = 0;
+      }
+      ltable.set(index, entry);
+    } else if (alloc) {
+      address_t X = random () & 3;
+      if ((random () & 3) == 0)
+        for (int i = 0; i < 4; i++) {
+          int LHIT = (X + i) & 3;
+          int index = (LI ^ ((LIB >> LHIT) << 2)) + LHIT;
+          loop_entry entry = ltable.get(index);
+          if (entry.age == 0)	{
+            entry.dir = !taken;
+            // most of mispredictions are on last iterations
+            entry.TAG = LTAG;
+            entry.PastIter = 0;
+            entry.age = 7;
+            entry.conf = 0;
+            entry.CurIter = 0;
+            ltable.set(index, entry);
+            break;
+          }	else
+            entry.age--;
+          ltable.set(index, entry);
+          break;
+        }
+    }
+  }
+
+  // Prefetches the set the prediction of the branch at pc reads
+  void prefetch(address_t pc) const {
+    int li = lindex(pc);
+    int lib = lbank(pc);
+    for (int i = 0; i < 4; i++)
+      ltable.prefetch((li ^ ((lib >> i) << 2)) + i);
+  }
+};
+
+#endif // LOOP_PREDICTOR_H_SEEN
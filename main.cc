@@ -2,45 +2,485 @@
  * Description: Branch predictor driver.
 */
 
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "branch_cache.h"
+#include "branch_columns.h"
+#include "op_state.h"
+#include "predictor_set.h"
+#include "predictor_snapshot.h"
+#include "spsc_ring.h"
 #include "tread.h"
+#include "work_pool.h"
 
-// include and define the predictor
+// include and define the predictor; predictor points at it, or at the
+// predictor restored from a snapshot (-r)
 #include "predictor.h"
-PREDICTOR predictor;
+PREDICTOR predictor_instance;
+PREDICTOR* predictor = &predictor_instance;
 
-// usage: predictor <trace>
-int
-main(int argc, char* argv[])
+// one decoded branch, handed from the decode thread to the predictor thread
+struct pipeline_slot_c
 {
-    using namespace std;
+    branch_record_c br;
+    bool            taken;
+    uint            num_insts;    // instructions decoded up to and including this branch
+    bool            last;         // end of trace: only num_insts is valid
+    op_state_c     *osptr;        // op_state snapshot at this branch (-s), else null
+};
 
-    if (2 != argc) {
-        printf("usage: %s <trace>\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
+const uint g_pipeline_slots = 1024;
 
-    cbp_trace_reader_c cbptr = cbp_trace_reader_c(argv[1]);
+// Read the trace, one branch at a time, and run the predictor on each branch,
+// up to the branch that reaches instruction end_insts.  If snapshot_file isn't
+// null, the predictor is saved to it, with the trace position and statistics,
+// after the branch that reaches instruction snapshot_insts.
+void
+run_serial(branch_reader_c* cbptr, const char* snapshot_file, uint64_t snapshot_insts, uint64_t end_insts)
+{
     branch_record_c br;
 
     // read the trace, one branch at a time, placing the branch info in br
-    while (cbptr.get_branch_record(&br)) {
+    while ((cbptr->get_position().insts < end_insts) && cbptr->get_branch_record(&br)) {
 
         // ************************************************************
         // Competing predictors must have the following methods:
         // ************************************************************
 
         // get_prediction() returns the prediction your predictor would like to make
-        bool predicted_taken = predictor.get_prediction(&br, cbptr.osptr);
+        bool predicted_taken = predictor->get_prediction(&br, cbptr->osptr);
 
         // predict_branch() tells the trace reader how you have predicted the branch
-        bool actual_taken    = cbptr.predict_branch(predicted_taken);
+        bool actual_taken    = cbptr->predict_branch(predicted_taken);
             
         // finally, update_predictor() is used to update your predictor with the
         // correct branch result
-        predictor.update_predictor(&br, cbptr.osptr, actual_taken);
+        predictor->update_predictor(&br, cbptr->osptr, actual_taken);
+
+        if (snapshot_file && (cbptr->get_position().insts >= snapshot_insts)) {
+            cbptr->score_pending_prediction(&br);
+            write_predictor_snapshot(snapshot_file, *predictor, cbptr);
+            snapshot_file = 0;
+        }
+    }
+    // the last branch is yet to be scored if the run ended before the trace did
+    cbptr->score_pending_prediction(&br);
+    if (snapshot_file)
+        fprintf(stderr, "the run ends before instruction %llu; no snapshot saved\n",
+                (unsigned long long)snapshot_insts);
+}
+
+// Run segment_predictor on the branches of the trace up to the one that reaches
+// instruction end_insts, or to the end of the trace; br holds the last branch read.
+void
+run_to_insts(branch_reader_c* cbptr, PREDICTOR* segment_predictor, uint64_t end_insts, branch_record_c* br)
+{
+    while ((cbptr->get_position().insts < end_insts) && cbptr->get_branch_record(br)) {
+        bool predicted_taken = segment_predictor->get_prediction(br, cbptr->osptr);
+        bool actual_taken    = cbptr->predict_branch(predicted_taken);
+        segment_predictor->update_predictor(br, cbptr->osptr, actual_taken);
+    }
+    cbptr->score_pending_prediction(br);
+}
+
+// The results of one task of run_segmented(): the statistics of each segment it
+// scored, the instruction the first of them starts after, and how long it took.
+struct segment_result_c
+{
+    std::vector<cbp_stats_c> stats;
+    uint64_t first_insts;
+    double seconds;
+};
+
+// Simulate segments contiguous segments of the trace at once, each with its own
+// reader and a cold PREDICTOR that is warmed up, unscored, over the warmup_insts
+// instructions before its segment, and merge their statistics.  With exact, the
+// whole trace is also run serially alongside, and each segment's mispredict rate
+// and the merged one are reported against the exact ones, to choose a warm-up
+// that keeps the error in bounds.  make_reader() opens another reader of the trace.
+template <class MAKE_READER>
+void
+run_segmented(MAKE_READER make_reader, uint segments, uint64_t warmup_insts, bool exact)
+{
+    using namespace std;
+
+    // the segments split the trace's instructions evenly, taking the count from
+    // the header of the branch cache or columnar trace, or from the trace's index;
+    // without either, counting them would decode the whole trace, serially, first
+    branch_reader_c* count_reader = make_reader();
+    count_reader->set_report(false);
+    uint64_t total_insts = count_reader->get_trace_insts();
+    delete count_reader;
+    if (total_insts == 0) {
+        fprintf(stderr, "-T needs the trace's instruction count: use -c or -b, or index the trace "
+                        "with trace_convert\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t segment_insts = (total_insts + segments - 1) / segments;
+    vector<uint64_t> bounds(segments + 1);
+    for (uint i = 0; i < segments; i++)
+        bounds[i] = i * segment_insts;
+    bounds[segments] = ~uint64_t(0);
+
+    // segment i runs from just after the branch that reaches instruction
+    // bounds[i] to the branch that reaches bounds[i + 1], as -x and -n would
+    vector<segment_result_c> results(segments + 1);
+    cbp::WORK_POOL pool;
+    if (exact) {
+        // the longest task goes first
+        pool.add([&]() {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            branch_reader_c* cbptr = make_reader();
+            cbptr->set_report(false);
+            PREDICTOR* exact_predictor = new PREDICTOR();
+            branch_record_c br;
+            for (uint i = 0; i < segments; i++) {
+                run_to_insts(cbptr, exact_predictor, bounds[i + 1], &br);
+                results[segments].stats.push_back(cbptr->get_stats());
+                cbptr->set_stats(cbp_stats_c());
+            }
+            delete exact_predictor;
+            delete cbptr;
+            results[segments].seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        });
+    }
+    for (uint i = 0; i < segments; i++) {
+        pool.add([&, i]() {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            branch_reader_c* cbptr = make_reader();
+            cbptr->set_report(false);
+            PREDICTOR* segment_predictor = new PREDICTOR();
+            branch_record_c br;
+            cbptr->skip_to_insts((bounds[i] > warmup_insts) ? (bounds[i] - warmup_insts) : 0);
+            run_to_insts(cbptr, segment_predictor, bounds[i], &br);
+            cbptr->set_stats(cbp_stats_c());
+            results[i].first_insts = cbptr->get_position().insts;
+            run_to_insts(cbptr, segment_predictor, bounds[i + 1], &br);
+            results[i].stats.push_back(cbptr->get_stats());
+            delete segment_predictor;
+            delete cbptr;
+            results[i].seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        });
+    }
+    pool.run(segments + (exact ? 1 : 0));
+
+    cbp_stats_c merged;
+    cbp_stats_c merged_exact;
+    double seconds = 0;
+    for (uint i = 0; i < segments; i++) {
+        const cbp_stats_c& stats = results[i].stats[0];
+        printf("segment %2u: insts %9llu to %9llu, mpki %7.3f", i, (unsigned long long)results[i].first_insts,
+               (unsigned long long)(results[i].first_insts + stats.stat_num_insts), stats.get_mpki());
+        if (exact) {
+            const cbp_stats_c& exact_stats = results[segments].stats[i];
+            printf(", exact %7.3f, error %+7.3f", exact_stats.get_mpki(), stats.get_mpki() - exact_stats.get_mpki());
+            merged_exact.add(exact_stats);
+        }
+        printf("\n");
+        merged.add(stats);
+        if (results[i].seconds > seconds)
+            seconds = results[i].seconds;
+    }
+    printf("*********************************************************\n");
+    merged.print();
+    printf("segments:                        %8u\n", segments);
+    printf("warm-up insts:                   %8llu\n", (unsigned long long)warmup_insts);
+    printf("segmented seconds:               %8.3f\n", seconds);
+    if (exact) {
+        float exact_mpki = merged_exact.get_mpki();
+        float error = merged.get_mpki() - exact_mpki;
+        printf("exact 1000*wrong_cc_predicts/total insts: %7.3f\n", exact_mpki);
+        printf("mpki error:                      %+8.3f (%+.2f%%)\n", error,
+               exact_mpki ? (100 * error / exact_mpki) : 0.0);
+        printf("exact seconds:                   %8.3f\n", results[segments].seconds);
+    }
+    printf("*********************************************************\n");
+}
+
+// Decode the trace on its own thread and run the predictor, or, if predictors
+// isn't null, the set of predictors, on this one.  The statistics, and so the
+// mispredict rate, are the same as the serial loop's.
+// Without snapshot_op_state the predictor sees an op_state with no registers
+// or ops; with it, each branch carries a copy of the op_state as it was when
+// the branch was decoded.  With look_ahead, each update also hands the
+// predictor the next branch, if it has been decoded already.
+void
+run_pipelined(branch_reader_c* cbptr, predictor_set_c* predictors, bool snapshot_op_state,
+              bool look_ahead)
+{
+    using namespace std;
+
+    cbp::SPSC_RING<pipeline_slot_c> ring(g_pipeline_slots);
+    op_state_c empty_os;
+    empty_os.init(&empty_os);
+    for (uint i = 0; i < ring.get_capacity(); i++) {
+        ring[i].osptr = 0;
+        if (snapshot_op_state) {
+            ring[i].osptr = new op_state_c();
+            ring[i].osptr->init(ring[i].osptr);
+        }
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    thread decoder([&]() {
+        bool more = true;
+        while (more) {
+            pipeline_slot_c* slot = ring.producer_slot();
+            slot->num_insts = 0;
+            more = cbptr->decode_branch_record(&slot->br, &slot->taken, &slot->num_insts);
+            slot->last = !more;
+            if (more && slot->osptr) {
+                slot->osptr->copy_from(cbptr->osptr);
+            }
+            ring.publish();
+        }
+    });
+
+    for (;;) {
+        pipeline_slot_c* slot = ring.consumer_slot();
+        cbptr->count_insts(slot->num_insts);
+        if (predictors)
+            predictors->count_insts(slot->num_insts);
+        if (slot->last) {
+            ring.release();
+            break;
+        }
+        const op_state_c* os = slot->osptr ? slot->osptr : &empty_os;
+        const pipeline_slot_c* next = look_ahead ? ring.consumer_peek() : 0;
+        const branch_record_c* next_br = (next && !next->last) ? &next->br : 0;
+        if (predictors) {
+            predictors->predict_and_update(&slot->br, os, slot->taken, next_br);
+        }
+        else {
+            bool predicted_taken = predictor->get_prediction(&slot->br, os);
+            cbptr->score_branch(&slot->br, predicted_taken, slot->taken);
+            update_predictor_with_next(predictor, &slot->br, os, slot->taken, next_br);
+        }
+        ring.release();
+    }
+    decoder.join();
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    printf("pipeline seconds:                %8.3f\n", elapsed.count());
+    printf("decode-bound fraction:           %8.3f\n", ring.get_consumer_wait_seconds() / elapsed.count());
+    printf("predict-bound fraction:          %8.3f\n", ring.get_producer_wait_seconds() / elapsed.count());
+
+    for (uint i = 0; i < ring.get_capacity(); i++) {
+        delete ring[i].osptr;
+    }
+}
+
+// usage: predictor [-j threads | -c | -b] [-p [-s]] [-l] [-P names]
+//                  [-w snapshot -i insts] [-r snapshot [-e] | -x insts] [-n insts]
+//                  [-T segments [-W insts] [-E]] <trace>
+//   -j threads: decompress the trace's bzip2 blocks on this many threads
+//   -c: replay the trace's branch cache (<trace>.brc, see trace_convert)
+//   -b: replay the trace's columnar branch trace (<trace>.bct, see trace_convert)
+//   -p: decode the trace on a separate thread from the predictor
+//   -s: with -p, give the predictor a snapshot of op_state at each branch
+//   -l: hand the predictor the next branch as it updates each one, so it can
+//       prefetch for it (see GEHL_PREDICTOR::look_ahead); needs -p, or -P with
+//       -c or -b
+//   -P names: instead of the predictor above, evaluate the comma separated list
+//             of registered predictors (see predictor_set.cc) side by side; a
+//             name+target pairs one with a registered target predictor, which
+//             is scored on the indirect branches' targets
+//   -w snapshot -i insts: save the predictor, with the trace position and
+//             statistics, to this snapshot after the branch that reaches
+//             instruction insts (see predictor_snapshot.h)
+//   -r snapshot: restore the predictor and the trace position and statistics
+//             from this snapshot, and run the rest of the trace
+//   -e: with -r, count the statistics from the snapshot's position on, rather
+//       than from the start of the trace
+//   -x insts: start from just after the branch that reaches instruction insts,
+//             with a cold predictor and statistics counted from there; a trace
+//             with an index (<trace>.idx, see trace_convert) seeks to it
+//   -n insts: stop at the branch that reaches insts more instructions
+//   -T segments: split the trace into this many contiguous segments and run them
+//             at once, each with its own predictor, and merge their statistics;
+//             needs -c or -b, or a trace with an index, for the trace's length
+//   -W insts: with -T, warm each segment's predictor up over this many
+//             instructions before the segment, unscored (default 1000000)
+//   -E: with -T, also run the trace serially, and report each segment's and
+//       the merged mispredict rate against the exact ones
+//   -w, -r, -x and -n are for the predictor above, run serially (no -p, -P or
+//   -T)
+int
+main(int argc, char* argv[])
+{
+    using namespace std;
+
+    uint decompress_threads = 0;
+    bool use_branch_cache = false;
+    bool use_branch_columns = false;
+    bool pipelined = false;
+    bool snapshot_op_state = false;
+    bool look_ahead = false;
+    predictor_set_c predictors;
+    bool use_predictor_set = false;
+    const char* write_snapshot = 0;
+    uint64_t snapshot_insts = 0;
+    bool have_snapshot_insts = false;
+    const char* read_snapshot = 0;
+    bool fresh_stats = false;
+    uint64_t first_insts = 0;
+    uint64_t run_insts = 0;
+    bool have_run_insts = false;
+    uint segments = 0;
+    uint64_t warmup_insts = 1000000;
+    bool have_warmup_insts = false;
+    bool exact = false;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:cbpslP:w:i:r:ex:n:T:W:E")) != -1) {
+        switch (opt) {
+          case 'j':
+            decompress_threads = atoi(optarg);
+            break;
+          case 'c':
+            use_branch_cache = true;
+            break;
+          case 'b':
+            use_branch_columns = true;
+            break;
+          case 'p':
+            pipelined = true;
+            break;
+          case 's':
+            snapshot_op_state = true;
+            break;
+          case 'l':
+            look_ahead = true;
+            break;
+          case 'P':
+            use_predictor_set = true;
+            if (!predictors.add(optarg)) {
+                printf("unknown predictor in \"%s\"; the predictors are %s, the target predictors %s\n",
+                       optarg, get_branch_predictor_names().c_str(), get_target_predictor_names().c_str());
+                exit(EXIT_FAILURE);
+            }
+            break;
+          case 'w':
+            write_snapshot = optarg;
+            break;
+          case 'i':
+            snapshot_insts = strtoull(optarg, 0, 0);
+            have_snapshot_insts = true;
+            break;
+          case 'r':
+            read_snapshot = optarg;
+            break;
+          case 'e':
+            fresh_stats = true;
+            break;
+          case 'x':
+            first_insts = strtoull(optarg, 0, 0);
+            break;
+          case 'n':
+            run_insts = strtoull(optarg, 0, 0);
+            have_run_insts = true;
+            break;
+          case 'T':
+            segments = atoi(optarg);
+            if (segments == 0)
+                bad_usage = true;
+            break;
+          case 'W':
+            warmup_insts = strtoull(optarg, 0, 0);
+            have_warmup_insts = true;
+            break;
+          case 'E':
+            exact = true;
+            break;
+          default:
+            bad_usage = true;
+            break;
+        }
+    }
+
+    if (look_ahead && !pipelined && !(use_predictor_set && (use_branch_cache || use_branch_columns)))
+        bad_usage = true;
+    if ((write_snapshot != 0) != have_snapshot_insts)
+        bad_usage = true;
+    if ((fresh_stats && !read_snapshot) || (read_snapshot && (first_insts != 0)))
+        bad_usage = true;
+    if ((write_snapshot || read_snapshot || (first_insts != 0) || have_run_insts) && (pipelined || use_predictor_set))
+        bad_usage = true;
+    if ((have_warmup_insts || exact) && (segments == 0))
+        bad_usage = true;
+    if ((segments != 0) && (write_snapshot || read_snapshot || (first_insts != 0) || have_run_insts || pipelined ||
+                            use_predictor_set))
+        bad_usage = true;
+    if (bad_usage || ((optind + 1) != argc)) {
+        printf("usage: %s [-j threads | -c | -b] [-p [-s]] [-l] [-P names] [-w snapshot -i insts] "
+               "[-r snapshot [-e] | -x insts] [-n insts] [-T segments [-W insts] [-E]] <trace>\n", argv[0]);
+        exit(EXIT_FAILURE);
     }
+
+    // the reader only keeps up the op_state the predictors read
+    char* trace_name = argv[optind];
+    uint op_state_use = use_predictor_set ? predictors.get_op_state_use() : get_op_state_use<PREDICTOR>();
+    auto make_reader = [=]() -> branch_reader_c* {
+        branch_reader_c* reader;
+        if (use_branch_cache)
+            reader = new branch_cache_reader_c(trace_name);
+        else if (use_branch_columns)
+            reader = new branch_columns_reader_c(trace_name);
+        else
+            reader = new cbp_trace_reader_c(trace_name, decompress_threads);
+        reader->set_op_state_use(op_state_use);
+        return reader;
+    };
+
+    if (segments != 0) {
+        print_budget(stderr, "predictor", PREDICTOR::BUDGET, PREDICTOR::BUDGET_LIMIT);
+        run_segmented(make_reader, segments, warmup_insts, exact);
+        return 0;
+    }
+
+    branch_reader_c* cbptr = make_reader();
+
+    // the storage each predictor is charged, on stderr so the report keeps its form
+    if (use_predictor_set)
+        predictors.print_budgets(stderr);
+    else
+        print_budget(stderr, "predictor", PREDICTOR::BUDGET, PREDICTOR::BUDGET_LIMIT);
+
+    if (use_predictor_set) {
+        // each predictor in the set keeps its own statistics
+        cbptr->set_report_stats(false);
+        if (pipelined)
+            run_pipelined(cbptr, &predictors, snapshot_op_state, look_ahead);
+        else
+            predictors.run(cbptr, look_ahead);
+        predictors.print();
+    }
+    else if (pipelined)
+        run_pipelined(cbptr, 0, snapshot_op_state, look_ahead);
+    else {
+        predictor_snapshot_c* snapshot = 0;
+        if (read_snapshot) {
+            snapshot = new predictor_snapshot_c(read_snapshot);
+            predictor = snapshot->get_predictor<PREDICTOR>();
+            snapshot->restore_reader(cbptr, fresh_stats);
+        }
+        if (!cbptr->skip_to_insts(first_insts)) {
+            fprintf(stderr, "%s ends before instruction %llu\n", argv[optind], (unsigned long long)first_insts);
+            exit(EXIT_FAILURE);
+        }
+        uint64_t start_insts = cbptr->get_position().insts;
+        uint64_t end_insts = have_run_insts ? (start_insts + run_insts) : ~uint64_t(0);
+        run_serial(cbptr, write_snapshot, snapshot_insts, end_insts);
+        delete snapshot;
+    }
+
+    // the reader prints the statistics when it is destroyed
+    delete cbptr;
 }
 
 
@@ -11,22 +11,27 @@ using namespace std;
 
 // op_record methods 
 op_record_c::op_record_c(){
-    init();
     osptr = 0;
+    init();
 }
 op_record_c::~op_record_c(){
 }
 void op_record_c::init(){
-    op_state_c *tmp_osptr = osptr;
+    const op_state_c *tmp_osptr = osptr;
     memset((char *)this, 0, sizeof(op_record_c));
     osptr = tmp_osptr;
 }
-void op_record_c::set_op_state(op_state_c *new_osptr){
+void op_record_c::set_op_state(const op_state_c *new_osptr){
     assert(!osptr);
     osptr = new_osptr;
 }
+void op_record_c::copy_from(const op_record_c *from){
+    const op_state_c *tmp_osptr = osptr;
+    memcpy((char *)this, (const char *)from, sizeof(op_record_c));
+    osptr = tmp_osptr;
+}
 // print information about the op_record
-void op_record_c::debug_print(){
+void op_record_c::debug_print() const{
     printf("op-op(%2x)fp(%1x)lip(%8x)", op_class, is_fp, instruction_addr);
     printf("rf(%1x)wf(%1x)ec(%1x)ms(%1x)md(%1x)", writ_flg, read_flg, special_esc, has_mem_src, has_mem_dst);
     printf("s1(%3x)(%8x)s2(%3x)(%8x)d(%3x)(%8x)", src1, src1_val, src2, src2_val, dst, dst_val);
@@ -43,7 +48,7 @@ void op_record_c::debug_print(){
 
 
 // methods for getting data values prevent the user from getting values before it is time
-bool op_record_c::are_values_available(){
+bool op_record_c::are_values_available() const{
     uint time_available = (clock_time_set + osptr->inst_delay);
     if(time_available > osptr->get_clock()){
         return false;
@@ -55,7 +60,7 @@ void op_record_c::set_src1_val(uint new_src1_val){
     src1_val = new_src1_val;
     clock_time_set = osptr->get_clock();
 }
-uint op_record_c::get_src1_val(){   
+uint op_record_c::get_src1_val() const{
     if(!are_values_available()){
         uint time_available = (clock_time_set + osptr->inst_delay);
         printf("get_src1_val called before src1_val available %8d > %8d\n", time_available, osptr->get_clock());
@@ -68,7 +73,7 @@ void op_record_c::set_src2_val(uint new_src2_val){
     src2_val = new_src2_val;
     clock_time_set = osptr->get_clock();
 }
-uint op_record_c::get_src2_val(){
+uint op_record_c::get_src2_val() const{
     if(!are_values_available()){
         uint time_available = (clock_time_set + osptr->inst_delay);
         printf("get_src2_val called before src2_val available %8d > %8d\n", time_available, osptr->get_clock());
@@ -81,7 +86,7 @@ void op_record_c::set_dst_val(uint new_dst_val){
     dst_val = new_dst_val;
     clock_time_set = osptr->get_clock();
 }
-uint op_record_c::get_dst_val(){
+uint op_record_c::get_dst_val() const{
     if(!are_values_available()){
         uint time_available = (clock_time_set + osptr->inst_delay);
         printf("get_dst_val called before dst_val available %8d > %8d\n", time_available, osptr->get_clock());
@@ -94,7 +99,7 @@ void op_record_c::set_src_vaddr(uint new_src_vaddr){
     src_vaddr = new_src_vaddr;
     clock_time_set = osptr->get_clock();
 }
-uint op_record_c::get_src_vaddr(){
+uint op_record_c::get_src_vaddr() const{
     if(!are_values_available()){
         uint time_available = (clock_time_set + osptr->inst_delay);
         printf("get_src_vaddr called before src_vaddr available %8d > %8d\n", time_available, osptr->get_clock());
@@ -107,7 +112,7 @@ void op_record_c::set_dst_vaddr(uint new_dst_vaddr){
     dst_vaddr = new_dst_vaddr;
     clock_time_set = osptr->get_clock();
 }
-uint op_record_c::get_dst_vaddr(){
+uint op_record_c::get_dst_vaddr() const{
     if(!are_values_available()){
         uint time_available = (clock_time_set + osptr->inst_delay);
         printf("get_dst_vaddr called before dst_vaddr available %8d > %8d\n", time_available, osptr->get_clock());
@@ -123,6 +128,9 @@ op_state_c::op_state_c(){
     num_regs    = g_num_regs;
     inst_delay  = g_inst_delay;
     num_ops     = g_num_ops;
+    ring_ops    = g_ring_ops;
+    // the op_list is masked into, and get_op_record() and get_op_window() stay within it
+    assert(((ring_ops & (ring_ops - 1)) == 0) && (inst_delay <= ring_ops) && (num_ops <= ring_ops));
 
     regs        = new uint[num_regs];
     regs_valid  = new bool[num_regs];
@@ -131,20 +139,177 @@ op_state_c::op_state_c(){
         regs_valid[i] = false;
     }
     op_list_ptr = 0;
-    op_list     = new op_record_c[num_ops];
+    // every field of every op starts out zero, and so invalid
+    uint entries        = 2 * ring_ops;
+    op_clock_time_set   = new uint[entries]();
+    op_instruction_addr = new uint[entries]();
+    op_class            = new uint8_t[entries]();
+    op_flags            = new uint16_t[entries]();
+    op_src1             = new uint8_t[entries]();
+    op_src2             = new uint8_t[entries]();
+    op_dst              = new uint8_t[entries]();
+    op_mem_src1         = new uint8_t[entries]();
+    op_mem_src2         = new uint8_t[entries]();
+    op_mem_src3         = new uint8_t[entries]();
+    op_src1_val         = new uint[entries]();
+    op_src2_val         = new uint[entries]();
+    op_dst_val          = new uint[entries]();
+    op_src_vaddr        = new uint[entries]();
+    op_dst_vaddr        = new uint[entries]();
 }
 op_state_c::~op_state_c(){
     delete [] regs;
     delete [] regs_valid;
-    delete [] op_list;
+    delete [] op_clock_time_set;
+    delete [] op_instruction_addr;
+    delete [] op_class;
+    delete [] op_flags;
+    delete [] op_src1;
+    delete [] op_src2;
+    delete [] op_dst;
+    delete [] op_mem_src1;
+    delete [] op_mem_src2;
+    delete [] op_mem_src3;
+    delete [] op_src1_val;
+    delete [] op_src2_val;
+    delete [] op_dst_val;
+    delete [] op_src_vaddr;
+    delete [] op_dst_vaddr;
 }
 void op_state_c::init(op_state_c *new_osptr){
     assert(this == new_osptr);
-    for(uint i = 0; i < num_ops; i++){
-        op_list[i].set_op_state(new_osptr);
-    } 
 }
-const char* op_state_c::register_name(uint register_code){
+void op_state_c::get_op_list_arrays(op_list_array_c *arrays) const{
+    op_list_array_c all[num_op_list_arrays] = {
+        {(char *)op_clock_time_set, sizeof(uint)},    {(char *)op_instruction_addr, sizeof(uint)},
+        {(char *)op_class, sizeof(uint8_t)},          {(char *)op_flags, sizeof(uint16_t)},
+        {(char *)op_src1, sizeof(uint8_t)},           {(char *)op_src2, sizeof(uint8_t)},
+        {(char *)op_dst, sizeof(uint8_t)},            {(char *)op_mem_src1, sizeof(uint8_t)},
+        {(char *)op_mem_src2, sizeof(uint8_t)},       {(char *)op_mem_src3, sizeof(uint8_t)},
+        {(char *)op_src1_val, sizeof(uint)},          {(char *)op_src2_val, sizeof(uint)},
+        {(char *)op_dst_val, sizeof(uint)},           {(char *)op_src_vaddr, sizeof(uint)},
+        {(char *)op_dst_vaddr, sizeof(uint)}};
+    memcpy(arrays, all, sizeof(all));
+}
+void op_state_c::copy_from(const op_state_c *from){
+    assert(num_regs == from->num_regs && inst_delay == from->inst_delay && num_ops == from->num_ops &&
+           ring_ops == from->ring_ops);
+    clock       = from->clock;
+    op_list_ptr = from->op_list_ptr;
+    memcpy(regs, from->regs, num_regs * sizeof(regs[0]));
+    memcpy(regs_valid, from->regs_valid, num_regs * sizeof(regs_valid[0]));
+    op_list_array_c to_arrays[num_op_list_arrays];
+    op_list_array_c from_arrays[num_op_list_arrays];
+    get_op_list_arrays(to_arrays);
+    from->get_op_list_arrays(from_arrays);
+    for(uint i = 0; i < num_op_list_arrays; i++){
+        memcpy(to_arrays[i].array, from_arrays[i].array, 2 * ring_ops * to_arrays[i].entry_size);
+    }
+}
+uint op_state_c::get_state_size() const{
+    uint size = sizeof(clock) + sizeof(op_list_ptr) + num_regs * (sizeof(regs[0]) + sizeof(regs_valid[0]));
+    op_list_array_c arrays[num_op_list_arrays];
+    get_op_list_arrays(arrays);
+    for(uint i = 0; i < num_op_list_arrays; i++){
+        size += ring_ops * arrays[i].entry_size;
+    }
+    return size;
+}
+void op_state_c::save_state(char *state) const{
+    memcpy(state, &clock, sizeof(clock));
+    state += sizeof(clock);
+    memcpy(state, &op_list_ptr, sizeof(op_list_ptr));
+    state += sizeof(op_list_ptr);
+    memcpy(state, regs, num_regs * sizeof(regs[0]));
+    state += num_regs * sizeof(regs[0]);
+    memcpy(state, regs_valid, num_regs * sizeof(regs_valid[0]));
+    state += num_regs * sizeof(regs_valid[0]);
+    // the op_list's arrays, each once: the second copy is the same
+    op_list_array_c arrays[num_op_list_arrays];
+    get_op_list_arrays(arrays);
+    for(uint i = 0; i < num_op_list_arrays; i++){
+        memcpy(state, arrays[i].array, ring_ops * arrays[i].entry_size);
+        state += ring_ops * arrays[i].entry_size;
+    }
+}
+void op_state_c::restore_state(const char *state){
+    memcpy(&clock, state, sizeof(clock));
+    state += sizeof(clock);
+    memcpy(&op_list_ptr, state, sizeof(op_list_ptr));
+    state += sizeof(op_list_ptr);
+    memcpy(regs, state, num_regs * sizeof(regs[0]));
+    state += num_regs * sizeof(regs[0]);
+    memcpy(regs_valid, state, num_regs * sizeof(regs_valid[0]));
+    state += num_regs * sizeof(regs_valid[0]);
+    op_list_array_c arrays[num_op_list_arrays];
+    get_op_list_arrays(arrays);
+    for(uint i = 0; i < num_op_list_arrays; i++){
+        uint size = ring_ops * arrays[i].entry_size;
+        memcpy(arrays[i].array, state, size);
+        memcpy(arrays[i].array + size, state, size);
+        state += size;
+    }
+}
+op_record_c op_state_c::get_op_record(uint op_num) const{
+    assert(op_num < num_ops);
+    uint slot  = (op_list_ptr - op_num) & (ring_ops - 1);
+    uint flags = op_flags[slot];
+    op_record_c op;
+    op.osptr            = this;
+    op.clock_time_set   = op_clock_time_set[slot];
+    op.src1_val         = op_src1_val[slot];
+    op.src2_val         = op_src2_val[slot];
+    op.dst_val          = op_dst_val[slot];
+    op.src_vaddr        = op_src_vaddr[slot];
+    op.dst_vaddr        = op_dst_vaddr[slot];
+    op.is_valid         = flags & OP_FLAG_VALID;
+    op.op_class         = op_class[slot];
+    op.instruction_addr = op_instruction_addr[slot];
+    op.is_load          = flags & OP_FLAG_LOAD;
+    op.is_store         = flags & OP_FLAG_STORE;
+    op.is_branch        = flags & OP_FLAG_BRANCH;
+    op.is_op            = flags & OP_FLAG_OP;
+    op.is_fp            = flags & OP_FLAG_FP;
+    op.read_flg         = flags & OP_FLAG_READ_FLG;
+    op.writ_flg         = flags & OP_FLAG_WRIT_FLG;
+    op.src1             = op_src1[slot];
+    op.src2             = op_src2[slot];
+    op.dst              = op_dst[slot];
+    op.has_mem_src      = flags & OP_FLAG_HAS_MEM_SRC;
+    op.has_mem_dst      = flags & OP_FLAG_HAS_MEM_DST;
+    op.mem_src1         = op_mem_src1[slot];
+    op.mem_src2         = op_mem_src2[slot];
+    op.mem_src3         = op_mem_src3[slot];
+    return op;
+}
+void op_state_c::get_op_window(uint window_ops, op_window_c *window) const{
+    assert(window_ops <= ring_ops);
+    // the window's oldest op; the arrays' second copy runs on past the end of the ring
+    uint first = (op_list_ptr + 1 - window_ops) & (ring_ops - 1);
+    window->num_ops          = window_ops;
+    window->instruction_addr = op_instruction_addr + first;
+    window->op_class         = op_class + first;
+    window->flags            = op_flags + first;
+    window->src1             = op_src1 + first;
+    window->src2             = op_src2 + first;
+    window->dst              = op_dst + first;
+    window->mem_src1         = op_mem_src1 + first;
+    window->mem_src2         = op_mem_src2 + first;
+    window->mem_src3         = op_mem_src3 + first;
+    // one check for the whole window: the ops' values were set in order, so the ones that are visible
+    // are the oldest, up to the newest one that is
+    uint with_values = window_ops;
+    while((with_values > 0) && ((op_clock_time_set[first + with_values - 1] + inst_delay) > get_clock())){
+        with_values--;
+    }
+    window->num_ops_with_values = with_values;
+    window->src1_val            = op_src1_val + first;
+    window->src2_val            = op_src2_val + first;
+    window->dst_val             = op_dst_val + first;
+    window->src_vaddr           = op_src_vaddr + first;
+    window->dst_vaddr           = op_dst_vaddr + first;
+}
+const char* op_state_c::register_name(uint register_code) const{
     switch(register_code){
         //general purpose registers
     case REG_NUL: return "NUL";
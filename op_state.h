@@ -7,6 +7,7 @@
 #define OP_STATE_H_SEEN
 
 #include <cassert>
+#include <inttypes.h>
 
 typedef unsigned int uint;
 
@@ -54,11 +55,41 @@ const uint REG_XMM6 = 0xa2;
 const uint REG_XMM7 = 0xa3;
       
 const uint g_num_regs   = 256;
-const uint g_inst_delay = 64; // the delay before the values from an instruction become visible 
+const uint g_inst_delay = 64; // the delay before the values from an instruction become visible (a power of two)
 const uint g_num_ops    = 64;
+const uint g_ring_ops   = 2 * g_inst_delay; // the ops the op_list holds: inst_delay whose values aren't visible
+                                            // yet, and as many whose are
+
+// What of the architectural state a predictor reads, or'ed together.  A predictor declares it as
+//   static constexpr uint OP_STATE_USE = ...;
+// and the driver hands it to the trace reader once, before the first branch
+// (branch_reader_c::set_op_state_use()).  The reader keeps up only what was asked for: with
+// OP_STATE_NONE it leaves the op_list and the register file alone altogether, otherwise each op it
+// records has the fields asked for set and the rest zero (the register file is written from the ops'
+// registers and values, so asking for it fills those in too).  A predictor that doesn't declare it gets
+// everything.
+const uint OP_STATE_NONE     = 0x0;
+const uint OP_STATE_OPS      = 0x1;  // each op's op_class, instruction_addr and is_xxx flags
+const uint OP_STATE_OP_REGS  = 0x2;  // ... its src1, src2, dst, mem_srcX, has_mem_xxx, read_flg and writ_flg
+const uint OP_STATE_OP_VALS  = 0x4;  // ... its values and memory addresses
+const uint OP_STATE_REG_FILE = 0x8;  // the register file (regs and regs_valid)
+const uint OP_STATE_ALL      = 0xf;
 
 class op_state_c;
 
+// the flags of an op (see op_state_c::get_op_window())
+const uint OP_FLAG_VALID       = 0x001;
+const uint OP_FLAG_LOAD        = 0x002;
+const uint OP_FLAG_STORE       = 0x004;
+const uint OP_FLAG_BRANCH      = 0x008;
+const uint OP_FLAG_OP          = 0x010;
+const uint OP_FLAG_FP          = 0x020;
+const uint OP_FLAG_READ_FLG    = 0x040;
+const uint OP_FLAG_WRIT_FLG    = 0x080;
+const uint OP_FLAG_HAS_MEM_SRC = 0x100;
+const uint OP_FLAG_HAS_MEM_DST = 0x200;
+
+// a copy of one op of the op_list (see op_state_c::get_op_record())
 class op_record_c
 {
     // when was the latest time that the values were set
@@ -71,7 +102,8 @@ class op_record_c
     uint src_vaddr;
     // mem dst addr
     uint dst_vaddr;
-    op_state_c *osptr;
+    const op_state_c *osptr;
+    friend class op_state_c;
 public:
     // methods for getting data values from an instruction.
     // the user should access the data values using these methods to avoid
@@ -81,22 +113,22 @@ public:
 
     // Are the values contained in the record available and can they be inspected.  This should be called
     // before trying to look at the data values.
-    bool are_values_available();
+    bool are_values_available() const;
     // set/get the value for src1 
     void set_src1_val(uint new_src1_val);
-    uint get_src1_val();
+    uint get_src1_val() const;
     // set/get the value for src2 
     void set_src2_val(uint new_src2_val);
-    uint get_src2_val();
+    uint get_src2_val() const;
      // set/get the value for dst
     void set_dst_val(uint new_dst_val);
-    uint get_dst_val();
+    uint get_dst_val() const;
     // set/get the address for a memory source 
     void set_src_vaddr(uint new_src_vaddr);
-    uint get_src_vaddr();
+    uint get_src_vaddr() const;
     // set/get the address for a memory dest
     void set_dst_vaddr(uint new_dst_vaddr);
-    uint get_dst_vaddr();
+    uint get_dst_vaddr() const;
     // is this a valid record containing arch state uploaded from a trace
     bool is_valid;
 
@@ -135,14 +167,71 @@ public:
     op_record_c();
     ~op_record_c();
     void init();
-    void set_op_state(op_state_c *new_osptr);
-    void debug_print();
+    void set_op_state(const op_state_c *new_osptr);
+    // copy another record's contents, keeping this record's op_state
+    void copy_from(const op_record_c *from);
+    void debug_print() const;
+};
+
+// the last num_ops ops of the op_list, oldest first (the last one is get_op_record(0)), each field an
+// array of num_ops entries, ready to be scanned a field at a time
+struct op_window_c
+{
+    uint num_ops;
+    uint num_ops_with_values;            // the values of the first (oldest) this many ops are visible
+    const uint     *instruction_addr;
+    const uint8_t  *op_class;
+    const uint16_t *flags;               // OP_FLAG_XXX
+    const uint8_t  *src1;
+    const uint8_t  *src2;
+    const uint8_t  *dst;
+    const uint8_t  *mem_src1;
+    const uint8_t  *mem_src2;
+    const uint8_t  *mem_src3;
+    // the values and memory addresses; only the first num_ops_with_values entries may be read (see
+    // op_record_c::are_values_available())
+    const uint     *src1_val;
+    const uint     *src2_val;
+    const uint     *dst_val;
+    const uint     *src_vaddr;
+    const uint     *dst_vaddr;
 };
 
 // op_state_c holds all the register values that have been committed and are available when the branch is predicted
 class op_state_c{
 private:
     int clock;
+    // the op_list: a ring of ring_ops ops, a power of two, kept as an array per field.  Each array is
+    // twice as long as the ring, and every op is written at its slot and ring_ops past it, so any
+    // ring_ops consecutive ops are contiguous in every array.
+    uint     *op_clock_time_set;
+    uint     *op_instruction_addr;
+    uint8_t  *op_class;
+    uint16_t *op_flags;
+    uint8_t  *op_src1;
+    uint8_t  *op_src2;
+    uint8_t  *op_dst;
+    uint8_t  *op_mem_src1;
+    uint8_t  *op_mem_src2;
+    uint8_t  *op_mem_src3;
+    uint     *op_src1_val;
+    uint     *op_src2_val;
+    uint     *op_dst_val;
+    uint     *op_src_vaddr;
+    uint     *op_dst_vaddr;
+
+    // the op_list's arrays, for copying and checkpointing them whole
+    struct op_list_array_c
+    {
+        char *array;
+        uint entry_size;
+    };
+    static const uint num_op_list_arrays = 15;
+    void get_op_list_arrays(op_list_array_c *arrays) const;
+
+    // not implemented
+    op_state_c(const op_state_c &);
+    op_state_c &operator=(const op_state_c &);
 public:
     // array indicating which regs are valid
     bool *regs_valid;
@@ -150,46 +239,92 @@ public:
     uint *regs;
     // number of regs in the register file
     uint num_regs;
-    // the delay before an instructions result becomes visible to the branch predictor
+    // the delay before an instructions result becomes visible to the branch predictor; a power of two
     uint inst_delay;
-    // number of ops contained in the op_list
+    // number of ops that can be looked at with get_op_record()
     uint num_ops;
-    // the op_list contains all ops that produce data values not yet visible to the branch predictor
-    op_record_c *op_list;
-    // pointer to the oldest op in the op list 
+    // number of ops in the op_list, twice inst_delay, so get_op_window() reaches ops whose values are visible
+    uint ring_ops;
+    // slot of the newest op in the op list 
     uint op_list_ptr;
 
     op_state_c();
     ~op_state_c();
+    // nothing to set up: kept for the readers written against op_records that pointed back at it
     void init(op_state_c *new_osptr);
-    const char *register_name(uint register_code);
+    // snapshot: copy the clock, register file, and op_list of another op_state
+    void copy_from(const op_state_c *from);
+    // checkpoint: the same as bytes, get_state_size() of them (see trace_index.h)
+    uint get_state_size() const;
+    void save_state(char *state) const;
+    void restore_state(const char *state);
+    const char *register_name(uint register_code) const;
     // clock methods
-    uint get_clock(){
+    uint get_clock() const{
         return clock;
     }
     void inc_clock(){
         clock++;
-        op_list_ptr = (op_list_ptr + 1) % inst_delay;
+        op_list_ptr = (op_list_ptr + 1) & (ring_ops - 1);
+    }
+    // trace reader methods: new_op() advances the clock and starts a new op in the op_list, in place of
+    // the oldest one; the op whose values become visible now (inst_delay ops back), with commit, writes
+    // its result to the register file.  It returns the new op's slot, with only OP_FLAG_VALID set, for
+    // the set_op_xxx() methods to fill in.  Fields never set stay zero.
+    uint new_op(bool commit){
+        inc_clock();
+        uint visible = (op_list_ptr - inst_delay) & (ring_ops - 1);
+        if(commit && (op_flags[visible] & OP_FLAG_VALID) && (op_dst[visible] != REG_NUL)){
+            regs[op_dst[visible]]       = op_dst_val[visible];
+            regs_valid[op_dst[visible]] = true;
+        }
+        uint slot = op_list_ptr;
+        op_flags[slot] = op_flags[slot + ring_ops] = OP_FLAG_VALID;
+        return slot;
+    }
+    // flags are or'ed into the op's
+    void set_op_class(uint slot, uint8_t op_class_arg, uint instruction_addr, uint flags){
+        op_class[slot]            = op_class[slot + ring_ops]            = op_class_arg;
+        op_instruction_addr[slot] = op_instruction_addr[slot + ring_ops] = instruction_addr;
+        op_flags[slot]            = op_flags[slot + ring_ops]            = op_flags[slot] | flags;
+    }
+    void set_op_regs(uint slot, uint8_t src1, uint8_t src2, uint8_t dst, uint8_t mem_src1, uint8_t mem_src2,
+                     uint8_t mem_src3, uint flags){
+        op_src1[slot]     = op_src1[slot + ring_ops]     = src1;
+        op_src2[slot]     = op_src2[slot + ring_ops]     = src2;
+        op_dst[slot]      = op_dst[slot + ring_ops]      = dst;
+        op_mem_src1[slot] = op_mem_src1[slot + ring_ops] = mem_src1;
+        op_mem_src2[slot] = op_mem_src2[slot + ring_ops] = mem_src2;
+        op_mem_src3[slot] = op_mem_src3[slot + ring_ops] = mem_src3;
+        op_flags[slot]    = op_flags[slot + ring_ops]    = op_flags[slot] | flags;
+    }
+    void set_op_values(uint slot, uint src1_val, uint src2_val, uint dst_val, uint src_vaddr, uint dst_vaddr){
+        op_clock_time_set[slot] = op_clock_time_set[slot + ring_ops] = clock;
+        op_src1_val[slot]       = op_src1_val[slot + ring_ops]       = src1_val;
+        op_src2_val[slot]       = op_src2_val[slot + ring_ops]       = src2_val;
+        op_dst_val[slot]        = op_dst_val[slot + ring_ops]        = dst_val;
+        op_src_vaddr[slot]      = op_src_vaddr[slot + ring_ops]      = src_vaddr;
+        op_dst_vaddr[slot]      = op_dst_vaddr[slot + ring_ops]      = dst_vaddr;
     }
     // op state method:
     // is_reg_valid: use this method for checking to see if a register has had a valid result
     // written into it.  Regnum can be any number from 0 - 255 since there are 256 registers.
-    bool is_reg_valid(uint reg_num){
+    bool is_reg_valid(uint reg_num) const{
         return regs_valid[reg_num];
     }
     // get_reg_state:  use this method for getting values that are stored in a register file entry.
     // It is wise to check that the values are valid before using them.  Some register file entries
     // may never be written to over the course of a trace's execution.
-    uint get_reg_state(uint reg_num){
+    uint get_reg_state(uint reg_num) const{
         return regs[reg_num];
     }
-    // get_op_record: use this method to get the op_record.  op_num = 0 is the most recent op_record.
-    // op_num = 63 is the oldest.
-    op_record_c *get_op_record(uint op_num){
-        uint index  = (op_list_ptr - op_num) % inst_delay;
-        assert(op_num < num_ops);
-        return op_list + index;
-    }
+    // get_op_record: use this method to get a copy of an op_record.  op_num = 0 is the most recent
+    // op_record.  op_num = 63 is the oldest.
+    op_record_c get_op_record(uint op_num) const;
+    // get_op_window: use this method to get the last window_ops ops (at most ring_ops) at once, as
+    // arrays.  The values are checked once, for the whole window: the ops from the oldest up to the
+    // newest one whose values are visible can be read (num_ops_with_values), the rest can't.
+    void get_op_window(uint window_ops, op_window_c *window) const;
 };
 
 #endif // OP_STATE_H_SEEN
@@ -0,0 +1,78 @@
+/* Description: This file tests op_state_c's op_list: it feeds ops to an
+ * op_state, as the trace reader does, and checks what get_op_window() and
+ * get_op_record() give back and what reaches the register file.
+*/
+
+#include "op_state.h"
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+static uint g_failures = 0;
+
+static void check(bool ok, const char *what, uint op){
+    if(!ok){
+        printf("op_state_test: after op %u: %s\n", op, what);
+        g_failures++;
+    }
+}
+
+// the values op n is given
+static uint src1_val(uint n){ return 0x10000 + n; }
+static uint dst_val(uint n){  return 0x20000 + n; }
+static uint dst_reg(uint n){  return 1 + (n % 8); }
+
+int main(){
+    op_state_c os;
+    uint num_ops = 3 * g_ring_ops;
+    for(uint n = 0; n < num_ops; n++){
+        uint slot = os.new_op(true);
+        os.set_op_class(slot, 0, 0x1000 + n, OP_FLAG_OP);
+        os.set_op_regs(slot, 0, 0, dst_reg(n), 0, 0, 0, 0);
+        os.set_op_values(slot, src1_val(n), 0, dst_val(n), 0, 0);
+
+        // the newest inst_delay ops' values aren't visible yet; all the older ones' are
+        op_window_c window;
+        os.get_op_window(g_ring_ops, &window);
+        uint expected = (n + 1 >= g_inst_delay) ? (g_ring_ops - g_inst_delay) : 0;
+        check(window.num_ops == g_ring_ops, "window has the wrong number of ops", n);
+        check(window.num_ops_with_values == expected, "window has the wrong number of ops with values", n);
+        check(window.instruction_addr[g_ring_ops - 1] == 0x1000 + n, "window's newest op is not the last one", n);
+        for(uint i = 0; i < window.num_ops_with_values; i++){
+            // window entry i is op n + 1 - ring_ops + i; those before the first op are empty
+            uint op = n + 1 - g_ring_ops + i;
+            if(n + 1 + i < g_ring_ops){
+                check(!(window.flags[i] & OP_FLAG_VALID), "window op before the first op is valid", n);
+                continue;
+            }
+            check(window.flags[i] & OP_FLAG_VALID, "window op is not valid", n);
+            check(window.src1_val[i] == src1_val(op), "window op has the wrong src1_val", n);
+            check(window.dst_val[i] == dst_val(op), "window op has the wrong dst_val", n);
+        }
+
+        // a window of the last num_ops ops has none, and one inst_delay + 3 long has the oldest 3
+        os.get_op_window(g_num_ops, &window);
+        check(window.num_ops_with_values == 0, "window of the newest ops has values", n);
+        if(n + 1 >= g_inst_delay + 3){
+            os.get_op_window(g_inst_delay + 3, &window);
+            check(window.num_ops_with_values == 3, "window reaching 3 visible ops doesn't have them", n);
+            check(window.dst_val[2] == dst_val(n - g_inst_delay), "newest visible op has the wrong dst_val", n);
+        }
+
+        // a register holds the result of the newest op writing it whose values are visible
+        op_record_c op = os.get_op_record(0);
+        check(op.instruction_addr == 0x1000 + n, "op record 0 is not the last op", n);
+        if(n >= g_inst_delay + 8){
+            uint visible = n - g_inst_delay;
+            check(os.is_reg_valid(dst_reg(visible)), "register of a visible op is not valid", n);
+            check(os.get_reg_state(dst_reg(visible)) == dst_val(visible), "register has the wrong value", n);
+        }
+    }
+    if(g_failures){
+        printf("op_state_test: %u checks failed\n", g_failures);
+        return EXIT_FAILURE;
+    }
+    printf("op_state_test: passed\n");
+    return EXIT_SUCCESS;
+}
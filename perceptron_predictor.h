@@ -0,0 +1,386 @@
+/* Description: This file defines a hashed perceptron branch predictor: one
+ * table of narrow weights per history length, each indexed by a hash of the
+ * pc and that much global and path history, the prediction being the sign of
+ * the sum of the selected weights, plus the loop predictor of predictor.h
+ * (loop_predictor.h) on the side.  It has the same interface as the GEHL
+ * predictor in predictor.h, and its histories and index hash are GEHL's
+ * (GEHL_INDEX_FAST); the weights of a prediction are summed and trained as
+ * one SSE2 vector.
+ */
+
+#ifndef PERCEPTRON_PREDICTOR_H_SEEN
+#define PERCEPTRON_PREDICTOR_H_SEEN
+
+#include <array>
+#include <cstddef>
+#include <inttypes.h>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "loop_predictor.h"
+#include "op_state.h"   // defines op_state_c (architectural state) class
+#include "storage_budget.h"
+#include "tread.h"      // defines branch_record_c class
+
+// A hashed perceptron configuration: the number of weight tables and, per
+// table, the history length and the log2 of the number of weights, the width
+// of a weight, the initial training threshold, whether the loop entries are
+// packed (as in GEHL_CONFIG_CBP), and the storage budget.  The table with no
+// history is the bias.  Ten tables of 5-bit weights predict better in the
+// budget than more tables of wider ones: the bias and shortest history get
+// the largest tables.  Derive from it to change any of these.
+struct PERCEPTRON_CONFIG_CBP {
+  static constexpr int NUM_TABLES = 10;
+  static constexpr std::array<std::size_t, NUM_TABLES> L = {{0, 1, 2, 4, 8, 12, 16, 32, 64, 128}};
+  static constexpr std::array<std::size_t, NUM_TABLES> LOG_SIZES = {{11, 11, 10, 10, 10, 10, 10, 10, 10, 10}};
+  static constexpr int WEIGHT_BITS = 5;
+  static constexpr int THRESH = 36;
+  static constexpr bool PACKED = false;
+  static constexpr std::size_t BUDGET_BITS = CBP_BUDGET_BITS;
+};
+
+template <class CONFIG>
+class PERCEPTRON_PREDICTOR {
+public:
+  typedef uint32_t address_t;
+
+private:
+  typedef uint64_t path_t;
+  typedef unsigned __int128 history_t;
+  typedef int8_t weight_t;
+
+  // Constant Definitions
+  static constexpr int NUM_TABLES = CONFIG::NUM_TABLES;
+  static constexpr std::array<std::size_t, NUM_TABLES> L = CONFIG::L;
+  static constexpr std::array<std::size_t, NUM_TABLES> LOG_SIZES = CONFIG::LOG_SIZES;
+  static constexpr int WEIGHT_BITS = CONFIG::WEIGHT_BITS;
+  static constexpr int WEIGHT_MAX = (1 << (WEIGHT_BITS - 1)) - 1;
+  static constexpr int WEIGHT_MIN = -(1 << (WEIGHT_BITS - 1));
+  static_assert((WEIGHT_BITS >= 2) && (WEIGHT_BITS <= 8), "a weight doesn't fit in its byte");
+
+  // Path History
+  static const int PATH_HIST_LENGTH = 48;  // 48 bits
+  static const path_t PATH_HIST_MASK = (path_t(1) << PATH_HIST_LENGTH) - 1;
+  static const int FAST_PATH_LENGTH = 16;  // most phist bits an index uses
+  // Global History
+  static const int GLOBAL_HIST_LENGTH = 128;  // 128 bits
+
+  // Loop Predictor
+  static const int LOOP_PRED_SIZE = 5;     // 32 entries
+  typedef LOOP_PREDICTOR<LOOP_PRED_SIZE, CONFIG::PACKED> loop_t;
+  static const int WITHLOOP_WIDTH = 7;     // Counter width of the WITHLOOP counter
+
+  static constexpr bool lengths_fit() {
+    for (int i = 0; i < NUM_TABLES; ++i)
+      if (L[i] > std::size_t(GLOBAL_HIST_LENGTH))
+        return false;
+    return true;
+  }
+  static_assert(lengths_fit(), "a history is longer than ghist");
+
+  // The weight tables lie one after another in one array
+  static constexpr std::array<std::size_t, NUM_TABLES + 1> table_bases() {
+    std::array<std::size_t, NUM_TABLES + 1> bases = {};
+    for (int i = 0; i < NUM_TABLES; ++i)
+      bases[i + 1] = bases[i] + (std::size_t(1) << LOG_SIZES[i]);
+    return bases;
+  }
+  static constexpr std::array<std::size_t, NUM_TABLES + 1> TABLE_BASES = table_bases();
+
+  // The number of phist bits folded into the index of table i
+  static constexpr std::size_t phist_fold_length(int i) {
+    return (L[i] < FAST_PATH_LENGTH) ? L[i] : FAST_PATH_LENGTH;
+  }
+
+  // Calls f(std::integral_constant<int, i>()) for each table i in order; the
+  // loop is unrolled and i is a constant inside f.
+  template <class F, int... I>
+  static void for_each_table(F f, std::integer_sequence<int, I...>) {
+    (f(std::integral_constant<int, I>()), ...);
+  }
+  template <class F>
+  static void for_each_table(F f) {
+    for_each_table(f, std::make_integer_sequence<int, NUM_TABLES>());
+  }
+
+  // a W-bit value rotated left by R
+  template <std::size_t W, std::size_t R>
+  static uint32_t rotate(uint32_t value) {
+    return ((value << (R % W)) | (value >> ((W - R % W) % W))) & ((uint32_t(1) << W) - 1);
+  }
+  // Shifts bit in into the W-bit fold of a LENGTH-bit history, and out (the
+  // history's oldest bit) out of it
+  template <std::size_t W, std::size_t LENGTH>
+  static uint32_t shift_fold(uint32_t folded, bool in, bool out) {
+    folded = (folded << 1) | uint32_t(in);
+    folded ^= folded >> W;
+    folded &= (uint32_t(1) << W) - 1;
+    return folded ^ (uint32_t(out) << (LENGTH % W));
+  }
+
+#if defined(__SSE2__)
+  // The SSE2 kernel holds one table's weight per 8-bit lane
+  static const int SIMD_LANES = 16;
+  static constexpr bool SIMD = NUM_TABLES <= SIMD_LANES;
+  typedef std::array<weight_t, SIMD_LANES> lanes_t;
+#else
+  static constexpr bool SIMD = false;
+#endif
+
+  static int counter_inc(/* n-bit counter */ int cnt, int n) {
+    if (cnt != (1 << (n - 1)) - 1)
+      ++cnt;
+    return cnt;
+  }
+  static int counter_dec(/* n-bit counter */ int cnt, int n) {
+    if (cnt != -(1 << (n - 1)))
+      --cnt;
+    return cnt;
+  }
+
+  static constexpr std::size_t weight_bits() {
+    return WEIGHT_BITS * TABLE_BASES[NUM_TABLES];
+  }
+
+public:
+  // The hardware storage of each component, in budgeted bits (see
+  // GEHL_PREDICTOR::BUDGET); the history folds are derived, so not counted
+  static constexpr std::array<BUDGET_ITEM, 8> BUDGET = {{
+    {"ghist", GLOBAL_HIST_LENGTH},
+    {"phist", PATH_HIST_LENGTH},
+    {"weights", weight_bits()},
+    {"loop table", loop_t::BUDGET_BITS},
+    {"WITHLOOP", WITHLOOP_WIDTH},
+    {"Seed", 32},
+    {"THRESH", 8},
+    {"TC", 7}
+  }};
+  static constexpr std::size_t STORAGE_BITS = budget_bits(BUDGET);
+  static constexpr std::size_t BUDGET_LIMIT = CONFIG::BUDGET_BITS;
+  static constexpr bool FITS_BUDGET = STORAGE_BITS <= BUDGET_LIMIT;
+  // it never looks at its op_state_c argument (see op_state.h)
+  static constexpr uint OP_STATE_USE = OP_STATE_NONE;
+
+private:
+  // Hardware Data Structures
+
+  // Global History Register
+  history_t ghist;                         // 128 bits
+  // Path History Register to prevent path aliasing
+  path_t phist;                            // 48 bits
+  // ghist and phist folded to each table's index width (derived from ghist
+  // and phist, so not counted)
+  std::array<uint32_t, NUM_TABLES> ghist_folds;
+  std::array<uint32_t, NUM_TABLES> phist_folds;
+  // Weight Tables
+  alignas(64) std::array<weight_t, TABLE_BASES[NUM_TABLES]> weights;
+  // Threshold for training
+  int THRESH;                              // 8 bits
+  // Counter for dynamic thresholding
+  int TC;                                  // 7 bits
+  // Loop Predictor
+  loop_t loop;
+  // Counter to monitor whether or not loop prediction is beneficial
+  int8_t WITHLOOP;
+  // Random number generator, for the loop predictor's allocation
+  int Seed;
+
+  // Per Branch Variables used in both getting and updating prediction
+  std::array<std::size_t, NUM_TABLES> indices;  // Indices to weights
+  int sum;                                 // Sum of the selected weights
+  bool perceptron_pred;                    // the perceptron's prediction, before the loop predictor
+  bool prediction;                         // Prediction of this particular branch
+
+public:
+  PERCEPTRON_PREDICTOR(void)
+    : ghist(0)
+    , phist(0)
+    , THRESH(CONFIG::THRESH)
+    , TC(0)
+    , WITHLOOP(-1)
+    , Seed(0)
+  {
+    static_assert(FITS_BUDGET, "the configuration is over its storage budget (see BUDGET)");
+    ghist_folds.fill(0);
+    phist_folds.fill(0);
+    weights.fill(0);
+  }
+  // uses compiler generated copy constructor
+  // uses compiler generated destructor
+  // uses compiler generated assignment operator
+
+  int MYRANDOM() {
+    Seed++;
+    Seed ^= int(phist);
+    Seed = (Seed >> 21) + (Seed << 11);
+    Seed ^= int(ghist);
+    Seed = (Seed >> 10) + (Seed << 22);
+    return (Seed);
+  }
+
+  // Computes the index of the branch at pc in each table, into indices
+  void calc_indices(address_t pc) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t W = LOG_SIZES[i];
+      std::size_t index = pc;
+      if constexpr (L[i] != 0)
+        index = pc ^ (pc >> W) ^ ghist_folds[i] ^ rotate<W, W / 2>(phist_folds[i]);
+      indices[i] = TABLE_BASES[i] + (index & ((std::size_t(1) << W) - 1));
+    });
+  }
+
+#if defined(__SSE2__)
+  // The weight of table i at its current index; 0 past the last table
+  template <int i>
+  char lane_weight() const {
+    if constexpr (i < NUM_TABLES)
+      return weights[indices[i]];
+    else
+      return 0;
+  }
+  // The weights at the current indices, one table per lane
+  __m128i load_weights() const {
+    return _mm_set_epi8(lane_weight<15>(), lane_weight<14>(), lane_weight<13>(), lane_weight<12>(),
+                        lane_weight<11>(), lane_weight<10>(), lane_weight<9>(), lane_weight<8>(),
+                        lane_weight<7>(), lane_weight<6>(), lane_weight<5>(), lane_weight<4>(),
+                        lane_weight<3>(), lane_weight<2>(), lane_weight<1>(), lane_weight<0>());
+  }
+#endif
+
+  // The sum of the weights at the current indices.  The SSE2 kernel biases
+  // each weight by 128, so it is unsigned, and sums each half of the vector
+  // with one psadbw.
+  int calc_sum() {
+    if constexpr (SIMD) {
+#if defined(__SSE2__)
+      __m128i biased = _mm_xor_si128(load_weights(), _mm_set1_epi8(char(0x80)));
+      __m128i halves = _mm_sad_epu8(biased, _mm_setzero_si128());
+      sum = _mm_cvtsi128_si32(halves) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(halves, halves)) - 128 * SIMD_LANES;
+#endif
+    } else {
+      sum = 0;
+      for_each_table([&](auto I) {
+        sum += weights[indices[I]];
+      });
+    }
+    return sum;
+  }
+
+  // get_prediction() takes a branch record (br, branch_record_c is defined in
+  // tread.h) and architectural state (os, op_state_c is defined op_state.h),
+  // like PREDICTOR's, and predicts conditional branches.
+  bool get_prediction(const branch_record_c* br, const op_state_c*) {
+    prediction = false;
+    if (/* conditional branch */ br->is_conditional) {
+      address_t pc = br->instruction_addr;
+      calc_indices(pc);
+      perceptron_pred = calc_sum() >= 0;
+
+      bool predloop = loop.get_prediction(pc);	// loop prediction
+      prediction = ((WITHLOOP >= 0) && loop.valid()) ? predloop : perceptron_pred;
+    }
+    return prediction;   // true for taken, false for not taken
+  }
+
+  // Moves every weight at the current indices one step toward taken; the
+  // SSE2 kernel saturates with one paddsb, and weights narrower than a byte
+  // with a pminub and a pmaxub of the weights biased by 128
+  void train(bool taken) {
+    if constexpr (SIMD) {
+#if defined(__SSE2__)
+      __m128i trained = _mm_adds_epi8(load_weights(), _mm_set1_epi8(taken ? 1 : -1));
+      if constexpr (WEIGHT_BITS < 8) {
+        __m128i bias = _mm_set1_epi8(char(0x80));
+        trained = _mm_xor_si128(trained, bias);
+        trained = _mm_min_epu8(trained, _mm_set1_epi8(char(0x80 + WEIGHT_MAX)));
+        trained = _mm_max_epu8(trained, _mm_set1_epi8(char(0x80 + WEIGHT_MIN)));
+        trained = _mm_xor_si128(trained, bias);
+      }
+      alignas(16) lanes_t lanes;
+      _mm_store_si128((__m128i*)lanes.data(), trained);
+      for_each_table([&](auto I) {
+        weights[indices[I]] = lanes[I];
+      });
+#endif
+    } else {
+      for_each_table([&](auto I) {
+        int weight = weights[indices[I]];
+        weights[indices[I]] = weight_t(taken ? counter_inc(weight, WEIGHT_BITS) : counter_dec(weight, WEIGHT_BITS));
+      });
+    }
+  }
+
+  void update_weights(bool taken) {
+    bool pred = sum >= 0;
+    bool weak = ((sum < 0) ? -sum : sum) <= THRESH;
+    if ((pred != taken) || weak)
+      train(taken);
+
+    // Dynamic Thresholding, as in GEHL
+    if (pred != taken) {
+      ++TC;
+      if (TC == 63) {
+        if (THRESH != 255)
+          ++THRESH;
+        TC = 0;
+      }
+    }
+    if ((pred == taken) && weak) {
+      --TC;
+      if (TC == -64) {
+        if (THRESH != 0)
+          --THRESH;
+        TC = 0;
+      }
+    }
+  }
+
+  void update_ghist(bool taken) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      if constexpr (L[i] != 0)
+        ghist_folds[i] = shift_fold<LOG_SIZES[i], L[i]>(ghist_folds[i], taken, bool((ghist >> (L[i] - 1)) & 1));
+    });
+    ghist = (ghist << 1) | history_t(taken);
+  }
+  void update_phist(path_t addr_bit) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t LENGTH = phist_fold_length(i);
+      if constexpr (LENGTH != 0)
+        phist_folds[i] = shift_fold<LOG_SIZES[i], LENGTH>(phist_folds[i], addr_bit != 0, bool((phist >> (LENGTH - 1)) & 1));
+    });
+    phist = ((phist << 1) & PATH_HIST_MASK) | addr_bit;
+  }
+
+  // Update the predictor after a prediction has been made, like PREDICTOR's
+  void update_predictor(const branch_record_c* br, const op_state_c*, bool taken) {
+
+    address_t pc = br->instruction_addr;
+    if (/* conditional branch */ br->is_conditional) {
+
+      if (loop.valid()) {
+        if (perceptron_pred != loop.prediction()) {
+          if (loop.prediction() == taken) {
+            WITHLOOP = counter_inc(WITHLOOP, WITHLOOP_WIDTH);
+          } else {
+            WITHLOOP = counter_dec(WITHLOOP, WITHLOOP_WIDTH);
+          }
+        }
+      }
+      loop.update(taken, (perceptron_pred != taken), perceptron_pred, [this]() { return MYRANDOM(); });
+
+      update_weights(taken);
+      update_ghist(taken);
+      update_phist(pc & 1);
+    } else if (br->is_call || br->is_return || br->is_indirect) {
+      update_ghist(true);
+      update_phist(pc & 1);
+    }
+
+  }
+};
+
+#endif // PERCEPTRON_PREDICTOR_H_SEEN
@@ -0,0 +1,220 @@
+/* Description: This file defines PHT_STORAGE, the storage of a GEHL
+ * predictor's pattern history tables: one arena, aligned to a cache line,
+ * holding every table in one of two layouts, with each counter either in a
+ * byte of its own or packed into exactly its budgeted bits.  It can also count
+ * the cache lines a prediction touches, so the layouts can be compared.
+ */
+
+#ifndef PHT_STORAGE_H_SEEN
+#define PHT_STORAGE_H_SEEN
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <inttypes.h>
+#include <utility>
+
+// How PHT_STORAGE lays out its tables
+enum PHT_LAYOUT {
+  PHT_LAYOUT_TABLES,      // each table contiguous, one after another
+  PHT_LAYOUT_INTERLEAVED  // a block of each table side by side in every cache line, so the
+                          // entries whose indices share their high bits share a line
+};
+
+// The tables of CONFIG (NUM_TABLES, PHT_SIZES, COUNTER_BITS, LAYOUT and
+// PACKED, as in GEHL_CONFIG_CBP), each entry a COUNTER.  Entry 'index' of
+// table T is get<T>(index); T is a template argument so the table's place in
+// the arena is a constant.  Packed entries are read and written with one
+// unaligned 64-bit access, which assumes a little-endian machine.
+template <class CONFIG, class COUNTER>
+class PHT_STORAGE {
+public:
+  static constexpr int NUM_TABLES = CONFIG::NUM_TABLES;
+  static constexpr PHT_LAYOUT LAYOUT = CONFIG::LAYOUT;
+  static constexpr bool PACKED = CONFIG::PACKED;
+  static const std::size_t LINE_BITS = 512;  // 64-byte cache lines
+
+private:
+  static constexpr std::size_t table_size(int t) {
+    return std::size_t(1) << CONFIG::PHT_SIZES[t];
+  }
+  static constexpr std::size_t max_table_size() {
+    std::size_t size = 0;
+    for (int t = 0; t < NUM_TABLES; ++t)
+      size = (table_size(t) > size) ? table_size(t) : size;
+    return size;
+  }
+  // The bits an entry of table t takes in the arena
+  static constexpr std::size_t entry_bits(int t) {
+    return PACKED ? CONFIG::COUNTER_BITS[t] : 8 * sizeof(COUNTER);
+  }
+
+  // PHT_LAYOUT_TABLES: the bit where each table starts; each starts a cache
+  // line
+  static constexpr std::array<std::size_t, NUM_TABLES> table_bases() {
+    std::array<std::size_t, NUM_TABLES> bases = {};
+    std::size_t base = 0;
+    for (int t = 0; t < NUM_TABLES; ++t) {
+      bases[t] = base;
+      base += (table_size(t) * entry_bits(t) + LINE_BITS - 1) / LINE_BITS * LINE_BITS;
+    }
+    return bases;
+  }
+  static constexpr std::array<std::size_t, NUM_TABLES> TABLE_BASES = table_bases();
+
+  // PHT_LAYOUT_INTERLEAVED: a row holds a block of BLOCK entries of each
+  // table, in table order, and is padded to a power of two bits, so the rows
+  // tile the cache lines and none crosses one.  The arena has rows for the
+  // biggest table, so smaller tables leave holes.
+  static constexpr std::size_t row_entry_bits() {
+    std::size_t bits = 0;
+    for (int t = 0; t < NUM_TABLES; ++t)
+      bits += entry_bits(t);
+    return bits;
+  }
+  static constexpr std::size_t block_size() {
+    std::size_t block = 1;
+    while (2 * block * row_entry_bits() <= LINE_BITS)
+      block *= 2;
+    return block;
+  }
+  static constexpr std::size_t BLOCK = block_size();
+  static constexpr std::size_t row_bits() {
+    std::size_t bits = 1;
+    while (bits < BLOCK * row_entry_bits())
+      bits *= 2;
+    return bits;
+  }
+  static constexpr std::size_t ROW_BITS = row_bits();
+  static_assert((LAYOUT != PHT_LAYOUT_INTERLEAVED) || (ROW_BITS <= LINE_BITS),
+                "an interleaved row of one entry of each table doesn't fit in a cache line");
+  static constexpr std::array<std::size_t, NUM_TABLES> row_bases() {
+    std::array<std::size_t, NUM_TABLES> bases = {};
+    std::size_t base = 0;
+    for (int t = 0; t < NUM_TABLES; ++t) {
+      bases[t] = base;
+      base += BLOCK * entry_bits(t);
+    }
+    return bases;
+  }
+  static constexpr std::array<std::size_t, NUM_TABLES> ROW_BASES = row_bases();
+
+  static constexpr std::size_t arena_bits() {
+    if (LAYOUT == PHT_LAYOUT_TABLES)
+      return TABLE_BASES[NUM_TABLES - 1] + table_size(NUM_TABLES - 1) * entry_bits(NUM_TABLES - 1);
+    return (max_table_size() + BLOCK - 1) / BLOCK * ROW_BITS;
+  }
+  static constexpr std::size_t counter_bits() {
+    std::size_t bits = 0;
+    for (int t = 0; t < NUM_TABLES; ++t)
+      bits += table_size(t) * CONFIG::COUNTER_BITS[t];
+    return bits;
+  }
+
+public:
+  // The bits the counters are budgeted, and the bits the arena takes (the
+  // same for packed tables that fill whole cache lines)
+  static constexpr std::size_t COUNTER_BITS = counter_bits();
+  static constexpr std::size_t ARENA_BITS = arena_bits();
+  // PHT_LAYOUT_INTERLEAVED: the entries of each table in a row; the entries
+  // at the same index / ROW_ENTRIES of every table share a cache line
+  static constexpr std::size_t ROW_ENTRIES = BLOCK;
+
+  // The first bit of entry 'index' of table T in the arena
+  template <int T>
+  static std::size_t bit_offset(std::size_t index) {
+    if constexpr (LAYOUT == PHT_LAYOUT_TABLES)
+      return TABLE_BASES[T] + index * entry_bits(T);
+    else
+      return (index / BLOCK) * ROW_BITS + ROW_BASES[T] + (index % BLOCK) * entry_bits(T);
+  }
+
+private:
+  // packed entries are read 8 bytes at a time, so the arena has 8 bytes to spare
+  alignas(LINE_BITS / 8) std::array<uint8_t, (ARENA_BITS + 7) / 8 + (PACKED ? 8 : 0)> arena;
+
+  template <class INDICES, int... T>
+  static int count_lines(const INDICES& indices, std::integer_sequence<int, T...>) {
+    std::array<std::size_t, NUM_TABLES> lines = {{(bit_offset<T>(indices[T]) / LINE_BITS)...}};
+    int count = 0;
+    for (int t = 0; t < NUM_TABLES; ++t) {
+      int u = 0;
+      while ((u < t) && (lines[u] != lines[t]))
+        ++u;
+      count += (u == t);
+    }
+    return count;
+  }
+
+  template <class INDICES, int... T>
+  void prefetch(const INDICES& indices, std::integer_sequence<int, T...>) const {
+    (__builtin_prefetch(&arena[bit_offset<T>(indices[T]) / 8]), ...);
+  }
+
+  template <int... T>
+  void fill(COUNTER value, std::integer_sequence<int, T...>) {
+    (fill_table<T>(value), ...);
+  }
+  template <int T>
+  void fill_table(COUNTER value) {
+    for (std::size_t index = 0; index < table_size(T); ++index)
+      set<T>(index, value);
+  }
+
+public:
+  // uses compiler generated constructor
+  // uses compiler generated copy constructor
+  // uses compiler generated destructor
+  // uses compiler generated assignment operator
+
+  // Sets every entry of every table to value
+  void fill(COUNTER value) {
+    arena.fill(0);
+    fill(value, std::make_integer_sequence<int, NUM_TABLES>());
+  }
+
+  template <int T>
+  COUNTER get(std::size_t index) const {
+    std::size_t bit = bit_offset<T>(index);
+    if constexpr (!PACKED) {
+      COUNTER value;
+      memcpy(&value, &arena[bit / 8], sizeof(value));
+      return value;
+    } else {
+      constexpr int WIDTH = entry_bits(T);
+      uint64_t word;
+      memcpy(&word, &arena[bit / 8], sizeof(word));
+      // shift the field to the top, then sign extend it back down
+      return COUNTER(int64_t(word << (64 - WIDTH - bit % 8)) >> (64 - WIDTH));
+    }
+  }
+  template <int T>
+  void set(std::size_t index, COUNTER value) {
+    std::size_t bit = bit_offset<T>(index);
+    if constexpr (!PACKED) {
+      memcpy(&arena[bit / 8], &value, sizeof(value));
+    } else {
+      constexpr int WIDTH = entry_bits(T);
+      uint64_t word;
+      memcpy(&word, &arena[bit / 8], sizeof(word));
+      uint64_t mask = ((uint64_t(1) << WIDTH) - 1) << (bit % 8);
+      word = (word & ~mask) | ((uint64_t(value) << (bit % 8)) & mask);
+      memcpy(&arena[bit / 8], &word, sizeof(word));
+    }
+  }
+
+  // Prefetches the entry at indices[t] of each table t
+  template <class INDICES>
+  void prefetch(const INDICES& indices) const {
+    prefetch(indices, std::make_integer_sequence<int, NUM_TABLES>());
+  }
+
+  // The number of distinct cache lines holding the entries at indices[t] of
+  // each table t
+  template <class INDICES>
+  static int count_lines(const INDICES& indices) {
+    return count_lines(indices, std::make_integer_sequence<int, NUM_TABLES>());
+  }
+};
+
+#endif // PHT_STORAGE_H_SEEN
@@ -5,40 +5,58 @@
 #ifndef PREDICTOR_H_SEEN
 #define PREDICTOR_H_SEEN
 
+#include <array>
 #include <bitset>
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <inttypes.h>
 #include <map>
+#include <utility>
 #include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "loop_predictor.h"
 #include "op_state.h"   // defines op_state_c (architectural state) class
+#include "pht_storage.h"
+#include "storage_budget.h"
 #include "tread.h"      // defines branch_record_c class
 
 #define abs(x) ((x)<0 ? -(x) : (x))
 
 
-class loop_entry {
-public:
-  uint16_t PastIter;		// 10 bits
-  uint8_t conf;		      // 2 bits
-  uint16_t CurIter;		  // 10 bits
-
-  uint16_t TAG;			    // 12 bits
-  uint8_t age;			    // 4 bits
-  bool dir;			        // 1 bit
-
-  // 39 bits per entry
-  loop_entry () {
-    conf = 0;
-    CurIter = 0;
-    PastIter = 0;
-    TAG = 0;
-    age = 0;
-    dir = false;
-  }
+// How GEHL_PREDICTOR computes its table indices (see calc_indices)
+enum GEHL_INDEX {
+  GEHL_INDEX_BITSET,  // the original: phist, ghist and the pc XOR-folded out of a std::bitset; slow
+  GEHL_INDEX_EXACT,   // the same indices, from incrementally folded history registers
+  GEHL_INDEX_FAST     // a cheaper hash of the pc, the last L bits of ghist and some phist
+};
 
+// A GEHL configuration: the number of tables and, per table, the history
+// length, the log2 of the number of counters, and the counter width, plus the
+// index function, the layout of the tables in memory, whether the counters
+// and loop entries are packed into their budgeted bits, and whether to count
+// the cache lines each prediction touches (see print_stats), and the storage
+// budget the predictor must fit in (see GEHL_PREDICTOR::BUDGET).  The
+// configuration is a template parameter of GEHL_PREDICTOR, so every mask,
+// shift and saturation bound derived from it is a compile-time constant, and
+// predictors with different configurations can be used side by side.  Other
+// configurations can derive from this one and override what they change.
+struct GEHL_CONFIG_CBP {
+  static constexpr GEHL_INDEX INDEX = GEHL_INDEX_EXACT;
+  static constexpr PHT_LAYOUT LAYOUT = PHT_LAYOUT_TABLES;
+  static constexpr bool PACKED = false;
+  static constexpr bool COUNT_LINES = false;
+  static constexpr int NUM_TABLES = 8;
+  static constexpr std::array<std::size_t, NUM_TABLES> L = {{0, 2, 4, 8, 16, 32, 64, 128}};
+  static constexpr std::array<std::size_t, NUM_TABLES> PHT_SIZES = {{11, 10, 11, 11, 11, 11, 11, 11}};
+  static constexpr std::array<std::size_t, NUM_TABLES> COUNTER_BITS = {{5, 5, 4, 4, 4, 4, 4, 4}};
+  static constexpr std::size_t BUDGET_BITS = CBP_BUDGET_BITS;
 };
 
-class PREDICTOR {
+template <class CONFIG>
+class GEHL_PREDICTOR {
 public:
   typedef uint32_t address_t;
 
@@ -48,10 +66,56 @@ private:
   typedef int8_t counter_t;
 
   // Constant Definitions
-  static const int NUM_TABLES = 8;
-  const size_t L[NUM_TABLES] = {0, 2, 4, 8, 16, 32, 64, 128};
-  const size_t PHT_SIZES[NUM_TABLES] = {11, 10, 11, 11, 11, 11, 11, 11};
-  const size_t COUNTER_BITS[NUM_TABLES] = {5, 5, 4, 4, 4, 4, 4, 4};
+  static constexpr GEHL_INDEX INDEX = CONFIG::INDEX;
+  static constexpr bool COUNT_LINES = CONFIG::COUNT_LINES;
+  static constexpr int NUM_TABLES = CONFIG::NUM_TABLES;
+  static constexpr std::array<std::size_t, NUM_TABLES> L = CONFIG::L;
+  static constexpr std::array<std::size_t, NUM_TABLES> PHT_SIZES = CONFIG::PHT_SIZES;
+  static constexpr std::array<std::size_t, NUM_TABLES> COUNTER_BITS = CONFIG::COUNTER_BITS;
+
+  // The ghist (and, for short histories, phist) mask of a table.  This was
+  // computed as the int expression (1 << L) - 1 at run time, where x86 only
+  // uses the low 5 bits of the shift count, so tables with L >= 32 got an
+  // empty mask; that behavior is kept so the predictions stay the same.
+  static constexpr unsigned long long history_mask(std::size_t length) {
+    return (unsigned long long)((1 << (length & 31)) - 1);
+  }
+
+  // The adder works in fixed point, in units of 1/SUM_SCALE: a counter's
+  // weight 1/COUNTER_BITS[i] becomes SUM_SCALE/COUNTER_BITS[i], where
+  // SUM_SCALE is the least common multiple of the COUNTER_BITS.
+  static constexpr int gcd(int a, int b) {
+    return (b == 0) ? a : gcd(b, a % b);
+  }
+  static constexpr int sum_scale() {
+    int scale = 1;
+    for (int i = 0; i < NUM_TABLES; ++i)
+      scale = scale / gcd(scale, COUNTER_BITS[i]) * COUNTER_BITS[i];
+    return scale;
+  }
+  static constexpr int SUM_SCALE = sum_scale();
+  // The sum used to be a double; with a COUNTER_BITS that isn't a power of 2,
+  // its rounding errors can land it just off a whole number (see calc_sum)
+  static constexpr bool sum_rounds() {
+    for (int i = 0; i < NUM_TABLES; ++i)
+      if (COUNTER_BITS[i] & (COUNTER_BITS[i] - 1))
+        return true;
+    return false;
+  }
+  static constexpr bool SUM_ROUNDS = sum_rounds();
+
+  // Calls f(std::integral_constant<int, i>()) for each table i in order; the
+  // loop is unrolled and i is a constant inside f.
+  template <class F, int... I>
+  static void for_each_table(F f, std::integer_sequence<int, I...>) {
+    (f(std::integral_constant<int, I>()), ...);
+  }
+  template <class F>
+  static void for_each_table(F f) {
+    for_each_table(f, std::make_integer_sequence<int, NUM_TABLES>());
+  }
+
+  typedef PHT_STORAGE<CONFIG, counter_t> pht_t;
 
   // Path History
   static const int PATH_HIST_LENGTH = 48;  // 48 bits
@@ -61,12 +125,89 @@ private:
   static const int GLOBAL_HIST_LENGTH = (1 << (NUM_TABLES - 1));  // 128 bits
   static const counter_t PHT_INIT = /* very weakly taken */ 0;
 
+  // Index Functions
+  static const int INDEX_BITS = 128 + PATH_HIST_LENGTH + 32;  // width of the GEHL_INDEX_BITSET vector
+  static const int FAST_PATH_LENGTH = 16;  // most phist bits GEHL_INDEX_FAST uses
+
+  // The GEHL_INDEX_BITSET index of table i is the XOR-fold, in PHT_SIZES[i]
+  // bit chunks, of a vector holding phist at bit 0, ghist at bit
+  // exact_ghist_offset(i) and the pc at bit exact_pc_offset(i), each masked as
+  // in calc_indices_bitset().  The fold is linear, so GEHL_INDEX_EXACT gets the
+  // same index by XORing the folds of the three parts, each rotated by its
+  // offset; the history folds are kept up to date as the histories shift.
+  static constexpr std::size_t exact_ghist_offset(int i) {
+    return (L[i] < PATH_HIST_LENGTH) ? L[i] : PATH_HIST_LENGTH;
+  }
+  static constexpr std::size_t exact_pc_offset(int i) {
+    return exact_ghist_offset(i) + L[i];
+  }
+  // The number of ghist and phist bits folded into the index of table i
+  static constexpr std::size_t ghist_fold_length(int i) {
+    if (INDEX == GEHL_INDEX_FAST)
+      return L[i];
+    if (INDEX == GEHL_INDEX_EXACT)
+      return L[i] & 31;  // see history_mask()
+    return 0;
+  }
+  static constexpr std::size_t phist_fold_length(int i) {
+    if ((INDEX == GEHL_INDEX_BITSET) || (L[i] == 0))
+      return 0;
+    if (INDEX == GEHL_INDEX_FAST)
+      return (L[i] < FAST_PATH_LENGTH) ? L[i] : FAST_PATH_LENGTH;
+    return (L[i] < PATH_HIST_LENGTH) ? (L[i] & 31) : PATH_HIST_LENGTH;
+  }
+
+  // value XOR-folded down to W bits
+  template <std::size_t W>
+  static uint32_t fold(uint64_t value) {
+    uint64_t folded = 0;
+    for (std::size_t shift = 0; shift < 64; shift += W)
+      folded ^= value >> shift;
+    return uint32_t(folded) & ((uint32_t(1) << W) - 1);
+  }
+  // a W-bit value rotated left by R
+  template <std::size_t W, std::size_t R>
+  static uint32_t rotate(uint32_t value) {
+    return ((value << (R % W)) | (value >> ((W - R % W) % W))) & ((uint32_t(1) << W) - 1);
+  }
+  // Shifts bit in into the W-bit fold of a LENGTH-bit history, and out (the
+  // history's oldest bit) out of it
+  template <std::size_t W, std::size_t LENGTH>
+  static uint32_t shift_fold(uint32_t folded, bool in, bool out) {
+    folded = (folded << 1) | uint32_t(in);
+    folded ^= folded >> W;
+    folded &= (uint32_t(1) << W) - 1;
+    return folded ^ (uint32_t(out) << (LENGTH % W));
+  }
+
+#if defined(__SSE2__)
+  // The SSE2 kernel holds one table's counter per 16-bit lane
+  static const int SIMD_LANES = 8;
+  static constexpr bool SIMD = NUM_TABLES <= SIMD_LANES;
+  typedef std::array<int16_t, SIMD_LANES> lanes_t;
+  // per lane: the weight, and the counter's bounds (lanes past NUM_TABLES stay 0)
+  static constexpr lanes_t simd_lanes(int what) {
+    lanes_t lanes = {};
+    for (int i = 0; i < NUM_TABLES && i < SIMD_LANES; ++i) {
+      if (what == 0)
+        lanes[i] = SUM_SCALE / COUNTER_BITS[i];
+      else if (what == 1)
+        lanes[i] = (1 << (COUNTER_BITS[i] - 1)) - 1;
+      else
+        lanes[i] = -(1 << (COUNTER_BITS[i] - 1));
+    }
+    return lanes;
+  }
+  alignas(16) static constexpr lanes_t SIMD_WEIGHTS = simd_lanes(0);
+  alignas(16) static constexpr lanes_t SIMD_COUNTER_MAX = simd_lanes(1);
+  alignas(16) static constexpr lanes_t SIMD_COUNTER_MIN = simd_lanes(2);
+#else
+  static constexpr bool SIMD = false;
+#endif
+
   // Loop Predictor
   static const int LOOP_PRED_SIZE  = 5;  // 32 entries
-  static const int WIDTH_ITER_LOOP = 10; // we predict only loops with less than 1K iterations
-  static const int LOOP_TAG_WIDTH  = 12; // tag width in the loop predictor
-  static const int LOOP_CONFIDENCE = 3;  // Max Confidence in a loop prediction
-  static const int MAX_AGE         = 15; // Max Age of a loop prediction
+  typedef LOOP_PREDICTOR<LOOP_PRED_SIZE, CONFIG::PACKED> loop_t;
   static const int WITHLOOP_WIDTH  = 7;  // Counter width of the WITHLOOP counter
 
   static counter_t counter_inc(/* n-bit counter */ counter_t cnt, int n) {
@@ -80,16 +221,47 @@ private:
     return cnt;
   }
 
+  static constexpr std::size_t log2(std::size_t n) {
+    return (n <= 1) ? 0 : 1 + log2(n / 2);
+  }
+
+public:
+  // The hardware storage of each component, in budgeted bits, whether or not
+  // it is PACKED; state derived from it (the history folds) and the per branch
+  // variables aren't counted.  A configuration whose total is over its
+  // BUDGET_BITS doesn't compile (see the constructor), but STORAGE_BITS and
+  // FITS_BUDGET can be read without constructing one, so a sweep can skip it.
+  static constexpr std::array<BUDGET_ITEM, 8> BUDGET = {{
+    {"ghist", GLOBAL_HIST_LENGTH},
+    {"phist", PATH_HIST_LENGTH},
+    {"pht", pht_t::COUNTER_BITS},
+    {"loop table", loop_t::BUDGET_BITS},
+    {"WITHLOOP", WITHLOOP_WIDTH},
+    {"Seed", 32},
+    {"THRESH", log2(NUM_TABLES)},
+    {"TC", 7}
+  }};
+  static constexpr std::size_t STORAGE_BITS = budget_bits(BUDGET);
+  static constexpr std::size_t BUDGET_LIMIT = CONFIG::BUDGET_BITS;
+  static constexpr bool FITS_BUDGET = STORAGE_BITS <= BUDGET_LIMIT;
+  // it never looks at its op_state_c argument (see op_state.h)
+  static constexpr uint OP_STATE_USE = OP_STATE_NONE;
+
+private:
   // Hardware Data Structures
 
   // Global History Register
   history_t ghist;                         // 128 bits
   // Path History Register to prevent path aliasing
   path_t phist;                            // 48 bits
+  // ghist and phist folded to each table's index width (derived from ghist
+  // and phist, so not counted)
+  std::array<uint32_t, NUM_TABLES> ghist_folds;
+  std::array<uint32_t, NUM_TABLES> phist_folds;
   // Various Pattern History Tables indexed by History Length
-  std::vector<counter_t> pht[NUM_TABLES];  // 1 x 2K x 5 + 1 x 1K x 5 + 6 x 2K x 4 = 63K
-  // Loop Predictor Table
-  loop_entry *ltable;			                 // 39 * 32 bits = 1248 bits
+  pht_t pht;                               // 1 x 2K x 5 + 1 x 1K x 5 + 6 x 2K x 4 = 63K
+  // Loop Predictor
+  loop_t loop;                             // 39 * 32 bits = 1248 bits
   // Counter to monitor whether or not loop prediction is beneficial
   int8_t WITHLOOP;		                     // 7 bits
   // A seed for generating randomness
@@ -99,22 +271,30 @@ private:
   // Counter for dynamic thresholding
   counter_t TC;                            // 7 bits
 
-  // Total = 65985 bits < 64K + 512 bits = 66048
+  // Total = 65985 bits < 64K + 512 bits = 66048 (see BUDGET)
+
+  // Cache lines of pht touched by the predictions, if COUNT_LINES
+  uint64_t line_predictions;
+  uint64_t lines_touched;
 
   // Per Branch Variables used in both getting and updating prediction
-  std::size_t indices[NUM_TABLES];         // Indices to the pht
-  double sum;                              // Adder sum
+  std::array<std::size_t, NUM_TABLES> indices;  // Indices to the pht
+  int sum;                                 // Adder sum, in units of 1/SUM_SCALE
+  bool sum_whole;                          // SUM_ROUNDS and sum is a multiple of SUM_SCALE
+  double rounded_sum;                      // if sum_whole, the sum as the double adder had it
   bool prediction;                         // Prediction of this particular branch
 
-  // Variables for the loop predictor
-  bool LVALID;			          // validity of the loop predictor prediction
-  bool predloop;			        // loop predictor prediction
-  int LIB;
-  int LI;
-  int LHIT;			      // hitting way in the loop predictor
-  int LTAG;			      // tag on the loop predictor
+  // Look-ahead: set once indices hold the next branch's (see update_predictor)
+  address_t next_pc;
+  bool have_next;                          // indices are next_pc's
 
   void update_ghist(bool taken) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t LENGTH = ghist_fold_length(i);
+      if constexpr (LENGTH != 0)
+        ghist_folds[i] = shift_fold<PHT_SIZES[i], LENGTH>(ghist_folds[i], taken, bool((ghist >> (LENGTH - 1)) & 1));
+    });
     ghist <<= 1;
     // ghist &= GLOBAL_HIST_MASK; // Not needed as max width of ghist is 128 bits
     if (taken)
@@ -122,42 +302,112 @@ private:
   }
 
   void update_phist(path_t addr_bit) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t LENGTH = phist_fold_length(i);
+      if constexpr (LENGTH != 0)
+        phist_folds[i] = shift_fold<PHT_SIZES[i], LENGTH>(phist_folds[i], addr_bit != 0, bool((phist >> (LENGTH - 1)) & 1));
+    });
     phist <<= 1;
     phist &= PATH_HIST_MASK;
     phist |= addr_bit;
   }
 
 public:
-  PREDICTOR(void)
+  GEHL_PREDICTOR(void)
     : ghist(0)
     , phist(0)
-    , ltable(new loop_entry[1 << LOOP_PRED_SIZE])
     , WITHLOOP(-1)
     , Seed(0)
     , THRESH(NUM_TABLES)
     , TC(0)
+    , line_predictions(0)
+    , lines_touched(0)
+    , have_next(false)
   {
-    for (std::size_t it = 0; it < NUM_TABLES; ++it) {
-      pht[it] = std::vector<counter_t>(std::size_t(1) << PHT_SIZES[it], counter_t(PHT_INIT));
-    }
+    static_assert(FITS_BUDGET, "the configuration is over its storage budget (see BUDGET)");
+    pht.fill(counter_t(PHT_INIT));
+    ghist_folds.fill(0);
+    phist_folds.fill(0);
   }
   // uses compiler generated copy constructor
   // uses compiler generated destructor
   // uses compiler generated assignment operator
 
-  void calc_indices(address_t pc) {
-    for (int i = 0; i < NUM_TABLES; ++i) {
-      std::size_t PHT_INDEX_MASK = (std::size_t(1) << PHT_SIZES[i]) - 1;
+  // Computes the pht indices of the branch at pc, from the current histories,
+  // into out
+  void calc_indices(address_t pc, std::array<std::size_t, NUM_TABLES>& out) const {
+    if constexpr (INDEX == GEHL_INDEX_BITSET)
+      calc_indices_bitset(pc, out);
+    else
+      calc_indices_hashed(pc, out);
+    if constexpr (CONFIG::LAYOUT == PHT_LAYOUT_INTERLEAVED)
+      share_rows(out);
+  }
+
+  // PHT_LAYOUT_INTERLEAVED: every table takes its row, the index bits above
+  // the offset in the row, from the index of ROW_TABLE (the pc and the
+  // shortest history), and only the offset in the row from its own index, so
+  // a prediction reads one row, which sits in one cache line
+  static constexpr int row_table() {
+    int i = 0;
+    while ((i < NUM_TABLES - 1) && (L[i] == 0))
+      ++i;
+    return i;
+  }
+  static constexpr int ROW_TABLE = row_table();
+  static constexpr std::size_t row_shift() {
+    std::size_t shift = 0;
+    while ((std::size_t(1) << shift) < pht_t::ROW_ENTRIES)
+      ++shift;
+    return shift;
+  }
+  static void share_rows(std::array<std::size_t, NUM_TABLES>& out) {
+    constexpr std::size_t ROW_SHIFT = row_shift();
+    std::size_t row = out[ROW_TABLE] >> ROW_SHIFT;
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t PHT_INDEX_MASK = (std::size_t(1) << PHT_SIZES[i]) - 1;
+      out[i] = ((row << ROW_SHIFT) | (out[i] & (pht_t::ROW_ENTRIES - 1))) & PHT_INDEX_MASK;
+    });
+  }
+
+  // The GEHL_INDEX_EXACT and GEHL_INDEX_FAST indices
+  void calc_indices_hashed(address_t pc, std::array<std::size_t, NUM_TABLES>& out) const {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t W = PHT_SIZES[i];
+      constexpr std::size_t PHT_INDEX_MASK = (std::size_t(1) << W) - 1;
+      std::size_t index = pc & PHT_INDEX_MASK;
+      if constexpr ((INDEX == GEHL_INDEX_EXACT) && (L[i] != 0)) {
+        // the pc bits that fit in the bitset vector
+        constexpr std::size_t PC_OFFSET = exact_pc_offset(i);
+        constexpr std::size_t PC_BITS = (PC_OFFSET >= INDEX_BITS) ? 0 : INDEX_BITS - PC_OFFSET;
+        constexpr uint64_t PC_MASK = (PC_BITS >= 32) ? 0xffffffff : (uint64_t(1) << PC_BITS) - 1;
+        index = phist_folds[i] ^ rotate<W, exact_ghist_offset(i)>(ghist_folds[i]) ^
+                rotate<W, PC_OFFSET>(fold<W>(pc & PC_MASK));
+      } else if constexpr ((INDEX == GEHL_INDEX_FAST) && (L[i] != 0)) {
+        index = (pc ^ (pc >> W) ^ ghist_folds[i] ^ rotate<W, W / 2>(phist_folds[i])) & PHT_INDEX_MASK;
+      }
+      out[i] = index;
+    });
+  }
+
+  // The original index function, kept as the reference for GEHL_INDEX_EXACT
+  void calc_indices_bitset(address_t pc, std::array<std::size_t, NUM_TABLES>& out) const {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t PHT_INDEX_MASK = (std::size_t(1) << PHT_SIZES[i]) - 1;
       std::size_t index = pc & PHT_INDEX_MASK;
-      if (L[i] != 0) {
-        typedef std::bitset<128 + PATH_HIST_LENGTH + 32> index_t;
+      if constexpr (L[i] != 0) {
+        typedef std::bitset<INDEX_BITS> index_t;
         index_t bitvector;
         // history_t bitvector = 0;
-        index_t GLOBAL_HIST_MASK = (1 << L[i]) - 1;
+        index_t GLOBAL_HIST_MASK = history_mask(L[i]);
         index_t ghist_bits = index_t(ghist) & GLOBAL_HIST_MASK;
         std::size_t bitsfilled = 0;
         // First add path history
-        if (L[i] < PATH_HIST_LENGTH) {
+        if constexpr (L[i] < PATH_HIST_LENGTH) {
           bitvector |= index_t(phist) & GLOBAL_HIST_MASK;
           bitsfilled += L[i];
         } else {
@@ -180,8 +430,8 @@ public:
           bitvector >>= PHT_SIZES[i];
         }
       }
-      indices[i] = index;
-    }
+      out[i] = index;
+    });
   }
 
   // get_prediction() takes a branch record (br, branch_record_c is defined in
@@ -196,77 +446,107 @@ public:
 
       prediction = get_gehl_pred(pc);
 
-      predloop = get_loop_pred(pc);	// loop prediction
-      prediction = ((WITHLOOP >= 0) && (LVALID)) ? predloop : prediction;
+      bool predloop = loop.get_prediction(pc);	// loop prediction
+      prediction = ((WITHLOOP >= 0) && loop.valid()) ? predloop : prediction;
 
     }
     return prediction;   // true for taken, false for not taken
   }
 
-  int lindex(address_t pc) {
-    return (((pc ^ (pc >> 2)) & ((1 << (LOOP_PRED_SIZE - 2)) - 1)) << 2);
-  }
-
-  // loop prediction: only used if high confidence
-  // skewed associative 4-way
-  // At fetch time: speculative
-  bool get_loop_pred(address_t pc) {
-      LHIT = -1;
-
-      LI = lindex (pc);
-      LIB = ((pc >> (LOOP_PRED_SIZE - 2)) & ((1 << (LOOP_PRED_SIZE - 2)) - 1));
-      LTAG = (pc >> (LOOP_PRED_SIZE - 2)) & ((1 << 2 * LOOP_TAG_WIDTH) - 1);
-      LTAG ^= (LTAG >> LOOP_TAG_WIDTH);
-      LTAG = (LTAG & ((1 << LOOP_TAG_WIDTH) - 1));
-
-      for (int i = 0; i < 4; i++) {
-        int index = (LI ^ ((LIB >> i) << 2)) + i;
-        if (ltable[index].TAG == LTAG) {
-          LHIT = i;
-          LVALID = ((ltable[index].conf == LOOP_CONFIDENCE)
-                    || (ltable[index].conf * ltable[index].PastIter > 128));
-          if (ltable[index].CurIter + 1 == ltable[index].PastIter) {
-            return !(ltable[index].dir);
-          }
-          return ltable[index].dir;
-        }
-      }
-      LVALID = false;
-      return false;
-  }
-
   bool get_gehl_pred(address_t pc) {
-    calc_indices(pc);
+    if (!have_next || (next_pc != pc))
+      calc_indices(pc, indices);
+    have_next = false;
+    if constexpr (COUNT_LINES) {
+      ++line_predictions;
+      lines_touched += pht_t::count_lines(indices);
+    }
     calc_sum();
-    return sum >= 0;
+    return sum_taken();
   }
 
-  double calc_sum() {
-    // double sum = NUM_TABLES / 2;
-    sum = 0;
-
-    for (int i = 0; i < NUM_TABLES; ++i) {
-      sum += ((double)pht[i][indices[i]])/COUNTER_BITS[i];
+#if defined(__SSE2__)
+  // The counter of table i at its current index; 0 past the last table
+  template <int i>
+  int16_t lane_counter() const {
+    if constexpr (i < NUM_TABLES)
+      return pht.template get<i>(indices[i]);
+    else
+      return 0;
+  }
+  // The counters at the current indices, one table per lane
+  __m128i load_counters() const {
+    return _mm_set_epi16(lane_counter<7>(), lane_counter<6>(), lane_counter<5>(), lane_counter<4>(),
+                         lane_counter<3>(), lane_counter<2>(), lane_counter<1>(), lane_counter<0>());
+  }
+#endif
+
+  // The original adder summed the counters as doubles; the fixed-point sum
+  // is exact, so the two differ by the double's rounding error (< 1e-15).
+  // That can only change a comparison with a whole number (0 or THRESH) when
+  // the exact sum is a whole number itself, so then the double sum is
+  // recomputed and used, which keeps the predictions the same.
+  int calc_sum() {
+    if constexpr (SIMD) {
+#if defined(__SSE2__)
+      __m128i products = _mm_madd_epi16(load_counters(), _mm_load_si128((const __m128i*)SIMD_WEIGHTS.data()));
+      products = _mm_add_epi32(products, _mm_shuffle_epi32(products, _MM_SHUFFLE(1, 0, 3, 2)));
+      products = _mm_add_epi32(products, _mm_shuffle_epi32(products, _MM_SHUFFLE(2, 3, 0, 1)));
+      sum = _mm_cvtsi128_si32(products);
+#endif
+    } else {
+      sum = 0;
+      for_each_table([&](auto I) {
+        sum += pht.template get<I>(indices[I]) * (SUM_SCALE / int(COUNTER_BITS[I]));
+      });
     }
 
+    sum_whole = SUM_ROUNDS && ((sum % SUM_SCALE) == 0);
+    if (sum_whole) {
+      rounded_sum = 0;
+      for_each_table([&](auto I) {
+        rounded_sum += ((double)pht.template get<I>(indices[I]))/COUNTER_BITS[I];
+      });
+    }
     return sum;
   }
 
+  // sum >= 0, and abs(sum) < threshold, as the double adder decided them
+  bool sum_taken() const {
+    return sum_whole ? (rounded_sum >= 0) : (sum >= 0);
+  }
+  bool sum_below(int threshold) const {
+    return sum_whole ? (abs(rounded_sum) < threshold) : (abs(sum) < threshold * SUM_SCALE);
+  }
+
   void update_counters(bool taken) {
-    for (int i = 0; i < NUM_TABLES; ++i) {
-      std::size_t index = indices[i];
-      counter_t cnt = pht[i][index];
-      if (taken)
-        cnt = counter_inc(cnt, COUNTER_BITS[i]);
-      else
-        cnt = counter_dec(cnt, COUNTER_BITS[i]);
-      pht[i][index] = cnt;
+    if constexpr (SIMD) {
+#if defined(__SSE2__)
+      __m128i counters = _mm_add_epi16(load_counters(), _mm_set1_epi16(taken ? 1 : -1));
+      counters = _mm_min_epi16(counters, _mm_load_si128((const __m128i*)SIMD_COUNTER_MAX.data()));
+      counters = _mm_max_epi16(counters, _mm_load_si128((const __m128i*)SIMD_COUNTER_MIN.data()));
+      alignas(16) lanes_t lanes;
+      _mm_store_si128((__m128i*)lanes.data(), counters);
+      for_each_table([&](auto I) {
+        pht.template set<I>(indices[I], counter_t(lanes[I]));
+      });
+#endif
+    } else {
+      for_each_table([&](auto I) {
+        std::size_t index = indices[I];
+        counter_t cnt = pht.template get<I>(index);
+        if (taken)
+          cnt = counter_inc(cnt, COUNTER_BITS[I]);
+        else
+          cnt = counter_dec(cnt, COUNTER_BITS[I]);
+        pht.template set<I>(index, cnt);
+      });
     }
   }
 
   void update_gehl_predictor(bool taken) {
-    bool pred = sum >= 0;
-    if (pred != taken || abs(sum) < THRESH) {
+    bool pred = sum_taken();
+    if (pred != taken || sum_below(THRESH)) {
       update_counters(taken);
     }
 
@@ -279,7 +559,7 @@ public:
         TC = 0;
       }
     }
-    if ((pred == taken) && (abs(sum) < THRESH)) {
+    if ((pred == taken) && sum_below(THRESH)) {
       --TC;
       if (TC == -64) {
         if (THRESH != 0)
@@ -299,108 +579,71 @@ public:
   };
 
 
-  void update_loop_predictor (address_t, bool taken, bool alloc) {
-    bool gehl_prediction = sum >= 0;
-    if (LHIT >= 0) {
-      int index = (LI ^ ((LIB >> LHIT) << 2)) + LHIT;
-      //already a hit
-      if (LVALID) {
-        if (taken != predloop) {
-          // free the entry
-          ltable[index].PastIter = 0;
-          ltable[index].age = 0;
-          ltable[index].conf = 0;
-          ltable[index].CurIter = 0;
-          return;
-	      }	else if ((predloop != gehl_prediction) || ((MYRANDOM () & 7) == 0))
-          if (ltable[index].age < MAX_AGE)
-            ltable[index].age++;
-      }
-
-      ltable[index].CurIter++;
-      ltable[index].CurIter &= ((1 << WIDTH_ITER_LOOP) - 1);
-      // loop with more than 2** WIDTH_ITER_LOOP iterations are not treated correctly; but who cares :-)
-      if (ltable[index].CurIter > ltable[index].PastIter) {
-        ltable[index].conf = 0;
-        ltable[index].PastIter = 0;
-        // treat like the 1st encounter of the loop
-      }
-      if (taken != ltable[index].dir) {
-        if (ltable[index].CurIter == ltable[index].PastIter) {
-          if (ltable[index].conf < LOOP_CONFIDENCE)
-            ltable[index].conf++;
-          //just do not predict when the loop count is 1 or 2
-          if (ltable[index].PastIter < 3) {
-            // free the entry
-            ltable[index].dir = taken;
-            ltable[index].PastIter = 0;
-            ltable[index].age = 0;
-            ltable[index].conf = 0;
-          }
-	      }	else {
-          if (ltable[index].PastIter == 0) {
-            // first complete nest;
-            ltable[index].conf = 0;
-            ltable[index].PastIter = ltable[index].CurIter;
-          }	else {
-            //not the same number of iterations as last time: free the entry
-            ltable[index].PastIter = 0;
-            ltable[index].conf = 0;
-          }
-	      }
-        ltable[index].CurIter = 0;
-      }
-    } else if (alloc) {
-      address_t X = MYRANDOM () & 3;
-      if ((MYRANDOM () & 3) == 0)
-        for (int i = 0; i < 4; i++) {
-          int LHIT = (X + i) & 3;
-          int index = (LI ^ ((LIB >> LHIT) << 2)) + LHIT;
-          if (ltable[index].age == 0)	{
-            ltable[index].dir = !taken;
-            // most of mispredictions are on last iterations
-            ltable[index].TAG = LTAG;
-            ltable[index].PastIter = 0;
-            ltable[index].age = 7;
-            ltable[index].conf = 0;
-            ltable[index].CurIter = 0;
-            break;
-          }	else
-            ltable[index].age--;
-          break;
-        }
+  // Prints the predictor's own statistics, in the trace reader's format
+  void print_stats(void) const {
+    if (COUNT_LINES) {
+      printf("pht cache lines per prediction:  %8.3f\n",
+             line_predictions ? double(lines_touched) / line_predictions : 0.0);
     }
   }
 
   // Update the predictor after a prediction has been made.  This should accept
   // the branch record (br) and architectural state (os), as well as a third
   // argument (taken) indicating whether or not the branch was taken.
-  void update_predictor(const branch_record_c* br, const op_state_c*, bool taken) {
+  void update_predictor(const branch_record_c* br, const op_state_c* os, bool taken) {
+    update_predictor(br, os, taken, 0);
+  }
 
+  // The same, for a driver that already has the next branch (next_br; null if
+  // it doesn't).  Once the histories are updated, every input of the next
+  // branch's indices is known, so they are computed then and the pht entries
+  // and loop set its prediction reads are prefetched; get_prediction() uses
+  // the indices instead of computing them again.
+  void update_predictor(const branch_record_c* br, const op_state_c*, bool taken,
+                        const branch_record_c* next_br) {
+
+    have_next = false;
     address_t pc =  br->instruction_addr;
     if (/* conditional branch */ br->is_conditional) {
 
-      if (LVALID) {
-        if (prediction != predloop) {
-          if (predloop == taken) {
+      if (loop.valid()) {
+        if (prediction != loop.prediction()) {
+          if (loop.prediction() == taken) {
             WITHLOOP = counter_inc(WITHLOOP, WITHLOOP_WIDTH);
           } else {
             WITHLOOP = counter_dec(WITHLOOP, WITHLOOP_WIDTH);
           }
         }
       }
-      update_loop_predictor(pc, taken, (prediction != taken));
+      loop.update(taken, (prediction != taken), sum_taken(), [this]() { return MYRANDOM(); });
 
       update_gehl_predictor(taken);
       update_ghist(taken);
       update_phist(pc & 1);
+      look_ahead(next_br);
     } else if (br->is_call || br->is_return || br->is_indirect) {
       update_ghist(true);
       update_phist(pc & 1);
+      look_ahead(next_br);
     }
 
   }
+
+  // Computes the indices of next_br, if it is a conditional branch, and
+  // prefetches the entries its prediction will read
+  void look_ahead(const branch_record_c* next_br) {
+    if (!next_br || !next_br->is_conditional)
+      return;
+    next_pc = next_br->instruction_addr;
+    calc_indices(next_pc, indices);
+    have_next = true;
+    pht.prefetch(indices);
+    loop.prefetch(next_pc);
+  }
 };
 
+// The predictor the driver runs
+typedef GEHL_PREDICTOR<GEHL_CONFIG_CBP> PREDICTOR;
+
 #endif // PREDICTOR_H_SEEN
 
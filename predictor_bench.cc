@@ -0,0 +1,155 @@
+/* Description: Times registered predictors on a trace.  The trace's branches
+ * (all of them, or the first -n) are decoded into memory first, then each
+ * predictor runs over them alone, so the time reported (in ns per branch, the
+ * best of -r runs, each with a fresh predictor) leaves out decoding and the
+ * driver.  A predictor's own statistics (see branch_predictor_c::print_stats)
+ * follow its time.  The predictors see the reader's final op_state, which the
+ * reader only keeps up as far as they declare they read it.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "branch_cache.h"
+#include "branch_columns.h"
+#include "predictor_set.h"
+#include "tread.h"
+
+// one decoded branch
+struct bench_branch_c
+{
+    branch_record_c br;
+    bool            taken;
+};
+
+// Runs predictor over branches, handing it the next branch with each update if
+// look_ahead; returns the seconds it took
+static double
+run_predictor(branch_predictor_c* predictor, const std::vector<bench_branch_c>& branches,
+              const op_state_c* os, cbp_stats_c* stats, bool look_ahead)
+{
+    using namespace std;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < branches.size(); i++) {
+        const bench_branch_c& branch = branches[i];
+        bool predicted_taken = predictor->get_prediction(&branch.br, os);
+        stats->score_branch(&branch.br, predicted_taken, branch.taken);
+        const branch_record_c* next_br = (look_ahead && (i + 1 < branches.size())) ? &branches[i + 1].br : 0;
+        predictor->update_predictor(&branch.br, os, branch.taken, next_br);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// usage: predictor_bench [-c | -b] [-n branches] [-r runs] [-l] [-P names] <trace>
+//   -c: read the trace's branch cache (.brc) instead of decoding it
+//   -b: read the trace's columnar branch trace (.bct) instead of decoding it
+//   -n branches: time only the first this many branches (default: 1000000; 0 for all)
+//   -r runs: time each predictor this many times and report the best (default: 3)
+//   -l: hand each predictor the next branch as it is updated, so it can prefetch
+//       for it (see GEHL_PREDICTOR::look_ahead)
+//   -P names: the comma separated list of registered predictors to time
+//             (default: all of them)
+int
+main(int argc, char* argv[])
+{
+    using namespace std;
+
+    bool use_cache = false;
+    bool use_columns = false;
+    unsigned long max_branches = 1000000;
+    unsigned num_runs = 3;
+    bool look_ahead = false;
+    string names = get_branch_predictor_names();
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "cbn:r:lP:")) != -1) {
+        switch (opt) {
+          case 'c':
+            use_cache = true;
+            break;
+          case 'b':
+            use_columns = true;
+            break;
+          case 'n':
+            max_branches = strtoul(optarg, 0, 0);
+            break;
+          case 'r':
+            num_runs = atoi(optarg);
+            break;
+          case 'l':
+            look_ahead = true;
+            break;
+          case 'P':
+            names = optarg;
+            break;
+          default:
+            bad_usage = true;
+            break;
+        }
+    }
+    if (bad_usage || (optind != argc - 1) || (use_cache && use_columns) || (num_runs == 0)) {
+        fprintf(stderr, "usage: %s [-c | -b] [-n branches] [-r runs] [-l] [-P names] <trace>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    vector<string> predictor_names;
+    uint op_state_use = OP_STATE_NONE;
+    for (size_t start = 0; start <= names.size();) {
+        size_t end = names.find(',', start);
+        if (end == string::npos)
+            end = names.size();
+        predictor_names.push_back(names.substr(start, end - start));
+        branch_predictor_c* probe = make_branch_predictor(predictor_names.back());
+        if (!probe) {
+            fprintf(stderr, "predictor_bench: unknown predictor \"%s\"; the predictors are %s\n",
+                    predictor_names.back().c_str(), get_branch_predictor_names().c_str());
+            exit(EXIT_FAILURE);
+        }
+        op_state_use |= probe->get_op_state_use();
+        delete probe;
+        start = end + 1;
+    }
+
+    branch_reader_c* reader;
+    if (use_cache)
+        reader = new branch_cache_reader_c(argv[optind]);
+    else if (use_columns)
+        reader = new branch_columns_reader_c(argv[optind]);
+    else
+        reader = new cbp_trace_reader_c(argv[optind]);
+    reader->set_report(false);
+    reader->set_op_state_use(op_state_use);
+
+    vector<bench_branch_c> branches;
+    bench_branch_c branch;
+    uint num_insts = 0;
+    while (((max_branches == 0) || (branches.size() < max_branches)) &&
+           reader->decode_branch_record(&branch.br, &branch.taken, &num_insts))
+        branches.push_back(branch);
+
+    printf("%lu branches, %u instructions\n", (unsigned long)branches.size(), num_insts);
+    for (size_t p = 0; p < predictor_names.size(); p++) {
+        double best = 0.0;
+        cbp_stats_c stats;
+        branch_predictor_c* predictor = 0;
+        for (unsigned run = 0; run < num_runs; run++) {
+            delete predictor;
+            predictor = make_branch_predictor(predictor_names[p]);
+            stats = cbp_stats_c();
+            double seconds = run_predictor(predictor, branches, reader->osptr, &stats, look_ahead);
+            if ((run == 0) || (seconds < best))
+                best = seconds;
+        }
+        stats.stat_num_insts = num_insts;
+        printf("%-20s %8.1f ns/branch   1000*wrong_cc_predicts/total insts: %7.3f\n",
+               predictor_names[p].c_str(), 1e9 * best / (branches.empty() ? 1 : branches.size()),
+               stats.get_mpki());
+        predictor->print_stats();
+        delete predictor;
+    }
+    delete reader;
+}
@@ -0,0 +1,253 @@
+/* Description: This file implements predictor_set_c and the registry of
+ * predictors that can be evaluated by name.
+*/
+
+#include "predictor_set.h"
+#include <cstdio>
+#include "perceptron_predictor.h"
+#include "predictor.h"
+#include "tage_predictor.h"
+#include "target_predictor.h"
+
+using namespace std;
+
+// the registry: to make a predictor selectable with "predictor -P <name>", add it here
+struct registered_predictor_c
+{
+    const char *name;
+    branch_predictor_c *(*make)();
+};
+
+template <class P>
+static branch_predictor_c *make_instance(){
+    return new branch_predictor_instance_c<P>();
+}
+
+// the GEHL of predictor.h with 4K counters in every table (about 128K bits), to see what the budget costs
+struct GEHL_CONFIG_4K : GEHL_CONFIG_CBP {
+    static constexpr std::size_t BUDGET_BITS = NO_BUDGET_BITS;
+    static constexpr std::array<std::size_t, NUM_TABLES> PHT_SIZES = {{12, 12, 12, 12, 12, 12, 12, 12}};
+};
+
+// the same with 128K counters in every table (1 megabyte), in each layout, counting the cache
+// lines touched
+struct GEHL_CONFIG_1M : GEHL_CONFIG_CBP {
+    static constexpr std::size_t BUDGET_BITS = NO_BUDGET_BITS;
+    static constexpr bool COUNT_LINES = true;
+    static constexpr std::array<std::size_t, NUM_TABLES> PHT_SIZES = {{17, 17, 17, 17, 17, 17, 17, 17}};
+};
+struct GEHL_CONFIG_1M_INTERLEAVED : GEHL_CONFIG_1M {
+    static constexpr PHT_LAYOUT LAYOUT = PHT_LAYOUT_INTERLEAVED;
+};
+
+// gehl and gehl-1m with their counters and loop entries packed into their budgeted bits
+struct GEHL_CONFIG_PACKED : GEHL_CONFIG_CBP {
+    static constexpr bool PACKED = true;
+};
+struct GEHL_CONFIG_1M_PACKED : GEHL_CONFIG_1M {
+    static constexpr bool PACKED = true;
+};
+// packed, the storage takes exactly the bits predictor.h budgets for it
+static_assert(PHT_STORAGE<GEHL_CONFIG_PACKED, int8_t>::ARENA_BITS == 63 * 1024, "packed pht is not 63K bits");
+static_assert(LOOP_TABLE<32, true>::BITS == 1248, "packed loop table is not 1248 bits");
+
+// gehl-4k and gehl-1m are over the budget, which is why they opt out of it
+static_assert(GEHL_PREDICTOR<GEHL_CONFIG_4K>::STORAGE_BITS > CBP_BUDGET_BITS, "gehl-4k fits the budget");
+
+// the GEHL of predictor.h with its other index functions
+struct GEHL_CONFIG_BITSET : GEHL_CONFIG_CBP {
+    static constexpr GEHL_INDEX INDEX = GEHL_INDEX_BITSET;
+};
+struct GEHL_CONFIG_FAST : GEHL_CONFIG_CBP {
+    static constexpr GEHL_INDEX INDEX = GEHL_INDEX_FAST;
+};
+
+static const registered_predictor_c g_registered_predictors[] = {
+    {"gehl", make_instance<PREDICTOR>},                                    // the GEHL + loop predictor in predictor.h
+    {"gehl-4k", make_instance<GEHL_PREDICTOR<GEHL_CONFIG_4K> >},           // the same with 4K counter tables
+    {"gehl-1m", make_instance<GEHL_PREDICTOR<GEHL_CONFIG_1M> >},           // ... and 128K counter tables
+    {"gehl-1m-interleaved", make_instance<GEHL_PREDICTOR<GEHL_CONFIG_1M_INTERLEAVED> >},
+    {"gehl-packed", make_instance<GEHL_PREDICTOR<GEHL_CONFIG_PACKED> >},
+    {"gehl-1m-packed", make_instance<GEHL_PREDICTOR<GEHL_CONFIG_1M_PACKED> >},
+    {"gehl-bitset", make_instance<GEHL_PREDICTOR<GEHL_CONFIG_BITSET> >},   // gehl with its original index function
+    {"gehl-fast", make_instance<GEHL_PREDICTOR<GEHL_CONFIG_FAST> >},       // gehl with the fast index function
+    {"tage", make_instance<TAGE_PREDICTOR<TAGE_CONFIG_CBP> >},             // L-TAGE: TAGE + the loop predictor of gehl
+    {"perceptron", make_instance<PERCEPTRON_PREDICTOR<PERCEPTRON_CONFIG_CBP> >},  // hashed perceptron
+};
+static const uint g_num_registered_predictors = sizeof(g_registered_predictors) / sizeof(g_registered_predictors[0]);
+
+// the registry of target predictors: to make one selectable with "predictor -P <name>+<target>", add it here
+struct registered_target_predictor_c
+{
+    const char *name;
+    target_predictor_c *(*make)();
+};
+
+template <class P>
+static target_predictor_c *make_target_instance(){
+    return new target_predictor_instance_c<P>();
+}
+
+// ittage with smaller return stacks, and with no repair, to size the return stack against the traces'
+// call depths (see the return stack's statistics)
+struct ITTAGE_CONFIG_RAS8 : ITTAGE_CONFIG_CBP {
+    static constexpr std::size_t RETURN_STACK_DEPTH = 8;
+};
+struct ITTAGE_CONFIG_RAS16 : ITTAGE_CONFIG_CBP {
+    static constexpr std::size_t RETURN_STACK_DEPTH = 16;
+};
+struct ITTAGE_CONFIG_RAS32 : ITTAGE_CONFIG_CBP {
+    static constexpr std::size_t RETURN_STACK_DEPTH = 32;
+};
+struct ITTAGE_CONFIG_NO_REPAIR : ITTAGE_CONFIG_CBP {
+    static constexpr std::size_t RETURN_STACK_REPAIR = 0;
+};
+
+static const registered_target_predictor_c g_registered_target_predictors[] = {
+    {"cbp", make_target_instance<CBP_TARGET_PREDICTOR>},                   // the trace compressor's, the baseline
+    {"ittage", make_target_instance<ITTAGE_PREDICTOR<ITTAGE_CONFIG_CBP> >},   // ITTAGE + a 64 entry return stack
+    {"ittage-ras8", make_target_instance<ITTAGE_PREDICTOR<ITTAGE_CONFIG_RAS8> >},
+    {"ittage-ras16", make_target_instance<ITTAGE_PREDICTOR<ITTAGE_CONFIG_RAS16> >},
+    {"ittage-ras32", make_target_instance<ITTAGE_PREDICTOR<ITTAGE_CONFIG_RAS32> >},
+    {"ittage-norepair", make_target_instance<ITTAGE_PREDICTOR<ITTAGE_CONFIG_NO_REPAIR> >},
+};
+static const uint g_num_registered_target_predictors =
+    sizeof(g_registered_target_predictors) / sizeof(g_registered_target_predictors[0]);
+
+branch_predictor_c *make_branch_predictor(const string &name){
+    for(uint i = 0; i < g_num_registered_predictors; i++){
+        if(name == g_registered_predictors[i].name){
+            return g_registered_predictors[i].make();
+        }
+    }
+    return 0;
+}
+
+string get_branch_predictor_names(){
+    string names;
+    for(uint i = 0; i < g_num_registered_predictors; i++){
+        if(i != 0){
+            names += ",";
+        }
+        names += g_registered_predictors[i].name;
+    }
+    return names;
+}
+
+target_predictor_c *make_target_predictor(const string &name){
+    for(uint i = 0; i < g_num_registered_target_predictors; i++){
+        if(name == g_registered_target_predictors[i].name){
+            return g_registered_target_predictors[i].make();
+        }
+    }
+    return 0;
+}
+
+string get_target_predictor_names(){
+    string names;
+    for(uint i = 0; i < g_num_registered_target_predictors; i++){
+        if(i != 0){
+            names += ",";
+        }
+        names += g_registered_target_predictors[i].name;
+    }
+    return names;
+}
+
+predictor_set_c::predictor_set_c(){
+}
+predictor_set_c::~predictor_set_c(){
+    for(uint i = 0; i < members.size(); i++){
+        delete members[i].predictor;
+        delete members[i].target;
+    }
+}
+bool predictor_set_c::add(const string &names){
+    size_t start = 0;
+    while(start <= names.size()){
+        size_t end = names.find(',', start);
+        if(end == string::npos){
+            end = names.size();
+        }
+        string name = names.substr(start, end - start);
+        size_t plus = name.find('+');
+        string target_name = (plus == string::npos) ? "" : name.substr(plus + 1);
+        branch_predictor_c *predictor = make_branch_predictor(name.substr(0, plus));
+        if(!predictor){
+            return false;
+        }
+        target_predictor_c *target = 0;
+        if(plus != string::npos){
+            target = make_target_predictor(target_name);
+            if(!target){
+                delete predictor;
+                return false;
+            }
+        }
+        members.push_back(member_c());
+        members.back().name        = name;
+        members.back().predictor   = predictor;
+        members.back().target_name = target_name;
+        members.back().target      = target;
+        start = end + 1;
+    }
+    return true;
+}
+uint predictor_set_c::get_op_state_use(){
+    uint op_state_use = OP_STATE_NONE;
+    for(uint i = 0; i < members.size(); i++){
+        op_state_use |= members[i].predictor->get_op_state_use();
+        if(members[i].target){
+            op_state_use |= members[i].target->get_op_state_use();
+        }
+    }
+    return op_state_use;
+}
+void predictor_set_c::run(branch_reader_c *reader, bool look_ahead){
+    reader->set_op_state_use(get_op_state_use());
+    branch_record_c br[2];
+    bool taken[2];
+    uint num_insts = 0;
+    if(look_ahead){
+        uint cur = 0;
+        bool more = reader->decode_branch_record(&br[cur], &taken[cur], &num_insts);
+        while(more){
+            reader->count_insts(num_insts);
+            count_insts(num_insts);
+            num_insts = 0;
+            more = reader->decode_branch_record(&br[cur ^ 1], &taken[cur ^ 1], &num_insts);
+            predict_and_update(&br[cur], reader->osptr, taken[cur], more ? &br[cur ^ 1] : 0);
+            cur ^= 1;
+        }
+    }
+    else{
+        while(reader->decode_branch_record(&br[0], &taken[0], &num_insts)){
+            reader->count_insts(num_insts);
+            count_insts(num_insts);
+            num_insts = 0;
+            predict_and_update(&br[0], reader->osptr, taken[0]);
+        }
+    }
+    reader->count_insts(num_insts);
+    count_insts(num_insts);
+}
+void predictor_set_c::print_budgets(FILE *file){
+    for(uint i = 0; i < members.size(); i++){
+        members[i].predictor->print_budget(file, members[i].name.c_str());
+        if(members[i].target){
+            members[i].target->print_budget(file, members[i].target_name.c_str());
+        }
+    }
+}
+void predictor_set_c::print(){
+    for(uint i = 0; i < members.size(); i++){
+        printf("predictor %u: %s\n", i, members[i].name.c_str());
+        printf("*********************************************************\n");
+        members[i].stats.print();
+        members[i].predictor->print_stats();
+        if(members[i].target){
+            members[i].target->print_stats();
+        }
+        printf("*********************************************************\n");
+    }
+}
@@ -0,0 +1,243 @@
+/* Description: This file defines a set of predictors that are evaluated side by
+ * side on one pass over a trace.  Every decoded branch is handed to each
+ * predictor in turn, and each predictor is scored separately, so the trace is
+ * decoded once no matter how many predictors are being compared.  Predictors
+ * are looked up by name in a registry (predictor_set.cc).
+*/
+
+#ifndef PREDICTOR_SET_H_SEEN
+#define PREDICTOR_SET_H_SEEN
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "op_state.h"
+#include "storage_budget.h"
+#include "tread.h"
+
+// a predictor behind a virtual interface; wraps any class with PREDICTOR's two methods, and
+// print_stats(), a storage BUDGET (see storage_budget.h), the look-ahead update_predictor()
+// (given the next branch too) and an OP_STATE_USE (see op_state.h) if it has them
+class branch_predictor_c
+{
+public:
+    virtual ~branch_predictor_c(){
+    }
+    virtual bool get_prediction(const branch_record_c *br, const op_state_c *os) = 0;
+    virtual void update_predictor(const branch_record_c *br, const op_state_c *os, bool taken) = 0;
+    // the same, given the next branch (or null), which the predictor may prefetch for
+    virtual void update_predictor(const branch_record_c *br, const op_state_c *os, bool taken,
+                                  const branch_record_c *next_br) = 0;
+    // print the predictor's own statistics, if it keeps any
+    virtual void print_stats(){
+    }
+    // print the breakdown of the predictor's storage, if it declares one
+    virtual void print_budget(FILE *, const char *){
+    }
+    // what of op_state the predictor reads
+    virtual uint get_op_state_use(){
+        return OP_STATE_ALL;
+    }
+};
+
+template <class P>
+auto update_predictor_with_next_of(P *p, const branch_record_c *br, const op_state_c *os, bool taken,
+                                   const branch_record_c *next_br, int)
+    -> decltype(p->update_predictor(br, os, taken, next_br), void()){
+    p->update_predictor(br, os, taken, next_br);
+}
+template <class P>
+void update_predictor_with_next_of(P *p, const branch_record_c *br, const op_state_c *os, bool taken,
+                                   const branch_record_c *, long){
+    p->update_predictor(br, os, taken);
+}
+// p->update_predictor(br, os, taken, next_br) if P has the look-ahead update_predictor(), else
+// p->update_predictor(br, os, taken)
+template <class P>
+void update_predictor_with_next(P *p, const branch_record_c *br, const op_state_c *os, bool taken,
+                                const branch_record_c *next_br){
+    update_predictor_with_next_of(p, br, os, taken, next_br, 0);
+}
+
+// q->print_stats() if Q has it; called with 0
+template <class Q>
+auto print_stats_of(const Q *q, int) -> decltype(q->print_stats(), void()){
+    q->print_stats();
+}
+template <class Q>
+void print_stats_of(const Q *, long){
+}
+// print_budget() of Q's storage if Q declares a BUDGET; called with 0
+template <class Q>
+auto print_budget_of(const Q *, FILE *file, const char *name, int)
+    -> decltype(Q::BUDGET, Q::BUDGET_LIMIT, void()){
+    ::print_budget(file, name, Q::BUDGET, Q::BUDGET_LIMIT);
+}
+template <class Q>
+void print_budget_of(const Q *, FILE *, const char *, long){
+}
+// Q::OP_STATE_USE if Q declares it, else OP_STATE_ALL (see op_state.h); called with 0
+template <class Q>
+constexpr auto op_state_use_of(const Q *, int) -> decltype(Q::OP_STATE_USE, uint()){
+    return Q::OP_STATE_USE;
+}
+template <class Q>
+constexpr uint op_state_use_of(const Q *, long){
+    return OP_STATE_ALL;
+}
+// what of op_state a predictor of type P reads, for branch_reader_c::set_op_state_use()
+template <class P>
+constexpr uint get_op_state_use(){
+    return op_state_use_of((const P *)0, 0);
+}
+
+template <class P>
+class branch_predictor_instance_c : public branch_predictor_c
+{
+private:
+    P predictor;
+public:
+    bool get_prediction(const branch_record_c *br, const op_state_c *os){
+        return predictor.get_prediction(br, os);
+    }
+    void update_predictor(const branch_record_c *br, const op_state_c *os, bool taken){
+        predictor.update_predictor(br, os, taken);
+    }
+    void update_predictor(const branch_record_c *br, const op_state_c *os, bool taken,
+                          const branch_record_c *next_br){
+        update_predictor_with_next(&predictor, br, os, taken, next_br);
+    }
+    void print_stats(){
+        print_stats_of(&predictor, 0);
+    }
+    void print_budget(FILE *file, const char *name){
+        print_budget_of(&predictor, file, name, 0);
+    }
+    uint get_op_state_use(){
+        return ::get_op_state_use<P>();
+    }
+};
+
+// an indirect branch target predictor behind a virtual interface; wraps any class with the two methods of
+// the target predictors in target_predictor.h, and print_stats(), a storage BUDGET and an OP_STATE_USE if
+// it has them
+class target_predictor_c
+{
+public:
+    virtual ~target_predictor_c(){
+    }
+    // predict the target of an indirect branch
+    virtual uint get_target_prediction(const branch_record_c *br, const op_state_c *os) = 0;
+    // update after every branch, once its direction (taken) and target are known
+    virtual void update_target_predictor(const branch_record_c *br, const op_state_c *os, bool taken) = 0;
+    virtual void print_stats(){
+    }
+    virtual void print_budget(FILE *, const char *){
+    }
+    virtual uint get_op_state_use(){
+        return OP_STATE_ALL;
+    }
+};
+
+template <class P>
+class target_predictor_instance_c : public target_predictor_c
+{
+private:
+    P predictor;
+public:
+    uint get_target_prediction(const branch_record_c *br, const op_state_c *os){
+        return predictor.get_target_prediction(br, os);
+    }
+    void update_target_predictor(const branch_record_c *br, const op_state_c *os, bool taken){
+        predictor.update_target_predictor(br, os, taken);
+    }
+    void print_stats(){
+        print_stats_of(&predictor, 0);
+    }
+    void print_budget(FILE *file, const char *name){
+        print_budget_of(&predictor, file, name, 0);
+    }
+    uint get_op_state_use(){
+        return ::get_op_state_use<P>();
+    }
+};
+
+// creates the predictor registered under name; returns 0 if there is none
+branch_predictor_c *make_branch_predictor(const std::string &name);
+// the names of all registered predictors, comma separated
+std::string get_branch_predictor_names();
+// the same for the registered target predictors
+target_predictor_c *make_target_predictor(const std::string &name);
+std::string get_target_predictor_names();
+
+class predictor_set_c
+{
+private:
+    struct member_c
+    {
+        std::string         name;
+        branch_predictor_c *predictor;
+        std::string         target_name;
+        target_predictor_c *target;       // null if the member doesn't predict targets
+        cbp_stats_c         stats;
+    };
+    std::vector<member_c> members;
+
+    // not implemented
+    predictor_set_c(const predictor_set_c &);
+    predictor_set_c &operator=(const predictor_set_c &);
+public:
+    predictor_set_c();
+    ~predictor_set_c();
+    // add the registered predictors named in the comma separated list names, each of which may be followed
+    // by +target, the name of a registered target predictor to predict its indirect branches' targets
+    // ("gehl+ittage"); returns false if a name isn't registered
+    bool add(const std::string &names);
+    uint size(){
+        return members.size();
+    }
+    // run one branch through every predictor: predict, score, then update, handing the predictor
+    // the next branch if it is known (next_br isn't null)
+    void predict_and_update(const branch_record_c *br, const op_state_c *os, bool taken,
+                            const branch_record_c *next_br = 0){
+        for(uint i = 0; i < members.size(); i++){
+            member_c *m = &members[i];
+            bool predicted_taken = m->predictor->get_prediction(br, os);
+            m->stats.score_branch(br, predicted_taken, taken);
+            m->predictor->update_predictor(br, os, taken, next_br);
+            if(m->target){
+                if(cbp_stats_c::get_target_class(br) >= 0){
+                    m->stats.score_target(br, m->target->get_target_prediction(br, os));
+                }
+                m->target->update_target_predictor(br, os, taken);
+            }
+        }
+    }
+    void count_insts(uint num_insts){
+        for(uint i = 0; i < members.size(); i++){
+            members[i].stats.stat_num_insts += num_insts;
+        }
+    }
+    // what of op_state any of the predictors reads
+    uint get_op_state_use();
+    // read the whole trace once, running every branch through every predictor, having told the reader
+    // what of op_state they read; with look_ahead,
+    // each branch is decoded before the one ahead of it is updated, so the predictors are handed
+    // the next branch, which is only right for readers with no op_state to advance (-c, -b)
+    void run(branch_reader_c *reader, bool look_ahead = false);
+    const std::string &get_name(uint i){
+        return members[i].name;
+    }
+    const cbp_stats_c &get_stats(uint i){
+        return members[i].stats;
+    }
+    branch_predictor_c *get_predictor(uint i){
+        return members[i].predictor;
+    }
+    // print each predictor's statistics, in the reader's format, under its name
+    void print();
+    // print the breakdown of each predictor's storage to file
+    void print_budgets(FILE *file);
+};
+
+#endif // PREDICTOR_SET_H_SEEN
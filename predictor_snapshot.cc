@@ -0,0 +1,98 @@
+/* Description: This file implements writing and mmapping predictor
+ * snapshots.
+*/
+
+#include "predictor_snapshot.h"
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cbp_fatal.h"
+
+static const char g_predictor_snapshot_magic[8] = {'C', 'B', 'P', 'S', 'N', 'A', 'P', 0};
+
+uint64_t get_predictor_snapshot_key(const std::type_info &type, size_t size){
+    // FNV-1a over the type's name, then its size
+    uint64_t key = 0xcbf29ce484222325ULL;
+    for(const char *c = type.name(); *c; c++){
+        key = (key ^ uint8_t(*c)) * 0x100000001b3ULL;
+    }
+    for(uint i = 0; i < sizeof(uint64_t); i++){
+        key = (key ^ uint8_t(uint64_t(size) >> (8 * i))) * 0x100000001b3ULL;
+    }
+    return key;
+}
+
+void write_predictor_snapshot(const char *file_name, const void *state, size_t state_size, uint64_t state_key,
+                              const branch_reader_c *reader){
+    assert(sizeof(predictor_snapshot_header_c) <= g_predictor_snapshot_state_offset);
+    static char page[g_predictor_snapshot_state_offset];
+    predictor_snapshot_header_c header = predictor_snapshot_header_c();
+    memcpy(header.magic, g_predictor_snapshot_magic, sizeof(header.magic));
+    header.version      = g_predictor_snapshot_version;
+    header.state_offset = g_predictor_snapshot_state_offset;
+    header.state_size   = state_size;
+    header.state_key    = state_key;
+    header.position     = reader->get_position();
+    header.stats        = reader->get_stats();
+    memset(page, 0, sizeof(page));
+    memcpy(page, &header, sizeof(header));
+    FILE *file = fopen(file_name, "wb");
+    if(!file){
+        CBP_FATAL("cannot create predictor snapshot \"%s\"", file_name);
+    }
+    bool ok = (fwrite(page, sizeof(page), 1, file) == 1);
+    ok = ok && (fwrite(state, state_size, 1, file) == 1);
+    if(!ok || (fclose(file) != 0)){
+        CBP_FATAL("cannot write predictor snapshot \"%s\"", file_name);
+    }
+}
+
+predictor_snapshot_c::predictor_snapshot_c(const char *file_name_arg){
+    file_name = file_name_arg;
+    int fd = open(file_name, O_RDONLY);
+    if(fd < 0){
+        CBP_FATAL("cannot open predictor snapshot \"%s\"", file_name);
+    }
+    struct stat file_stat;
+    if((fstat(fd, &file_stat) != 0) || (size_t(file_stat.st_size) < g_predictor_snapshot_state_offset)){
+        CBP_FATAL("predictor snapshot \"%s\" is truncated", file_name);
+    }
+    map_size = file_stat.st_size;
+    // private and writable: the predictor runs in the mapping, and what it writes stays in memory
+    map      = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        CBP_FATAL("cannot mmap predictor snapshot \"%s\"", file_name);
+    }
+    header = (const predictor_snapshot_header_c *)map;
+    if((memcmp(header->magic, g_predictor_snapshot_magic, sizeof(header->magic)) != 0) ||
+       (header->version != g_predictor_snapshot_version) ||
+       (header->state_offset != g_predictor_snapshot_state_offset) ||
+       (map_size != header->state_offset + header->state_size)){
+        CBP_FATAL("\"%s\" is not a version %u predictor snapshot", file_name, g_predictor_snapshot_version);
+    }
+}
+
+predictor_snapshot_c::~predictor_snapshot_c(){
+    munmap(map, map_size);
+}
+
+void *predictor_snapshot_c::get_state(uint64_t state_key, size_t state_size){
+    if((header->state_key != state_key) || (header->state_size != state_size)){
+        CBP_FATAL("predictor snapshot \"%s\" was saved from another predictor", file_name);
+    }
+    return (char *)map + header->state_offset;
+}
+
+void predictor_snapshot_c::restore_reader(branch_reader_c *reader, bool fresh_stats){
+    if(!reader->set_position(header->position)){
+        CBP_FATAL("cannot restore the trace position of predictor snapshot \"%s\" (branch %llu)", file_name,
+                  (unsigned long long)header->position.branches);
+    }
+    if(!fresh_stats){
+        reader->set_stats(header->stats);
+    }
+}
@@ -0,0 +1,92 @@
+/* Description: This file defines predictor snapshots (.snap): a predictor's
+ * whole state, saved with the trace reader's position and statistics, so a
+ * run can be resumed from a warmed-up predictor or evaluated from a point in
+ * the trace without simulating what comes before it.  The state is the
+ * predictor object's own bytes, which any trivially copyable predictor (one
+ * with no pointers, as PREDICTOR and the registered predictors are) can be
+ * saved as.  predictor_snapshot_c mmaps a snapshot copy-on-write and hands
+ * out the predictor in place, so restoring one costs the mapping, not a copy
+ * of the state.
+*/
+
+#ifndef PREDICTOR_SNAPSHOT_H_SEEN
+#define PREDICTOR_SNAPSHOT_H_SEEN
+
+#include <cstddef>
+#include <cstring>
+#include <inttypes.h>
+#include <type_traits>
+#include <typeinfo>
+#include "tread.h"
+
+// file layout: one predictor_snapshot_header_c, padded to state_offset bytes (a page, so the state is as
+// aligned as the predictor needs), then the state_size bytes of the predictor, all in the host's byte
+// order.  A snapshot is only good for the build that wrote it: state_key identifies the predictor's type
+// and size, and anything else that changes the layout of its state must bump g_predictor_snapshot_version.
+struct predictor_snapshot_header_c
+{
+    char     magic[8];             // "CBPSNAP\0"
+    uint32_t version;              // g_predictor_snapshot_version
+    uint32_t state_offset;
+    uint64_t state_size;
+    uint64_t state_key;            // get_predictor_snapshot_key() of the predictor's type
+    branch_reader_position_c position;
+    cbp_stats_c stats;             // the reader's statistics at position
+};
+
+const uint32_t g_predictor_snapshot_version      = 1;
+const uint32_t g_predictor_snapshot_state_offset = 4096;
+
+// a hash of the name of type and its size, so a snapshot is only restored into the type that saved it
+uint64_t get_predictor_snapshot_key(const std::type_info &type, size_t size);
+
+// writes the state (state_size bytes at state) of a predictor of the type with key state_key, and the
+// reader's position and statistics, to file_name
+void write_predictor_snapshot(const char *file_name, const void *state, size_t state_size, uint64_t state_key,
+                              const branch_reader_c *reader);
+
+// saves predictor, with reader's position and statistics, to file_name
+template <class P>
+void write_predictor_snapshot(const char *file_name, const P &predictor, const branch_reader_c *reader){
+    static_assert(std::is_trivially_copyable<P>::value, "the predictor can't be saved as its bytes");
+    write_predictor_snapshot(file_name, &predictor, sizeof(P), get_predictor_snapshot_key(typeid(P), sizeof(P)),
+                             reader);
+}
+
+// a snapshot, mmapped copy-on-write: the predictor in it can be run in place, and its changes stay in
+// memory
+class predictor_snapshot_c
+{
+private:
+    void *map;                                      // the mmapped file
+    size_t map_size;
+    const predictor_snapshot_header_c *header;
+    const char *file_name;
+
+    // not implemented
+    predictor_snapshot_c(const predictor_snapshot_c &);
+    predictor_snapshot_c &operator=(const predictor_snapshot_c &);
+
+    void *get_state(uint64_t state_key, size_t state_size);
+public:
+    predictor_snapshot_c(const char *file_name_arg);
+    ~predictor_snapshot_c();
+    // the predictor in the snapshot, which is valid as long as the snapshot is; fails if the snapshot was
+    // saved from another type of predictor.  No P is ever constructed in the mapping: a trivially copyable
+    // P with a trivial destructor is an implicit-lifetime type, and memmove() implicitly creates such an
+    // object in its destination, with the bytes copied there as its value, and returns a pointer to it
+    // (P0593, a defect report against C++17).  Moving the state onto itself starts the predictor's
+    // lifetime that way; compilers drop the move, so nothing is copied.
+    template <class P>
+    P *get_predictor(){
+        static_assert(std::is_trivially_copyable<P>::value && std::is_trivially_destructible<P>::value,
+                      "the predictor can't be restored from its bytes");
+        void *state = get_state(get_predictor_snapshot_key(typeid(P), sizeof(P)), sizeof(P));
+        return static_cast<P *>(std::memmove(state, state, sizeof(P)));
+    }
+    // restores reader, which must be reading the trace the snapshot was saved from, to the snapshot's
+    // position, and, unless fresh_stats, to its statistics; fails if the reader is already past it
+    void restore_reader(branch_reader_c *reader, bool fresh_stats);
+};
+
+#endif // PREDICTOR_SNAPSHOT_H_SEEN
@@ -0,0 +1,138 @@
+/* Description: This file defines a return address stack, the target
+ * predictor of returns: a circular stack of return addresses, like
+ * cbp::FINITE_STACK, that also knows how full it is, so it can count the
+ * calls it overflows on and the returns it underflows on, and that repairs
+ * itself when a return skips frames.
+ */
+
+#ifndef RETURN_STACK_H_SEEN
+#define RETURN_STACK_H_SEEN
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <inttypes.h>
+
+// A return address stack of DEPTH entries.  As in cbp::FINITE_STACK, a call
+// pushed onto a full stack overwrites the oldest entry (an overflow), and a
+// return popped off an empty one predicts whatever stale entry is on top (an
+// underflow), so deep recursion loses only its outermost frames.  A return
+// whose target isn't on top (a mismatch, after a longjmp, say, or a frame a
+// tail call left) looks for its target in the REPAIR_WINDOW entries under
+// the top and, if it is there, pops through it (a repair), so the returns
+// that follow find their frames on top again.
+template <std::size_t DEPTH, std::size_t REPAIR_WINDOW>
+class RETURN_STACK {
+public:
+  typedef uint32_t address_t;
+
+  static_assert((DEPTH & (DEPTH - 1)) == 0, "the depth is not a power of 2");
+
+private:
+  static const int ADDRESS_BITS = 32;
+
+  static constexpr std::size_t bits_to_count(std::size_t n) {
+    std::size_t bits = 0;
+    while ((std::size_t(1) << bits) <= n)
+      ++bits;
+    return bits;
+  }
+
+public:
+  // The bits the stack is budgeted: its entries, its top and how full it is
+  static constexpr std::size_t BUDGET_BITS = DEPTH * ADDRESS_BITS + bits_to_count(DEPTH - 1) + bits_to_count(DEPTH);
+
+private:
+  std::array<address_t, DEPTH> stack;
+  std::size_t top_ptr;
+  std::size_t occupancy;        // valid entries, at most DEPTH
+
+  // Statistics (not hardware, so not budgeted)
+  uint64_t stat_pushes;
+  uint64_t stat_pops;
+  uint64_t stat_overflows;      // pushes onto a full stack
+  uint64_t stat_underflows;     // pops off an empty stack
+  uint64_t stat_mismatches;     // pops off a stack whose top isn't the target
+  uint64_t stat_repairs;        // ... of which the target was in the repair window
+  uint64_t call_depth;          // calls less returns, as an unbounded stack would hold
+  uint64_t stat_max_call_depth;
+
+  address_t entry(std::size_t below_top) const {
+    return stack[(top_ptr - below_top) % DEPTH];
+  }
+
+public:
+  RETURN_STACK(void)
+    : top_ptr(0)
+    , occupancy(0)
+    , stat_pushes(0)
+    , stat_pops(0)
+    , stat_overflows(0)
+    , stat_underflows(0)
+    , stat_mismatches(0)
+    , stat_repairs(0)
+    , call_depth(0)
+    , stat_max_call_depth(0)
+  {
+    stack.fill(0);
+  }
+  // uses compiler generated copy constructor
+  // uses compiler generated destructor
+  // uses compiler generated assignment operator
+
+  // The predicted target of a return
+  address_t top(void) const {
+    return entry(0);
+  }
+
+  // A call, returning to return_addr
+  void push(address_t return_addr) {
+    ++stat_pushes;
+    if (occupancy == DEPTH)
+      ++stat_overflows;
+    else
+      ++occupancy;
+    top_ptr = (top_ptr + 1) % DEPTH;
+    stack[top_ptr] = return_addr;
+    if (++call_depth > stat_max_call_depth)
+      stat_max_call_depth = call_depth;
+  }
+
+  // A return, to target
+  void pop(address_t target) {
+    ++stat_pops;
+    if (call_depth > 0)
+      --call_depth;
+    if (occupancy == 0) {
+      ++stat_underflows;
+      top_ptr = (top_ptr - 1) % DEPTH;
+      return;
+    }
+    if (top() != target) {
+      ++stat_mismatches;
+      for (std::size_t i = 1; (i <= REPAIR_WINDOW) && (i < occupancy); ++i) {
+        if (entry(i) == target) {
+          ++stat_repairs;
+          top_ptr = (top_ptr - i) % DEPTH;
+          occupancy -= i;
+          break;
+        }
+      }
+    }
+    top_ptr = (top_ptr - 1) % DEPTH;
+    --occupancy;
+  }
+
+  void print_stats(void) const {
+    printf("return stack depth:              %8zu\n", DEPTH);
+    printf("return stack pushes:             %8" PRIu64 "\n", stat_pushes);
+    printf("return stack pops:               %8" PRIu64 "\n", stat_pops);
+    printf("return stack overflows:          %8" PRIu64 "\n", stat_overflows);
+    printf("return stack underflows:         %8" PRIu64 "\n", stat_underflows);
+    printf("return stack mismatches:         %8" PRIu64 "\n", stat_mismatches);
+    printf("return stack repairs:            %8" PRIu64 "\n", stat_repairs);
+    printf("deepest call depth:              %8" PRIu64 "\n", stat_max_call_depth);
+  }
+};
+
+#endif // RETURN_STACK_H_SEEN
@@ -0,0 +1,142 @@
+/* Description: This file defines a bounded single-producer/single-consumer
+ * ring used to hand decoded branches from the trace-decode thread to the
+ * predictor thread.  Slots are filled and drained in place, so no element is
+ * ever copied.  Each side records how long it spent waiting on the other.
+*/
+
+#ifndef SPSC_RING_H_SEEN
+#define SPSC_RING_H_SEEN
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+#include "cbp_assert.h"
+
+namespace cbp
+{
+    // A ring of 'capacity' slots, where capacity is a power of two.  The
+    // producer calls producer_slot(), fills the slot, and publish()es it; the
+    // consumer calls consumer_slot(), reads the slot, and release()s it.
+    // producer_slot() and consumer_slot() block while the ring is full or
+    // empty, respectively.
+    template <class T>
+    class SPSC_RING
+    {
+      private:
+        enum { CACHE_LINE = 64 };
+        enum { SPIN_COUNT = 64 };           // polls before yielding the CPU
+
+        std::vector<T> slots;
+        std::size_t mask;
+
+        // producer side
+        alignas(CACHE_LINE) std::atomic<std::size_t> head;  // next slot to publish
+        std::size_t producer_tail;          // producer's cached copy of tail
+        double producer_wait_seconds;
+
+        // consumer side
+        alignas(CACHE_LINE) std::atomic<std::size_t> tail;  // next slot to release
+        std::size_t consumer_head;          // consumer's cached copy of head
+        double consumer_wait_seconds;
+
+        // not implemented
+        explicit SPSC_RING(const SPSC_RING&);
+        SPSC_RING& operator=(const SPSC_RING&);
+
+        // spin, then yield, until ready() holds; returns the seconds waited
+        template <class READY>
+        static double wait(READY ready)
+        {
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            for (unsigned spins = 0; !ready(); ++spins) {
+                if (spins >= SPIN_COUNT)
+                    std::this_thread::yield();
+            }
+            std::chrono::duration<double> waited =
+                std::chrono::steady_clock::now() - start;
+            return waited.count();
+        }
+
+      public:
+        explicit SPSC_RING(std::size_t capacity)
+          : slots(capacity), mask(capacity - 1), head(0), producer_tail(0),
+            producer_wait_seconds(0.0), tail(0), consumer_head(0),
+            consumer_wait_seconds(0.0)
+        {
+            CBP_ASSERT((capacity != 0) && ((capacity & mask) == 0));
+        }
+        // uses compiler generated destructor
+
+        std::size_t get_capacity(void) const { return slots.size(); }
+
+        // direct access to the slots, e.g. for initializing them
+        T& operator[](std::size_t index) { return slots[index & mask]; }
+
+        // Producer: returns the next free slot, waiting while the ring is full.
+        T* producer_slot(void)
+        {
+            std::size_t h = head.load(std::memory_order_relaxed);
+            if ((h - producer_tail) == slots.size()) {
+                producer_tail = tail.load(std::memory_order_acquire);
+                if ((h - producer_tail) == slots.size()) {
+                    producer_wait_seconds += wait([&]() {
+                        producer_tail = tail.load(std::memory_order_acquire);
+                        return (h - producer_tail) != slots.size();
+                    });
+                }
+            }
+            return &slots[h & mask];
+        }
+
+        // Producer: hands the slot returned by producer_slot() to the consumer.
+        void publish(void)
+        {
+            head.store(head.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+        }
+
+        // Consumer: returns the oldest published slot, waiting while the ring
+        // is empty.
+        T* consumer_slot(void)
+        {
+            std::size_t t = tail.load(std::memory_order_relaxed);
+            if (t == consumer_head) {
+                consumer_head = head.load(std::memory_order_acquire);
+                if (t == consumer_head) {
+                    consumer_wait_seconds += wait([&]() {
+                        consumer_head = head.load(std::memory_order_acquire);
+                        return t != consumer_head;
+                    });
+                }
+            }
+            return &slots[t & mask];
+        }
+
+        // Consumer: returns the slot after the one returned by consumer_slot()
+        // if it has been published already, else null; never waits.
+        T* consumer_peek(void)
+        {
+            std::size_t t = tail.load(std::memory_order_relaxed) + 1;
+            if (t == consumer_head)
+                consumer_head = head.load(std::memory_order_acquire);
+            return (t != consumer_head) ? &slots[t & mask] : 0;
+        }
+
+        // Consumer: returns the slot returned by consumer_slot() to the producer.
+        void release(void)
+        {
+            tail.store(tail.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+        }
+
+        // Seconds the producer has waited on a full ring, i.e. on the consumer.
+        double get_producer_wait_seconds(void) const { return producer_wait_seconds; }
+        // Seconds the consumer has waited on an empty ring, i.e. on the producer.
+        double get_consumer_wait_seconds(void) const { return consumer_wait_seconds; }
+    };
+} // namespace cbp
+
+#endif // SPSC_RING_H_SEEN
@@ -0,0 +1,48 @@
+/* Description: This file defines the accounting of a predictor's hardware
+ * storage.  A predictor lists its components and their sizes in bits as a
+ * constexpr array of BUDGET_ITEM's, so the total is known at compile time and
+ * can be checked against the budget with a static_assert; print_budget()
+ * prints the breakdown.
+ */
+
+#ifndef STORAGE_BUDGET_H_SEEN
+#define STORAGE_BUDGET_H_SEEN
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+
+// The championship's limit: 64K bits plus 512 bits of odds and ends
+static const std::size_t CBP_BUDGET_BITS = 64 * 1024 + 512;
+// The limit of a configuration that isn't held to a budget
+static const std::size_t NO_BUDGET_BITS = ~std::size_t(0);
+
+// One component of a predictor's storage
+struct BUDGET_ITEM {
+  const char* name;
+  std::size_t bits;
+};
+
+// The bits all of items take
+template <std::size_t N>
+constexpr std::size_t budget_bits(const std::array<BUDGET_ITEM, N>& items) {
+  std::size_t bits = 0;
+  for (std::size_t i = 0; i < N; ++i)
+    bits += items[i].bits;
+  return bits;
+}
+
+// Prints each of items, then the total against limit, to file
+template <std::size_t N>
+void print_budget(FILE* file, const char* predictor_name, const std::array<BUDGET_ITEM, N>& items,
+                  std::size_t limit) {
+  fprintf(file, "storage of %s:\n", predictor_name);
+  for (std::size_t i = 0; i < N; ++i)
+    fprintf(file, "  %-30s %10zu bits\n", items[i].name, items[i].bits);
+  if (limit == NO_BUDGET_BITS)
+    fprintf(file, "  %-30s %10zu bits (no budget)\n", "total", budget_bits(items));
+  else
+    fprintf(file, "  %-30s %10zu bits of %zu\n", "total", budget_bits(items), limit);
+}
+
+#endif // STORAGE_BUDGET_H_SEEN
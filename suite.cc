@@ -0,0 +1,322 @@
+/* Description: Runs the predictor over the whole trace suite and prints the
+ * report gen_report.pl used to generate (see BASELINE).  The traces run in
+ * parallel on a work-stealing pool, biggest first; the statistics are kept in
+ * memory and can also be written as CSV or JSON.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "branch_cache.h"
+#include "branch_columns.h"
+#include "predictor_set.h"
+#include "tread.h"
+#include "work_pool.h"
+
+static const char* const g_trace_list[] = {
+    "DIST-FP-1",
+    "DIST-FP-2",
+    "DIST-FP-3",
+    "DIST-FP-4",
+    "DIST-FP-5",
+    "DIST-INT-1",
+    "DIST-INT-2",
+    "DIST-INT-3",
+    "DIST-INT-4",
+    "DIST-INT-5",
+    "DIST-MM-1",
+    "DIST-MM-2",
+    "DIST-MM-3",
+    "DIST-MM-4",
+    "DIST-MM-5",
+    "DIST-SERV-1",
+    "DIST-SERV-2",
+    "DIST-SERV-3",
+    "DIST-SERV-4",
+    "DIST-SERV-5"
+};
+static const unsigned g_num_traces = sizeof(g_trace_list) / sizeof(g_trace_list[0]);
+
+// one trace of the suite and, once it has run, its results
+struct suite_trace_c
+{
+    std::string name;
+    std::string path;                  // trace name passed to the reader
+    long long size;                    // size of the file read; < 0 if missing
+    double seconds;
+    std::vector<std::string> predictor_names;
+    std::vector<cbp_stats_c> stats;    // one per predictor
+};
+
+// which file of a trace to read
+enum suite_format_c { FORMAT_BZ2, FORMAT_BRC, FORMAT_BCT };
+
+static void
+run_trace(suite_trace_c* trace, suite_format_c format, const std::string& predictor_names, bool look_ahead)
+{
+    using namespace std;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    char* path = const_cast<char*>(trace->path.c_str());
+    branch_reader_c* reader;
+    if (format == FORMAT_BRC)
+        reader = new branch_cache_reader_c(path);
+    else if (format == FORMAT_BCT)
+        reader = new branch_columns_reader_c(path);
+    else
+        reader = new cbp_trace_reader_c(path);
+    reader->set_report(false);
+
+    predictor_set_c predictors;
+    predictors.add(predictor_names);
+    predictors.run(reader, look_ahead);
+    delete reader;
+
+    for (uint i = 0; i < predictors.size(); i++) {
+        trace->predictor_names.push_back(predictors.get_name(i));
+        trace->stats.push_back(predictors.get_stats(i));
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    trace->seconds = elapsed.count();
+}
+
+static int
+mispredicts(const cbp_stats_c& stats)
+{
+    return stats.stat_num_cc_branches - stats.stat_num_correct_predicts;
+}
+
+static void
+write_csv(const char* file_name, const std::vector<suite_trace_c>& traces,
+          const std::vector<double>& mean_mpki)
+{
+    FILE* file = fopen(file_name, "w");
+    if (!file) {
+        fprintf(stderr, "suite: cannot create \"%s\"\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(file, "trace,predictor,mispredicts,insts,mpki,branches,cc_branches,predicts,seconds,"
+            "jump_target_mpki,call_target_mpki,return_target_mpki,target_mpki\n");
+    for (size_t t = 0; t < traces.size(); t++) {
+        const suite_trace_c& trace = traces[t];
+        for (size_t p = 0; p < trace.stats.size(); p++) {
+            const cbp_stats_c& stats = trace.stats[p];
+            fprintf(file, "%s,%s,%d,%u,%.3f,%u,%u,%u,%.3f", trace.name.c_str(),
+                    trace.predictor_names[p].c_str(), mispredicts(stats), stats.stat_num_insts,
+                    stats.get_mpki(), stats.stat_num_branches, stats.stat_num_cc_branches,
+                    stats.stat_num_predicts, trace.seconds);
+            // the target mispredict rates are left empty for predictors that don't predict targets
+            for (int c = 0; c <= cbp_stats_c::NUM_TARGET_CLASSES; c++) {
+                if (stats.has_target_predicts())
+                    fprintf(file, ",%.3f", stats.get_target_mpki(c));
+                else
+                    fprintf(file, ",");
+            }
+            fprintf(file, "\n");
+        }
+    }
+    for (size_t t = 0; t < traces.size(); t++) {
+        if (!traces[t].stats.empty()) {
+            for (size_t p = 0; p < mean_mpki.size(); p++)
+                fprintf(file, "mean,%s,,,%.3f,,,,,,,,\n", traces[t].predictor_names[p].c_str(), mean_mpki[p]);
+            break;
+        }
+    }
+    fclose(file);
+}
+
+static void
+write_json(const char* file_name, const std::vector<suite_trace_c>& traces,
+           const std::vector<double>& mean_mpki)
+{
+    FILE* file = fopen(file_name, "w");
+    if (!file) {
+        fprintf(stderr, "suite: cannot create \"%s\"\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    const std::vector<std::string>* names = 0;
+    fprintf(file, "{\n  \"traces\": [");
+    bool first = true;
+    for (size_t t = 0; t < traces.size(); t++) {
+        const suite_trace_c& trace = traces[t];
+        if (!trace.stats.empty())
+            names = &trace.predictor_names;
+        for (size_t p = 0; p < trace.stats.size(); p++) {
+            const cbp_stats_c& stats = trace.stats[p];
+            fprintf(file, "%s\n    {\"trace\": \"%s\", \"predictor\": \"%s\", \"mispredicts\": %d, "
+                    "\"insts\": %u, \"mpki\": %.3f, \"branches\": %u, \"cc_branches\": %u, "
+                    "\"predicts\": %u, \"seconds\": %.3f", first ? "" : ",", trace.name.c_str(),
+                    trace.predictor_names[p].c_str(), mispredicts(stats), stats.stat_num_insts,
+                    stats.get_mpki(), stats.stat_num_branches, stats.stat_num_cc_branches,
+                    stats.stat_num_predicts, trace.seconds);
+            if (stats.has_target_predicts()) {
+                for (int c = 0; c <= cbp_stats_c::NUM_TARGET_CLASSES; c++)
+                    fprintf(file, ", \"%s_target_mpki\": %.3f", cbp_stats_c::get_target_class_name(c),
+                            stats.get_target_mpki(c));
+            }
+            fprintf(file, "}");
+            first = false;
+        }
+    }
+    fprintf(file, "\n  ],\n  \"mean_mpki\": {");
+    for (size_t p = 0; names && (p < mean_mpki.size()); p++)
+        fprintf(file, "%s\n    \"%s\": %.3f", (p == 0) ? "" : ",", (*names)[p].c_str(), mean_mpki[p]);
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
+}
+
+// usage: suite [-t threads] [-c | -b] [-l] [-P names] [-o csv] [-J json] [with-values | without-values]
+//   -t threads: run this many traces at once (default: one per CPU)
+//   -c: replay each trace's branch cache (.brc) instead of decoding it
+//   -b: replay each trace's columnar branch trace (.bct) instead of decoding it
+//   -l: with -c or -b, hand the predictors the next branch as they update each
+//       one, so they can prefetch for it
+//   -P names: the comma separated list of registered predictors to run
+//             (default: gehl, the predictor in predictor.h), each optionally
+//             paired with a target predictor as name+target
+//   -o csv: also write the statistics to this CSV file
+//   -J json: also write the statistics to this JSON file
+int
+main(int argc, char* argv[])
+{
+    using namespace std;
+
+    unsigned num_threads = thread::hardware_concurrency();
+    suite_format_c format = FORMAT_BZ2;
+    string predictor_names = "gehl";
+    const char* csv_file = 0;
+    const char* json_file = 0;
+    bool look_ahead = false;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:cblP:o:J:")) != -1) {
+        switch (opt) {
+          case 't':
+            num_threads = atoi(optarg);
+            break;
+          case 'c':
+            format = FORMAT_BRC;
+            break;
+          case 'b':
+            format = FORMAT_BCT;
+            break;
+          case 'l':
+            look_ahead = true;
+            break;
+          case 'P':
+            predictor_names = optarg;
+            break;
+          case 'o':
+            csv_file = optarg;
+            break;
+          case 'J':
+            json_file = optarg;
+            break;
+          default:
+            bad_usage = true;
+            break;
+        }
+    }
+
+    string trace_type = "without-values";
+    if (optind < argc)
+        trace_type = argv[optind++];
+    if (bad_usage || (optind != argc) || ((trace_type != "with-values") && (trace_type != "without-values")) ||
+        (look_ahead && (format == FORMAT_BZ2))) {
+        fprintf(stderr, "usage: %s [-t threads] [-c | -b] [-l] [-P names] [-o csv] [-J json] "
+                "[with-values | without-values]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    predictor_set_c probe;
+    if (!probe.add(predictor_names)) {
+        fprintf(stderr, "suite: unknown predictor in \"%s\"; the predictors are %s, the target predictors %s\n",
+                predictor_names.c_str(), get_branch_predictor_names().c_str(), get_target_predictor_names().c_str());
+        exit(EXIT_FAILURE);
+    }
+    probe.print_budgets(stderr);
+
+    const char* suffix = (format == FORMAT_BRC) ? ".brc" : ((format == FORMAT_BCT) ? ".bct" : ".bz2");
+    vector<suite_trace_c> traces(g_num_traces);
+    vector<suite_trace_c*> by_size;
+    for (unsigned i = 0; i < g_num_traces; i++) {
+        suite_trace_c* trace = &traces[i];
+        trace->name = g_trace_list[i];
+        trace->path = "traces/" + trace_type + "/" + trace->name;
+        trace->seconds = 0.0;
+        struct stat file_stat;
+        trace->size = (stat((trace->path + suffix).c_str(), &file_stat) == 0) ? file_stat.st_size : -1;
+        if (trace->size < 0) {
+            fprintf(stderr, "suite: cannot open \"%s%s\"; skipping it\n", trace->path.c_str(), suffix);
+            continue;
+        }
+        // insertion sort, biggest first
+        size_t j = by_size.size();
+        by_size.push_back(trace);
+        for (; (j > 0) && (by_size[j - 1]->size < trace->size); j--)
+            by_size[j] = by_size[j - 1];
+        by_size[j] = trace;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    cbp::WORK_POOL pool;
+    for (size_t i = 0; i < by_size.size(); i++) {
+        suite_trace_c* trace = by_size[i];
+        pool.add([=]() { run_trace(trace, format, predictor_names, look_ahead); });
+    }
+    pool.run(num_threads);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    // the report, in the same form as the BASELINE file
+    vector<double> mean_mpki;
+    vector<double> mean_target_mpki;
+    unsigned num_run = 0;
+    for (unsigned i = 0; i < g_num_traces; i++) {
+        const suite_trace_c& trace = traces[i];
+        printf("%s\n", trace.name.c_str());
+        for (size_t p = 0; p < trace.stats.size(); p++) {
+            if (trace.stats.size() > 1)
+                printf("predictor %u: %s\n", unsigned(p), trace.predictor_names[p].c_str());
+            printf("*********************************************************\n");
+            trace.stats[p].print();
+            printf("*********************************************************\n");
+            if (mean_mpki.size() <= p) {
+                mean_mpki.push_back(0.0);
+                mean_target_mpki.push_back(0.0);
+            }
+            mean_mpki[p] += trace.stats[p].get_mpki();
+            mean_target_mpki[p] += trace.stats[p].get_target_mpki(cbp_stats_c::NUM_TARGET_CLASSES);
+        }
+        printf("\n");
+        num_run += trace.stats.empty() ? 0 : 1;
+    }
+    for (size_t p = 0; p < mean_mpki.size(); p++) {
+        mean_mpki[p] /= num_run;
+        mean_target_mpki[p] /= num_run;
+    }
+    fflush(stdout);
+
+    fprintf(stderr, "suite: %u traces on %u threads in %.3f seconds\n", num_run, num_threads, elapsed.count());
+    for (unsigned i = 0; (i < g_num_traces) && num_run; i++) {
+        if (traces[i].stats.empty())
+            continue;
+        for (size_t p = 0; p < mean_mpki.size(); p++)
+            fprintf(stderr, "suite: mean 1000*wrong_cc_predicts/total insts (%s): %7.3f\n",
+                    traces[i].predictor_names[p].c_str(), mean_mpki[p]);
+        for (size_t p = 0; p < mean_mpki.size(); p++) {
+            if (traces[i].stats[p].has_target_predicts())
+                fprintf(stderr, "suite: mean 1000*wrong_indirect_targets/total insts (%s): %7.3f\n",
+                        traces[i].predictor_names[p].c_str(), mean_target_mpki[p]);
+        }
+        break;
+    }
+
+    if (csv_file)
+        write_csv(csv_file, traces, mean_mpki);
+    if (json_file)
+        write_json(json_file, traces, mean_mpki);
+}
@@ -0,0 +1,415 @@
+/* Description: This file defines a TAGE branch predictor: a bimodal table
+ * backed by tagged tables indexed with geometrically longer global histories,
+ * the longest matching one providing the prediction, plus the loop predictor
+ * of L-TAGE (loop_predictor.h) on the side.  It has the same interface as the
+ * GEHL predictor in predictor.h, so the driver can run it the same way.
+ */
+
+#ifndef TAGE_PREDICTOR_H_SEEN
+#define TAGE_PREDICTOR_H_SEEN
+
+#include <array>
+#include <cstddef>
+#include <inttypes.h>
+#include <utility>
+#include "loop_predictor.h"
+#include "op_state.h"   // defines op_state_c (architectural state) class
+#include "storage_budget.h"
+#include "tread.h"      // defines branch_record_c class
+
+// A TAGE configuration: the log2 of the bimodal table's size, and, per tagged
+// table, the history length, the log2 of the number of entries and the tag
+// width; the widths of the counters and useful bits of the tagged entries;
+// how often the useful bits are aged; how many entries a misprediction may
+// allocate; whether the loop entries are packed (as in GEHL_CONFIG_CBP); and
+// the storage budget.  Derive from it to change any of these.
+struct TAGE_CONFIG_CBP {
+  static constexpr int LOG_BIMODAL = 12;
+  static constexpr int NUM_TABLES = 7;
+  static constexpr std::array<std::size_t, NUM_TABLES> L = {{4, 8, 14, 24, 40, 72, 128}};
+  static constexpr std::array<std::size_t, NUM_TABLES> LOG_SIZES = {{9, 9, 9, 9, 9, 9, 9}};
+  static constexpr std::array<std::size_t, NUM_TABLES> TAG_BITS = {{8, 9, 9, 10, 10, 11, 11}};
+  static constexpr int COUNTER_BITS = 3;
+  static constexpr int U_BITS = 2;
+  static constexpr int U_RESET_LOG_PERIOD = 18;  // the useful bits age every 2^18 branches
+  static constexpr int MAX_ALLOC = 1;            // entries allocated per misprediction
+  static constexpr bool PACKED = false;
+  static constexpr std::size_t BUDGET_BITS = CBP_BUDGET_BITS;
+};
+
+template <class CONFIG>
+class TAGE_PREDICTOR {
+public:
+  typedef uint32_t address_t;
+
+private:
+  typedef unsigned __int128 history_t;
+  typedef uint16_t entry_t;
+
+  // Constant Definitions
+  static constexpr int NUM_TABLES = CONFIG::NUM_TABLES;
+  static constexpr std::array<std::size_t, NUM_TABLES> L = CONFIG::L;
+  static constexpr std::array<std::size_t, NUM_TABLES> LOG_SIZES = CONFIG::LOG_SIZES;
+  static constexpr std::array<std::size_t, NUM_TABLES> TAG_BITS = CONFIG::TAG_BITS;
+  static constexpr int COUNTER_BITS = CONFIG::COUNTER_BITS;
+  static constexpr int U_BITS = CONFIG::U_BITS;
+  static constexpr int LOG_BIMODAL = CONFIG::LOG_BIMODAL;
+
+  // Path History
+  static const int PATH_HIST_LENGTH = 16;  // 16 bits
+  // Global History
+  static const int GLOBAL_HIST_LENGTH = 128;  // 128 bits
+
+  // Loop Predictor
+  static const int LOOP_PRED_SIZE = 5;     // 32 entries
+  typedef LOOP_PREDICTOR<LOOP_PRED_SIZE, CONFIG::PACKED> loop_t;
+  static const int WITHLOOP_WIDTH = 7;     // Counter width of the WITHLOOP counter
+  static const int USE_ALT_WIDTH = 4;      // Counter width of USE_ALT_ON_NA
+
+  // A tagged entry takes 16 bits: the counter at the top, then the useful
+  // bits, then the tag
+  static const int COUNTER_SHIFT = 16 - COUNTER_BITS;
+  static const int U_SHIFT = COUNTER_SHIFT - U_BITS;
+  static constexpr bool tags_fit() {
+    for (int i = 0; i < NUM_TABLES; ++i)
+      if ((TAG_BITS[i] > std::size_t(U_SHIFT)) || (L[i] > std::size_t(GLOBAL_HIST_LENGTH)))
+        return false;
+    return true;
+  }
+  static_assert(tags_fit(), "a tag doesn't fit in an entry or a history is longer than ghist");
+
+  // The tagged tables lie one after another in one array
+  static constexpr std::array<std::size_t, NUM_TABLES + 1> table_bases() {
+    std::array<std::size_t, NUM_TABLES + 1> bases = {};
+    for (int i = 0; i < NUM_TABLES; ++i)
+      bases[i + 1] = bases[i] + (std::size_t(1) << LOG_SIZES[i]);
+    return bases;
+  }
+  static constexpr std::array<std::size_t, NUM_TABLES + 1> TABLE_BASES = table_bases();
+
+  static int counter_of(entry_t entry) {
+    return int16_t(entry) >> COUNTER_SHIFT;
+  }
+  static int u_of(entry_t entry) {
+    return (entry >> U_SHIFT) & ((1 << U_BITS) - 1);
+  }
+  static int tag_of(entry_t entry) {
+    return entry & ((1 << U_SHIFT) - 1);
+  }
+  static entry_t make_entry(int tag, int counter, int u) {
+    return entry_t((counter << COUNTER_SHIFT) | (u << U_SHIFT) | tag);
+  }
+
+  static int counter_inc(/* n-bit counter */ int cnt, int n) {
+    if (cnt != (1 << (n - 1)) - 1)
+      ++cnt;
+    return cnt;
+  }
+  static int counter_dec(/* n-bit counter */ int cnt, int n) {
+    if (cnt != -(1 << (n - 1)))
+      --cnt;
+    return cnt;
+  }
+
+  // Calls f(std::integral_constant<int, i>()) for each tagged table i in
+  // order; the loop is unrolled and i is a constant inside f.
+  template <class F, int... I>
+  static void for_each_table(F f, std::integer_sequence<int, I...>) {
+    (f(std::integral_constant<int, I>()), ...);
+  }
+  template <class F>
+  static void for_each_table(F f) {
+    for_each_table(f, std::make_integer_sequence<int, NUM_TABLES>());
+  }
+
+  // Shifts bit in into the W-bit fold of a LENGTH-bit history, and out (the
+  // history's oldest bit) out of it
+  template <std::size_t W, std::size_t LENGTH>
+  static uint32_t shift_fold(uint32_t folded, bool in, bool out) {
+    folded = (folded << 1) | uint32_t(in);
+    folded ^= folded >> W;
+    folded &= (uint32_t(1) << W) - 1;
+    return folded ^ (uint32_t(out) << (LENGTH % W));
+  }
+
+  static constexpr std::size_t tagged_bits() {
+    std::size_t bits = 0;
+    for (int i = 0; i < NUM_TABLES; ++i)
+      bits += (std::size_t(1) << LOG_SIZES[i]) * (COUNTER_BITS + U_BITS + TAG_BITS[i]);
+    return bits;
+  }
+
+public:
+  // The hardware storage of each component, in budgeted bits (see
+  // GEHL_PREDICTOR::BUDGET); the history folds are derived, so not counted
+  static constexpr std::array<BUDGET_ITEM, 10> BUDGET = {{
+    {"ghist", GLOBAL_HIST_LENGTH},
+    {"phist", PATH_HIST_LENGTH},
+    {"bimodal table", std::size_t(2) << LOG_BIMODAL},
+    {"tagged tables", tagged_bits()},
+    {"loop table", loop_t::BUDGET_BITS},
+    {"WITHLOOP", WITHLOOP_WIDTH},
+    {"USE_ALT_ON_NA", USE_ALT_WIDTH},
+    {"useful bit aging counter", CONFIG::U_RESET_LOG_PERIOD},
+    {"useful bit aging phase", 1},
+    {"Seed", 32}
+  }};
+  static constexpr std::size_t STORAGE_BITS = budget_bits(BUDGET);
+  static constexpr std::size_t BUDGET_LIMIT = CONFIG::BUDGET_BITS;
+  static constexpr bool FITS_BUDGET = STORAGE_BITS <= BUDGET_LIMIT;
+  // it never looks at its op_state_c argument (see op_state.h)
+  static constexpr uint OP_STATE_USE = OP_STATE_NONE;
+
+private:
+  // Hardware Data Structures
+
+  // Global History Register
+  history_t ghist;
+  // Path History Register
+  uint32_t phist;
+  // ghist folded to each table's index width and to its tag width (twice,
+  // the second one bit narrower, so the tag isn't just the index's fold)
+  std::array<uint32_t, NUM_TABLES> index_folds;
+  std::array<uint32_t, NUM_TABLES> tag_folds;
+  std::array<uint32_t, NUM_TABLES> tag_folds2;
+  // Bimodal Table of 2-bit counters
+  std::array<int8_t, std::size_t(1) << LOG_BIMODAL> bimodal;
+  // Tagged Tables
+  std::array<entry_t, TABLE_BASES[NUM_TABLES]> tables;
+  // Loop Predictor
+  loop_t loop;
+  // Counter to monitor whether or not loop prediction is beneficial
+  int8_t WITHLOOP;
+  // Counter to monitor whether to trust a newly allocated entry or the
+  // alternate prediction
+  int8_t USE_ALT_ON_NA;
+  // Branches since the useful bits were last aged, and which of their bits
+  // ages next
+  uint32_t u_tick;
+  bool u_reset_high;
+  // A seed for generating randomness
+  int Seed;
+
+  // Per Branch Variables used in both getting and updating prediction
+  std::array<std::size_t, NUM_TABLES> indices;  // entry in tables of each tagged table
+  std::array<int, NUM_TABLES> tags;
+  std::size_t bimodal_index;
+  int provider;                            // longest matching table, or -1
+  int alt_provider;                        // next longest matching table, or -1
+  bool provider_pred;
+  bool alt_pred;
+  bool provider_new;                       // the provider is weak and not yet useful
+  bool tage_pred;                          // the TAGE prediction, before the loop predictor
+  bool prediction;                         // Prediction of this particular branch
+
+public:
+  TAGE_PREDICTOR(void)
+    : ghist(0)
+    , phist(0)
+    , WITHLOOP(-1)
+    , USE_ALT_ON_NA(0)
+    , u_tick(0)
+    , u_reset_high(true)
+    , Seed(0)
+  {
+    static_assert(FITS_BUDGET, "the configuration is over its storage budget (see BUDGET)");
+    index_folds.fill(0);
+    tag_folds.fill(0);
+    tag_folds2.fill(0);
+    bimodal.fill(0);
+    tables.fill(0);
+  }
+  // uses compiler generated copy constructor
+  // uses compiler generated destructor
+  // uses compiler generated assignment operator
+
+  int MYRANDOM() {
+    Seed++;
+    Seed ^= phist;
+    Seed = (Seed >> 21) + (Seed << 11);
+    Seed ^= int(ghist);
+    Seed = (Seed >> 10) + (Seed << 22);
+    return (Seed);
+  }
+
+  // Computes the index and tag of the branch at pc in each tagged table
+  void calc_indices(address_t pc) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t W = LOG_SIZES[i];
+      constexpr uint32_t PATH_MASK = (L[i] < PATH_HIST_LENGTH) ? (1u << L[i]) - 1 : (1u << PATH_HIST_LENGTH) - 1;
+      uint32_t path = phist & PATH_MASK;
+      path ^= path >> W;
+      indices[i] = (pc ^ (pc >> (W - i % W)) ^ index_folds[i] ^ path) & ((std::size_t(1) << W) - 1);
+      tags[i] = (pc ^ tag_folds[i] ^ (tag_folds2[i] << 1)) & ((1 << TAG_BITS[i]) - 1);
+    });
+  }
+
+  // get_prediction() takes a branch record (br, branch_record_c is defined in
+  // tread.h) and architectural state (os, op_state_c is defined op_state.h),
+  // like PREDICTOR's, and predicts conditional branches.
+  bool get_prediction(const branch_record_c* br, const op_state_c*) {
+    prediction = false;
+    if (/* conditional branch */ br->is_conditional) {
+      address_t pc = br->instruction_addr;
+      calc_indices(pc);
+      bimodal_index = pc & ((std::size_t(1) << LOG_BIMODAL) - 1);
+
+      provider = -1;
+      alt_provider = -1;
+      for (int i = NUM_TABLES - 1; i >= 0; --i) {
+        if (tag_of(tables[TABLE_BASES[i] + indices[i]]) == tags[i]) {
+          if (provider < 0) {
+            provider = i;
+          } else {
+            alt_provider = i;
+            break;
+          }
+        }
+      }
+
+      alt_pred = (alt_provider >= 0) ? (counter_of(tables[TABLE_BASES[alt_provider] + indices[alt_provider]]) >= 0)
+                                     : (bimodal[bimodal_index] >= 0);
+      if (provider >= 0) {
+        entry_t entry = tables[TABLE_BASES[provider] + indices[provider]];
+        int counter = counter_of(entry);
+        provider_pred = counter >= 0;
+        provider_new = ((counter == 0) || (counter == -1)) && (u_of(entry) == 0);
+        tage_pred = (provider_new && (USE_ALT_ON_NA >= 0)) ? alt_pred : provider_pred;
+      } else {
+        provider_pred = alt_pred;
+        provider_new = false;
+        tage_pred = alt_pred;
+      }
+
+      bool predloop = loop.get_prediction(pc);	// loop prediction
+      prediction = ((WITHLOOP >= 0) && loop.valid()) ? predloop : tage_pred;
+    }
+    return prediction;   // true for taken, false for not taken
+  }
+
+  void update_bimodal(bool taken) {
+    int counter = bimodal[bimodal_index];
+    bimodal[bimodal_index] = taken ? counter_inc(counter, 2) : counter_dec(counter, 2);
+  }
+  void update_counter(int table, bool taken) {
+    entry_t& entry = tables[TABLE_BASES[table] + indices[table]];
+    int counter = taken ? counter_inc(counter_of(entry), COUNTER_BITS) : counter_dec(counter_of(entry), COUNTER_BITS);
+    entry = make_entry(tag_of(entry), counter, u_of(entry));
+  }
+  void update_u(int table, bool useful) {
+    entry_t& entry = tables[TABLE_BASES[table] + indices[table]];
+    int u = u_of(entry);
+    if (useful && (u < (1 << U_BITS) - 1))
+      ++u;
+    else if (!useful && (u > 0))
+      --u;
+    entry = make_entry(tag_of(entry), counter_of(entry), u);
+  }
+
+  // On a misprediction, allocates up to MAX_ALLOC entries in tables with
+  // longer histories than the provider's, skipping one at random so
+  // allocations spread out; if none is free, the candidates age instead
+  void allocate(bool taken) {
+    int first = provider + 1;
+    if ((first < NUM_TABLES - 1) && (MYRANDOM() & 1))
+      ++first;
+    int allocated = 0;
+    for (int i = first; (i < NUM_TABLES) && (allocated < CONFIG::MAX_ALLOC); ++i) {
+      entry_t& entry = tables[TABLE_BASES[i] + indices[i]];
+      if (u_of(entry) == 0) {
+        entry = make_entry(tags[i], taken ? 0 : -1, 0);
+        ++allocated;
+      }
+    }
+    if (allocated == 0) {
+      for (int i = first; i < NUM_TABLES; ++i)
+        update_u(i, false);
+    }
+  }
+
+  // Ages every useful bit: every 2^U_RESET_LOG_PERIOD branches, alternately
+  // clears the high and the low bit of every u
+  void age_useful_bits(void) {
+    if (++u_tick < (uint32_t(1) << CONFIG::U_RESET_LOG_PERIOD))
+      return;
+    u_tick = 0;
+    entry_t mask = entry_t(~((u_reset_high ? (1 << (U_BITS - 1)) : 1) << U_SHIFT));
+    for (std::size_t e = 0; e < tables.size(); ++e)
+      tables[e] &= mask;
+    u_reset_high = !u_reset_high;
+  }
+
+  void update_ghist(bool taken) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      bool out = (ghist >> (L[i] - 1)) & 1;
+      index_folds[i] = shift_fold<LOG_SIZES[i], L[i]>(index_folds[i], taken, out);
+      tag_folds[i] = shift_fold<TAG_BITS[i], L[i]>(tag_folds[i], taken, out);
+      tag_folds2[i] = shift_fold<TAG_BITS[i] - 1, L[i]>(tag_folds2[i], taken, out);
+    });
+    ghist = (ghist << 1) | history_t(taken);
+  }
+  void update_phist(bool bit) {
+    phist = ((phist << 1) | uint32_t(bit)) & ((1u << PATH_HIST_LENGTH) - 1);
+  }
+
+  // Update the predictor after a prediction has been made, like PREDICTOR's
+  void update_predictor(const branch_record_c* br, const op_state_c*, bool taken) {
+
+    address_t pc = br->instruction_addr;
+    if (/* conditional branch */ br->is_conditional) {
+
+      if (loop.valid()) {
+        if (tage_pred != loop.prediction()) {
+          if (loop.prediction() == taken) {
+            WITHLOOP = counter_inc(WITHLOOP, WITHLOOP_WIDTH);
+          } else {
+            WITHLOOP = counter_dec(WITHLOOP, WITHLOOP_WIDTH);
+          }
+        }
+      }
+      loop.update(taken, (tage_pred != taken), tage_pred, [this]() { return MYRANDOM(); });
+
+      bool alloc = (tage_pred != taken) && (provider < NUM_TABLES - 1);
+      if (provider_new) {
+        // a new entry that was right needs no help from a longer history
+        if (provider_pred == taken)
+          alloc = false;
+        if (provider_pred != alt_pred) {
+          if (alt_pred == taken)
+            USE_ALT_ON_NA = counter_inc(USE_ALT_ON_NA, USE_ALT_WIDTH);
+          else
+            USE_ALT_ON_NA = counter_dec(USE_ALT_ON_NA, USE_ALT_WIDTH);
+        }
+      }
+      if (alloc)
+        allocate(taken);
+
+      if (provider >= 0) {
+        update_counter(provider, taken);
+        // a new entry is still learning, so its alternate learns too
+        if (provider_new) {
+          if (alt_provider >= 0)
+            update_counter(alt_provider, taken);
+          else
+            update_bimodal(taken);
+        }
+        if (provider_pred != alt_pred)
+          update_u(provider, provider_pred == taken);
+      } else {
+        update_bimodal(taken);
+      }
+      age_useful_bits();
+
+      update_ghist(taken);
+      update_phist(pc & 1);
+    } else if (br->is_call || br->is_return || br->is_indirect) {
+      update_ghist(true);
+      update_phist(pc & 1);
+    }
+
+  }
+};
+
+#endif // TAGE_PREDICTOR_H_SEEN
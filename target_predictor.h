@@ -0,0 +1,402 @@
+/* Description: This file defines the indirect branch target predictors: the
+ * trace compressor's (cbp_inst.cc), as the baseline, and an ITTAGE, whose
+ * target comes from the longest of its tagged tables, indexed with
+ * geometrically longer global histories, that matches, and which leaves
+ * returns to a return stack (return_stack.h).  A target predictor
+ * predicts the targets of indirect branches with get_target_prediction() and
+ * sees every branch through update_target_predictor(); predictor_set_c scores
+ * it next to a direction predictor.
+ */
+
+#ifndef TARGET_PREDICTOR_H_SEEN
+#define TARGET_PREDICTOR_H_SEEN
+
+#include <array>
+#include <cstddef>
+#include <inttypes.h>
+#include <utility>
+#include "finite_stack.h"
+#include "indirect_pred.h"
+#include "op_state.h"   // defines op_state_c (architectural state) class
+#include "return_stack.h"
+#include "storage_budget.h"
+#include "tread.h"      // defines branch_record_c class
+
+// The trace compressor's target predictor: a return stack for returns and
+// cbp::INDIRECT_PRED, which indexes a branch's targets by the last few of
+// them, for the other indirect branches.
+class CBP_TARGET_PREDICTOR {
+public:
+  typedef uint32_t address_t;
+
+private:
+  cbp::FINITE_STACK<128> ret_pred;
+  cbp::INDIRECT_PRED<10> ind_pred;
+
+public:
+  // uses compiler generated constructor
+  // uses compiler generated destructor
+
+  // it never looks at its op_state_c argument (see op_state.h)
+  static constexpr uint OP_STATE_USE = OP_STATE_NONE;
+
+  // get_target_prediction() takes an indirect branch and architectural state,
+  // like PREDICTOR's get_prediction(), and predicts its target
+  address_t get_target_prediction(const branch_record_c* br, const op_state_c*) {
+    if (br->is_return)
+      return address_t(ret_pred.top());
+    return address_t(ind_pred.get_prediction(br->instruction_addr));
+  }
+
+  // Update the predictor after any branch, its target (br->branch_target)
+  // known
+  void update_target_predictor(const branch_record_c* br, const op_state_c*, bool) {
+    if (br->is_call)
+      ret_pred.push(br->instruction_next_addr);
+    if (br->is_return)
+      ret_pred.pop();
+    else if (br->is_indirect)
+      ind_pred.train(br->instruction_addr, br->branch_target);
+  }
+};
+
+// An ITTAGE configuration: the log2 of the base table's size, and, per
+// tagged table, the history length, the log2 of the number of entries and the
+// tag width; the bits of its target each indirect branch shifts into the
+// history; how often the useful bits are cleared; the depth of the return
+// stack and how far under its top it looks for a return's target; and the
+// storage budget.  Derive from it to change any of these.
+struct ITTAGE_CONFIG_CBP {
+  static constexpr int LOG_BASE = 9;
+  static constexpr int NUM_TABLES = 7;
+  static constexpr std::array<std::size_t, NUM_TABLES> L = {{4, 8, 13, 22, 38, 66, 128}};
+  static constexpr std::array<std::size_t, NUM_TABLES> LOG_SIZES = {{7, 7, 7, 7, 7, 7, 7}};
+  static constexpr std::array<std::size_t, NUM_TABLES> TAG_BITS = {{9, 9, 10, 10, 11, 11, 12}};
+  static constexpr int TARGET_HIST_BITS = 3;
+  static constexpr int U_RESET_LOG_PERIOD = 16;  // the useful bits are cleared every 2^16 indirect branches
+  static constexpr std::size_t RETURN_STACK_DEPTH = 64;
+  static constexpr std::size_t RETURN_STACK_REPAIR = 4;
+  static constexpr std::size_t BUDGET_BITS = CBP_BUDGET_BITS;
+};
+
+template <class CONFIG>
+class ITTAGE_PREDICTOR {
+public:
+  typedef uint32_t address_t;
+
+private:
+  typedef unsigned __int128 history_t;
+
+  // Constant Definitions
+  static constexpr int NUM_TABLES = CONFIG::NUM_TABLES;
+  static constexpr std::array<std::size_t, NUM_TABLES> L = CONFIG::L;
+  static constexpr std::array<std::size_t, NUM_TABLES> LOG_SIZES = CONFIG::LOG_SIZES;
+  static constexpr std::array<std::size_t, NUM_TABLES> TAG_BITS = CONFIG::TAG_BITS;
+  static constexpr int LOG_BASE = CONFIG::LOG_BASE;
+
+  static const int TARGET_BITS = 32;        // a target is stored whole
+  static const int CONFIDENCE_BITS = 2;     // confidence in an entry's target
+  static const int MAX_CONFIDENCE = (1 << CONFIDENCE_BITS) - 1;
+
+  typedef RETURN_STACK<CONFIG::RETURN_STACK_DEPTH, CONFIG::RETURN_STACK_REPAIR> return_stack_t;
+
+  // Path History
+  static const int PATH_HIST_LENGTH = 16;  // 16 bits
+  // Global History
+  static const int GLOBAL_HIST_LENGTH = 128;  // 128 bits
+
+  static constexpr bool lengths_fit() {
+    for (int i = 0; i < NUM_TABLES; ++i)
+      if ((TAG_BITS[i] > 16) || (L[i] > std::size_t(GLOBAL_HIST_LENGTH)))
+        return false;
+    return true;
+  }
+  static_assert(lengths_fit(), "a tag is over 16 bits or a history is longer than ghist");
+
+  // The tagged tables lie one after another in one array
+  static constexpr std::array<std::size_t, NUM_TABLES + 1> table_bases() {
+    std::array<std::size_t, NUM_TABLES + 1> bases = {};
+    for (int i = 0; i < NUM_TABLES; ++i)
+      bases[i + 1] = bases[i] + (std::size_t(1) << LOG_SIZES[i]);
+    return bases;
+  }
+  static constexpr std::array<std::size_t, NUM_TABLES + 1> TABLE_BASES = table_bases();
+
+  struct base_entry {
+    address_t target;
+    uint8_t confidence;
+  };
+  struct tagged_entry {
+    address_t target;
+    uint16_t tag;
+    uint8_t confidence;
+    bool u;                 // useful
+  };
+
+  // Calls f(std::integral_constant<int, i>()) for each tagged table i in
+  // order; the loop is unrolled and i is a constant inside f.
+  template <class F, int... I>
+  static void for_each_table(F f, std::integer_sequence<int, I...>) {
+    (f(std::integral_constant<int, I>()), ...);
+  }
+  template <class F>
+  static void for_each_table(F f) {
+    for_each_table(f, std::make_integer_sequence<int, NUM_TABLES>());
+  }
+
+  // Shifts bit in into the W-bit fold of a LENGTH-bit history, and out (the
+  // history's oldest bit) out of it
+  template <std::size_t W, std::size_t LENGTH>
+  static uint32_t shift_fold(uint32_t folded, bool in, bool out) {
+    folded = (folded << 1) | uint32_t(in);
+    folded ^= folded >> W;
+    folded &= (uint32_t(1) << W) - 1;
+    return folded ^ (uint32_t(out) << (LENGTH % W));
+  }
+
+  static constexpr std::size_t tagged_bits() {
+    std::size_t bits = 0;
+    for (int i = 0; i < NUM_TABLES; ++i)
+      bits += (std::size_t(1) << LOG_SIZES[i]) * (TARGET_BITS + CONFIDENCE_BITS + 1 + TAG_BITS[i]);
+    return bits;
+  }
+
+public:
+  // The hardware storage of each component, in budgeted bits (see
+  // GEHL_PREDICTOR::BUDGET); the history folds are derived, so not counted
+  static constexpr std::array<BUDGET_ITEM, 7> BUDGET = {{
+    {"ghist", GLOBAL_HIST_LENGTH},
+    {"phist", PATH_HIST_LENGTH},
+    {"base table", (std::size_t(1) << LOG_BASE) * (TARGET_BITS + CONFIDENCE_BITS)},
+    {"tagged tables", tagged_bits()},
+    {"useful bit clearing counter", CONFIG::U_RESET_LOG_PERIOD},
+    {"return stack", return_stack_t::BUDGET_BITS},
+    {"Seed", 32}
+  }};
+  static constexpr std::size_t STORAGE_BITS = budget_bits(BUDGET);
+  static constexpr std::size_t BUDGET_LIMIT = CONFIG::BUDGET_BITS;
+  static constexpr bool FITS_BUDGET = STORAGE_BITS <= BUDGET_LIMIT;
+  // it never looks at its op_state_c argument (see op_state.h)
+  static constexpr uint OP_STATE_USE = OP_STATE_NONE;
+
+private:
+  // Hardware Data Structures
+
+  // Global History Register: conditional branch directions, and a few bits
+  // of the target of each indirect branch but returns
+  history_t ghist;
+  // Path History Register
+  uint32_t phist;
+  // ghist folded to each table's index width and to its tag width (twice,
+  // the second one bit narrower, so the tag isn't just the index's fold)
+  std::array<uint32_t, NUM_TABLES> index_folds;
+  std::array<uint32_t, NUM_TABLES> tag_folds;
+  std::array<uint32_t, NUM_TABLES> tag_folds2;
+  // Base Table, indexed by pc alone
+  std::array<base_entry, std::size_t(1) << LOG_BASE> base;
+  // Tagged Tables
+  std::array<tagged_entry, TABLE_BASES[NUM_TABLES]> tables;
+  // Indirect branches since the useful bits were last cleared
+  uint32_t u_tick;
+  // Return Stack: the tables would learn return targets only for the call
+  // sites they have seen, at the cost of the other indirect branches' entries
+  return_stack_t return_stack;
+  // A seed for generating randomness
+  int Seed;
+
+  // Per Branch Variables used in both getting and updating prediction
+  std::array<std::size_t, NUM_TABLES> indices;  // entry in tables of each tagged table
+  std::array<int, NUM_TABLES> tags;
+  std::size_t base_index;
+  int provider;                            // longest matching table, or -1
+  int alt_provider;                        // next longest matching table, or -1
+  address_t provider_target;
+  address_t alt_target;
+  address_t prediction;                    // Prediction of this particular branch
+
+public:
+  ITTAGE_PREDICTOR(void)
+    : ghist(0)
+    , phist(0)
+    , u_tick(0)
+    , Seed(0)
+  {
+    static_assert(FITS_BUDGET, "the configuration is over its storage budget (see BUDGET)");
+    index_folds.fill(0);
+    tag_folds.fill(0);
+    tag_folds2.fill(0);
+    base.fill(base_entry());
+    tables.fill(tagged_entry());
+  }
+  // uses compiler generated copy constructor
+  // uses compiler generated destructor
+  // uses compiler generated assignment operator
+
+  int MYRANDOM() {
+    Seed++;
+    Seed ^= phist;
+    Seed = (Seed >> 21) + (Seed << 11);
+    Seed ^= int(ghist);
+    Seed = (Seed >> 10) + (Seed << 22);
+    return (Seed);
+  }
+
+  // Computes the index and tag of the branch at pc in each tagged table
+  void calc_indices(address_t pc) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      constexpr std::size_t W = LOG_SIZES[i];
+      constexpr uint32_t PATH_MASK = (L[i] < PATH_HIST_LENGTH) ? (1u << L[i]) - 1 : (1u << PATH_HIST_LENGTH) - 1;
+      uint32_t path = phist & PATH_MASK;
+      path ^= path >> W;
+      indices[i] = TABLE_BASES[i] + ((pc ^ (pc >> (W - i % W)) ^ index_folds[i] ^ path) & ((std::size_t(1) << W) - 1));
+      tags[i] = (pc ^ tag_folds[i] ^ (tag_folds2[i] << 1)) & ((1 << TAG_BITS[i]) - 1);
+    });
+  }
+
+  // get_target_prediction() takes an indirect branch (br, branch_record_c is
+  // defined in tread.h) and architectural state (os, op_state_c is defined
+  // op_state.h), like PREDICTOR's get_prediction(), and predicts its target.
+  address_t get_target_prediction(const branch_record_c* br, const op_state_c*) {
+    if (br->is_return)
+      return address_t(return_stack.top());
+    address_t pc = br->instruction_addr;
+    calc_indices(pc);
+    base_index = pc & ((std::size_t(1) << LOG_BASE) - 1);
+
+    provider = -1;
+    alt_provider = -1;
+    for (int i = NUM_TABLES - 1; i >= 0; --i) {
+      if (tables[indices[i]].tag == tags[i]) {
+        if (provider < 0) {
+          provider = i;
+        } else {
+          alt_provider = i;
+          break;
+        }
+      }
+    }
+
+    alt_target = (alt_provider >= 0) ? tables[indices[alt_provider]].target : base[base_index].target;
+    if (provider >= 0) {
+      const tagged_entry& entry = tables[indices[provider]];
+      provider_target = entry.target;
+      // a new entry that hasn't been confirmed yet defers to the alternate
+      prediction = ((entry.confidence == 0) && !entry.u) ? alt_target : provider_target;
+    } else {
+      provider_target = alt_target;
+      prediction = alt_target;
+    }
+    return prediction;
+  }
+
+  // Moves an entry's confidence toward target, replacing its target once it
+  // has none left
+  template <class ENTRY>
+  static void update_target(ENTRY& entry, address_t target) {
+    if (entry.target == target) {
+      if (entry.confidence < MAX_CONFIDENCE)
+        ++entry.confidence;
+    } else if (entry.confidence > 0) {
+      --entry.confidence;
+    } else {
+      entry.target = target;
+    }
+  }
+
+  // On a misprediction, allocates an entry in a table with a longer history
+  // than the provider's, skipping one at random so allocations spread out;
+  // if none is free, the candidates lose their useful bits instead
+  void allocate(address_t target) {
+    int first = provider + 1;
+    if ((first < NUM_TABLES - 1) && (MYRANDOM() & 1))
+      ++first;
+    for (int i = first; i < NUM_TABLES; ++i) {
+      tagged_entry& entry = tables[indices[i]];
+      if (!entry.u) {
+        entry.target = target;
+        entry.tag = uint16_t(tags[i]);
+        entry.confidence = 0;
+        return;
+      }
+    }
+    for (int i = first; i < NUM_TABLES; ++i)
+      tables[indices[i]].u = false;
+  }
+
+  // Clears every useful bit every 2^U_RESET_LOG_PERIOD indirect branches
+  void age_useful_bits(void) {
+    if (++u_tick < (uint32_t(1) << CONFIG::U_RESET_LOG_PERIOD))
+      return;
+    u_tick = 0;
+    for (std::size_t e = 0; e < tables.size(); ++e)
+      tables[e].u = false;
+  }
+
+  void update_ghist(bool bit) {
+    for_each_table([&](auto I) {
+      constexpr int i = I;
+      bool out = (ghist >> (L[i] - 1)) & 1;
+      index_folds[i] = shift_fold<LOG_SIZES[i], L[i]>(index_folds[i], bit, out);
+      tag_folds[i] = shift_fold<TAG_BITS[i], L[i]>(tag_folds[i], bit, out);
+      tag_folds2[i] = shift_fold<TAG_BITS[i] - 1, L[i]>(tag_folds2[i], bit, out);
+    });
+    ghist = (ghist << 1) | history_t(bit);
+  }
+  void update_phist(bool bit) {
+    phist = ((phist << 1) | uint32_t(bit)) & ((1u << PATH_HIST_LENGTH) - 1);
+  }
+
+  // Update the predictor after any branch, its direction (taken) and target
+  // (br->branch_target) known; an indirect branch must have been predicted.
+  // Returns neither train the tables nor enter the history.
+  void update_target_predictor(const branch_record_c* br, const op_state_c*, bool taken) {
+
+    address_t pc = br->instruction_addr;
+    if (br->is_indirect && !br->is_return) {
+      address_t target = br->branch_target;
+
+      if ((prediction != target) && (provider < NUM_TABLES - 1))
+        allocate(target);
+
+      if (provider >= 0) {
+        tagged_entry& entry = tables[indices[provider]];
+        bool new_entry = (entry.confidence == 0) && !entry.u;
+        if (provider_target != alt_target)
+          entry.u = (provider_target == target);
+        update_target(entry, target);
+        // a new entry is still learning, so its alternate learns too
+        if (new_entry) {
+          if (alt_provider >= 0)
+            update_target(tables[indices[alt_provider]], target);
+          else
+            update_target(base[base_index], target);
+        }
+      } else {
+        update_target(base[base_index], target);
+      }
+      age_useful_bits();
+
+      for (int b = 0; b < CONFIG::TARGET_HIST_BITS; ++b)
+        update_ghist(((target >> (2 + b)) ^ (target >> (2 + b + CONFIG::TARGET_HIST_BITS))) & 1);
+      update_phist(pc & 1);
+    } else if (br->is_conditional) {
+      update_ghist(taken);
+      update_phist(pc & 1);
+    } else if (br->is_call) {
+      update_ghist(true);
+      update_phist(pc & 1);
+    }
+    if (br->is_call)
+      return_stack.push(br->instruction_next_addr);
+    if (br->is_return)
+      return_stack.pop(br->branch_target);
+
+  }
+
+  void print_stats(void) const {
+    return_stack.print_stats();
+  }
+};
+
+#endif // TARGET_PREDICTOR_H_SEEN
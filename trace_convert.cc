@@ -0,0 +1,134 @@
+/* Description: Converts a trace into its branch cache (.brc) or columnar
+ * branch trace (.bct), which the driver can replay with "predictor -c" or
+ * "predictor -b" instead of decoding the trace, or builds its index (.idx),
+ * which the trace reader seeks with (see trace_index.h).
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include "branch_cache.h"
+#include "branch_columns.h"
+#include "trace_index.h"
+#include "tread.h"
+
+// Writes the branches 'reader' reads, up to the one that reaches 'max_insts'
+// instructions, with 'writer' (a branch_cache_writer_c or
+// branch_columns_writer_c).  Only the branches are kept; every other
+// instruction just adds to the count carried by the next branch.
+template <class WRITER>
+void
+convert(branch_reader_c* reader, WRITER* writer, const char* output_name, uint64_t max_insts)
+{
+    branch_record_c br;
+    bool taken;
+    uint num_insts = 0;
+    uint num_branches = 0;
+    uint64_t total_insts = 0;
+    while ((total_insts < max_insts) && reader->decode_branch_record(&br, &taken, &num_insts)) {
+        writer->write(&br, taken, num_insts);
+        total_insts += num_insts;
+        num_insts = 0;
+        num_branches++;
+    }
+    // the instructions after the last branch, if the trace has ended
+    writer->close(num_insts);
+    total_insts += num_insts;
+
+    printf("%s: %u branches, %llu instructions\n", output_name, num_branches, (unsigned long long)total_insts);
+}
+
+// usage: trace_convert [-j threads] [-f brc | bct | idx] [-k millions]
+//                      [-x insts] [-n insts] [-o output] <trace>
+//   -j threads: decompress the trace's bzip2 blocks on this many threads
+//   -f format: write a branch cache (brc, the default), a columnar branch
+//              trace (bct), or the trace's index (idx)
+//   -k millions: with -f idx, checkpoint every this many million
+//                instructions (1 by default)
+//   -x insts: convert the trace from just after the branch that reaches
+//             instruction insts, seeking with the trace's index if it has one
+//   -n insts: convert the trace up to the branch that reaches insts more
+//             instructions
+//   -o output: write <output>.brc or <output>.bct, rather than <trace>.brc or
+//              <trace>.bct, as a slice of the trace (-x, -n) had better be
+// reads <trace>.bz2 and writes <trace>.brc, <trace>.bct or <trace>.idx
+int
+main(int argc, char* argv[])
+{
+    using namespace std;
+
+    uint decompress_threads = 0;
+    string format = "brc";
+    uint64_t interval_millions = 1;
+    uint64_t first_insts = 0;
+    uint64_t max_insts = ~uint64_t(0);
+    const char* output = 0;
+    bool bad_usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:f:k:x:n:o:")) != -1) {
+        switch (opt) {
+          case 'j':
+            decompress_threads = atoi(optarg);
+            break;
+          case 'f':
+            format = optarg;
+            break;
+          case 'k':
+            interval_millions = strtoull(optarg, 0, 0);
+            break;
+          case 'x':
+            first_insts = strtoull(optarg, 0, 0);
+            break;
+          case 'n':
+            max_insts = strtoull(optarg, 0, 0);
+            break;
+          case 'o':
+            output = optarg;
+            break;
+          default:
+            bad_usage = true;
+            break;
+        }
+    }
+
+    if ((format != "brc") && (format != "bct") && (format != "idx"))
+        bad_usage = true;
+    // an index covers the whole trace
+    if ((format == "idx") && ((first_insts != 0) || (max_insts != ~uint64_t(0)) || output))
+        bad_usage = true;
+    if (bad_usage || ((optind + 1) != argc) || (interval_millions == 0)) {
+        printf("usage: %s [-j threads] [-f brc | bct | idx] [-k millions] [-x insts] [-n insts] [-o output] <trace>\n",
+               argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // indexing locates each checkpoint in the trace's bzip2 blocks, which the
+    // parallel decompressor reads block by block
+    if ((format == "idx") && (decompress_threads == 0))
+        decompress_threads = 1;
+    // (and builds a new index without the old one)
+    cbp_trace_reader_c reader(argv[optind], decompress_threads, format != "idx");
+    reader.set_report(false);
+
+    string output_name = string(output ? output : argv[optind]) + "." + format;
+    if (format == "idx") {
+        reader.write_index(output_name.c_str(), interval_millions * 1000000);
+        printf("%s: a checkpoint every %llu instructions\n", output_name.c_str(),
+               (unsigned long long)(interval_millions * 1000000));
+        return 0;
+    }
+    if (!reader.skip_to_insts(first_insts)) {
+        printf("%s ends before instruction %llu\n", argv[optind], (unsigned long long)first_insts);
+        exit(EXIT_FAILURE);
+    }
+
+    if (format == "brc") {
+        branch_cache_writer_c writer(output_name.c_str());
+        convert(&reader, &writer, output_name.c_str(), max_insts);
+    }
+    else {
+        branch_columns_writer_c writer(output_name.c_str());
+        convert(&reader, &writer, output_name.c_str(), max_insts);
+    }
+}
@@ -0,0 +1,165 @@
+/* Description: This file implements the trace index (.idx) writer and the
+ * mmap-based trace index.
+*/
+
+#include "trace_index.h"
+#include <bzlib.h>
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cbp_fatal.h"
+#include "op_state.h"
+
+using namespace cbp;
+using namespace std;
+
+static const char g_trace_index_magic[8] = {'C', 'B', 'P', 'I', 'D', 'X', 0, 0};
+
+string get_trace_index_name(const char *trace_name){
+    return string(trace_name) + ".idx";
+}
+
+trace_index_writer_c::trace_index_writer_c(const char *file_name, uint64_t trace_size, uint64_t interval_insts){
+    file = fopen(file_name, "wb");
+    if(!file){
+        CBP_FATAL("cannot create trace index \"%s\"", file_name);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, g_trace_index_magic, sizeof(header.magic));
+    header.version        = g_trace_index_version;
+    header.entry_size     = sizeof(trace_index_entry_c);
+    header.trace_size     = trace_size;
+    header.interval_insts = interval_insts;
+    // the header is rewritten with the final counts by close()
+    if(fwrite(&header, sizeof(header), 1, file) != 1){
+        CBP_FATAL("cannot write trace index header");
+    }
+    file_size = sizeof(header);
+}
+trace_index_writer_c::~trace_index_writer_c(){
+    assert(!file);
+}
+void trace_index_writer_c::write(const trace_index_entry_c &entry, const vector<uint8_t> &decoder_state,
+                                 const vector<char> &op_state){
+    // the decoder state is mostly the run-length coded entries of the decoder's tables, which compress well
+    unsigned int compressed_size = decoder_state.size() + (decoder_state.size() / 100) + 600;
+    compressed.resize(compressed_size);
+    if(BZ2_bzBuffToBuffCompress(&compressed[0], &compressed_size, (char *)&decoder_state[0], decoder_state.size(),
+                                9, 0, 0) != BZ_OK){
+        CBP_FATAL("cannot compress decoder state");
+    }
+    entries.push_back(entry);
+    trace_index_entry_c &written = entries.back();
+    written.decoder_state_offset   = file_size;
+    written.decoder_state_size     = compressed_size;
+    written.decoder_state_raw_size = decoder_state.size();
+    written.op_state_offset        = file_size + compressed_size;
+    written.op_state_size          = op_state.size();
+    if((fwrite(&compressed[0], compressed_size, 1, file) != 1) || (fwrite(&op_state[0], op_state.size(), 1, file) != 1)){
+        CBP_FATAL("cannot write trace index checkpoint");
+    }
+    file_size += compressed_size + op_state.size();
+}
+void trace_index_writer_c::close(uint64_t trace_insts){
+    header.trace_insts     = trace_insts;
+    header.num_checkpoints = entries.size();
+    header.entries_offset  = file_size;
+    if(!entries.empty() && (fwrite(&entries[0], sizeof(entries[0]), entries.size(), file) != entries.size())){
+        CBP_FATAL("cannot write trace index entries");
+    }
+    if((fseek(file, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(header), 1, file) != 1) || (fclose(file) != 0)){
+        CBP_FATAL("cannot finish trace index");
+    }
+    file = 0;
+}
+
+trace_index_c::trace_index_c(const char *trace_name){
+    assert(trace_name);
+    file_name = get_trace_index_name(trace_name);
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if(fd < 0){
+        CBP_FATAL("cannot open trace index \"%s\"; create it with trace_convert", file_name.c_str());
+    }
+    struct stat file_stat;
+    if((fstat(fd, &file_stat) != 0) || (size_t(file_stat.st_size) < sizeof(trace_index_header_c))){
+        CBP_FATAL("trace index \"%s\" is truncated", file_name.c_str());
+    }
+    map_size = file_stat.st_size;
+    map      = mmap(0, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        CBP_FATAL("cannot mmap trace index \"%s\"", file_name.c_str());
+    }
+    header = (const trace_index_header_c *)map;
+    if((memcmp(header->magic, g_trace_index_magic, sizeof(header->magic)) != 0) ||
+       (header->version != g_trace_index_version) ||
+       (header->entry_size != sizeof(trace_index_entry_c)) ||
+       (map_size != header->entries_offset + header->num_checkpoints * sizeof(trace_index_entry_c))){
+        CBP_FATAL("\"%s\" is not a version %u trace index", file_name.c_str(), g_trace_index_version);
+    }
+    entries = (const trace_index_entry_c *)((const char *)map + header->entries_offset);
+    string trace_file_name = string(trace_name) + ".bz2";
+    if((stat(trace_file_name.c_str(), &file_stat) != 0) || (uint64_t(file_stat.st_size) != header->trace_size)){
+        CBP_FATAL("trace index \"%s\" is not the index of \"%s\"; rebuild it with trace_convert", file_name.c_str(),
+                  trace_file_name.c_str());
+    }
+}
+
+trace_index_c::~trace_index_c(){
+    munmap(map, map_size);
+}
+
+bool trace_index_c::exists(const char *trace_name){
+    return access(get_trace_index_name(trace_name).c_str(), R_OK) == 0;
+}
+
+const trace_index_entry_c *trace_index_c::find_checkpoint(uint64_t branches, uint64_t insts) const{
+    // the checkpoints are in the order of the trace: find the first one past the position
+    uint64_t low  = 0;
+    uint64_t high = header->num_checkpoints;
+    while(low < high){
+        uint64_t middle = low + (high - low) / 2;
+        const branch_reader_position_c &position = entries[middle].position;
+        if((position.branches <= branches) && (position.insts <= insts)){
+            low = middle + 1;
+        }
+        else{
+            high = middle;
+        }
+    }
+    return (low == 0) ? 0 : (entries + low - 1);
+}
+
+void trace_index_c::open_checkpoint(const trace_index_entry_c *checkpoint, const char *trace_file_name,
+                                    uint decompress_threads, TRACE_SOURCE **source, CBP_INST_STREAM **stream,
+                                    op_state_c *osptr) const{
+    BZ2_PARALLEL_SOURCE *block_source = new BZ2_PARALLEL_SOURCE(trace_file_name, (decompress_threads > 0) ?
+                                                                decompress_threads : 1, checkpoint->block,
+                                                                checkpoint->block_offset);
+    if(block_source->get_block_bit(checkpoint->block) != checkpoint->block_bit){
+        CBP_FATAL("trace index \"%s\" is not the index of \"%s\"; rebuild it with trace_convert", file_name.c_str(),
+                  trace_file_name);
+    }
+    *source = block_source;
+    *stream = cbp_inst_open(*source);
+
+    vector<uint8_t> decoder_state(checkpoint->decoder_state_raw_size);
+    unsigned int decoder_state_size = decoder_state.size();
+    if((BZ2_bzBuffToBuffDecompress((char *)&decoder_state[0], &decoder_state_size,
+                                   (char *)map + checkpoint->decoder_state_offset, checkpoint->decoder_state_size,
+                                   0, 0) != BZ_OK) || (decoder_state_size != decoder_state.size())){
+        CBP_FATAL("trace index \"%s\" is corrupt", file_name.c_str());
+    }
+    if(!cbp_inst_restore_state(*stream, &decoder_state[0], decoder_state_size)){
+        CBP_FATAL("trace index \"%s\" was built by another version of the decoder; rebuild it with trace_convert",
+                  file_name.c_str());
+    }
+    if(checkpoint->op_state_size != osptr->get_state_size()){
+        CBP_FATAL("trace index \"%s\" was built with another op_state; rebuild it with trace_convert",
+                  file_name.c_str());
+    }
+    osptr->restore_state((const char *)map + checkpoint->op_state_offset);
+}
@@ -0,0 +1,115 @@
+/* Description: This file defines the trace index (.idx) file format, which
+ * makes a bzip2 compressed trace seekable.  A CBP_INST_STREAM decodes each
+ * instruction from what its predictors learned from all the instructions
+ * before it, so reaching instruction N otherwise means decoding everything
+ * before it.  Every interval instructions, at the branch that reaches the
+ * interval, the index holds a checkpoint: where the branch is in the
+ * compressed trace (a bzip2 block and an offset into what the block
+ * decompresses to) and the state of the decoder and of the reader's op_state
+ * there.  A decoder restored from a checkpoint decodes the rest of the trace
+ * exactly as one that decoded the whole trace does.
+ * cbp_trace_reader_c::write_index() builds the index (see trace_convert.cc),
+ * and a cbp_trace_reader_c of a trace with an index seeks with it.
+*/
+
+#ifndef TRACE_INDEX_H_SEEN
+#define TRACE_INDEX_H_SEEN
+
+#include <cstdio>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "cbp_inst.h"
+#include "trace_source.h"
+#include "tread.h"
+
+// file layout: one trace_index_header_c, then the checkpoints' states, then num_checkpoints
+// trace_index_entry_c's at entries_offset, in the order of the trace, all in the host's byte order
+struct trace_index_header_c
+{
+    char     magic[8];             // "CBPIDX\0\0"
+    uint32_t version;              // g_trace_index_version
+    uint32_t entry_size;           // sizeof(trace_index_entry_c)
+    uint64_t trace_size;           // bytes in the compressed trace, to catch the index of another trace
+    uint64_t interval_insts;       // instructions between checkpoints
+    uint64_t trace_insts;          // instructions in the whole trace
+    uint64_t num_checkpoints;
+    uint64_t entries_offset;
+};
+
+struct trace_index_entry_c
+{
+    branch_reader_position_c position;    // the reader's position, just after a branch
+    uint64_t trace_offset;         // decompressed bytes of the trace before the checkpoint
+    uint64_t block;                // the bzip2 block the checkpoint is in, numbered as BZ2_PARALLEL_SOURCE does
+    uint64_t block_bit;            // the block's bit offset in the compressed trace
+    uint64_t block_offset;         // the checkpoint's offset into what the block decompresses to
+    uint64_t decoder_state_offset; // the decoder's state (cbp_inst_save_state()), bzip2 compressed
+    uint64_t decoder_state_size;
+    uint64_t decoder_state_raw_size;   // ... and before it was compressed
+    uint64_t op_state_offset;      // the op_state's state (op_state_c::save_state())
+    uint64_t op_state_size;
+};
+
+const uint32_t g_trace_index_version = 4;
+
+// the index of trace_name: <trace_name>.idx
+std::string get_trace_index_name(const char *trace_name);
+
+// writes a trace index, one checkpoint at a time
+class trace_index_writer_c
+{
+private:
+    FILE *file;
+    trace_index_header_c header;
+    std::vector<trace_index_entry_c> entries;
+    uint64_t file_size;
+    std::vector<char> compressed;                   // the decoder state being written
+public:
+    trace_index_writer_c(const char *file_name, uint64_t trace_size, uint64_t interval_insts);
+    ~trace_index_writer_c();
+    // append a checkpoint: entry's position and location in the trace, and the states
+    void write(const trace_index_entry_c &entry, const std::vector<uint8_t> &decoder_state,
+               const std::vector<char> &op_state);
+    // finish the file; trace_insts counts the instructions in the whole trace
+    void close(uint64_t trace_insts);
+};
+
+// a trace index, mmapped
+class trace_index_c
+{
+private:
+    void *map;                                      // the mmapped file
+    size_t map_size;
+    const trace_index_header_c *header;
+    const trace_index_entry_c *entries;
+    std::string file_name;
+
+    // not implemented
+    trace_index_c(const trace_index_c &);
+    trace_index_c &operator=(const trace_index_c &);
+public:
+    // opens the index of trace_name, which must be up to date with the trace
+    trace_index_c(const char *trace_name);
+    ~trace_index_c();
+    // whether trace_name has an index
+    static bool exists(const char *trace_name);
+    uint64_t get_trace_insts() const{
+        return header->trace_insts;
+    }
+    uint64_t get_num_checkpoints() const{
+        return header->num_checkpoints;
+    }
+    const trace_index_entry_c *get_checkpoint(uint64_t i) const{
+        return entries + i;
+    }
+    // the last checkpoint at or before both branches and insts, or null if there is none
+    const trace_index_entry_c *find_checkpoint(uint64_t branches, uint64_t insts) const;
+    // starts a source of the trace (trace_file_name, the .bz2) at checkpoint, decompressing on
+    // decompress_threads threads (at least one), and a decoder reading it, restored to the checkpoint, and
+    // restores osptr to it
+    void open_checkpoint(const trace_index_entry_c *checkpoint, const char *trace_file_name, uint decompress_threads,
+                         cbp::TRACE_SOURCE **source, cbp::CBP_INST_STREAM **stream, op_state_c *osptr) const;
+};
+
+#endif // TRACE_INDEX_H_SEEN
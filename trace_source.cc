@@ -0,0 +1,404 @@
+/* Description: This file defines the sources that a CBP_INST_STREAM can read
+ * the raw (uncompressed) trace bytes from.  BZ2_SOURCE decompresses a bzip2
+ * trace in-process, so no "bzip2 -dc" subprocess or pipe is needed.
+ * BZ2_PARALLEL_SOURCE splits the trace at its bzip2 block boundaries and
+ * decompresses the blocks on a pool of worker threads.
+*/
+
+#include "trace_source.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "cbp_fatal.h"
+
+namespace cbp
+{
+    using namespace std;
+
+    /* **************************************** */
+
+    size_t
+    FILE_SOURCE::read(uint8_t* buffer, size_t size)
+    {
+        return fread(buffer, sizeof(uint8_t), size, stream);
+    }
+
+    /* **************************************** */
+
+    BZ2_SOURCE::BZ2_SOURCE(const char* file_name)
+        : file(fopen(file_name, "rb")),
+          bz_active(false),
+          input_eof(false),
+          output_eof(false),
+          input(new char[INPUT_SIZE]),
+          output(new uint8_t[OUTPUT_SIZE]),
+          output_head(output),
+          output_tail(output),
+          decompress_seconds(0.0)
+    {
+        if (!file)
+            CBP_FATAL("cannot open trace file %s", file_name);
+        memset(&bz, 0, sizeof(bz));
+    }
+
+    BZ2_SOURCE::~BZ2_SOURCE(void)
+    {
+        if (bz_active)
+            BZ2_bzDecompressEnd(&bz);
+        fclose(file);
+        delete [] input;
+        delete [] output;
+    }
+
+    // Decompresses up to 'size' bytes straight into 'buffer'.  Returns the
+    // number of bytes produced, which is less than 'size' only at the end.
+    size_t
+    BZ2_SOURCE::decompress(uint8_t* buffer, size_t size)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        uint8_t* tail = buffer;
+        while (!output_eof && (tail != (buffer + size))) {
+            // top up the compressed input
+            if ((0 == bz.avail_in) && !input_eof) {
+                size_t n = fread(input, sizeof(char), INPUT_SIZE, file);
+                input_eof = (n < INPUT_SIZE);
+                bz.next_in = input;
+                bz.avail_in = static_cast<unsigned int>(n);
+            }
+
+            // start a new stream if the previous one has ended; concatenated
+            // streams follow unless the input is exhausted
+            if (!bz_active) {
+                if ((0 == bz.avail_in) && input_eof) {
+                    output_eof = true;
+                    break;
+                }
+                if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK)
+                    CBP_FATAL("BZ2_bzDecompressInit failed");
+                bz_active = true;
+            }
+
+            bz.next_out = reinterpret_cast<char*>(tail);
+            bz.avail_out = static_cast<unsigned int>((buffer + size) - tail);
+            int status = BZ2_bzDecompress(&bz);
+            tail = reinterpret_cast<uint8_t*>(bz.next_out);
+
+            if (BZ_STREAM_END == status) {
+                BZ2_bzDecompressEnd(&bz);
+                bz_active = false;
+            } else if (BZ_OK != status) {
+                CBP_FATAL("corrupt bzip2 trace (error %d)", status);
+            } else if ((0 == bz.avail_in) && input_eof && (0 != bz.avail_out)) {
+                CBP_FATAL("truncated bzip2 trace");
+            }
+        }
+
+        decompress_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return (tail - buffer);
+    }
+
+    size_t
+    BZ2_SOURCE::read(uint8_t* buffer, size_t size)
+    {
+        size_t copied = 0;
+        while (copied != size) {
+            if (output_head == output_tail) {
+                if (output_eof)
+                    break;
+                // large reads (e.g., a CBP_INST_STREAM window refill) bypass
+                // the output buffer
+                if ((size - copied) >= DIRECT_SIZE) {
+                    copied += decompress(buffer + copied, size - copied);
+                    continue;
+                }
+                output_head = output;
+                output_tail = (output + decompress(output, OUTPUT_SIZE));
+                continue;
+            }
+            size_t n = min(size - copied, static_cast<size_t>(output_tail - output_head));
+            memcpy(buffer + copied, output_head, n);
+            output_head += n;
+            copied += n;
+        }
+        return copied;
+    }
+
+    /* **************************************** */
+
+    // 48-bit magic numbers that start each compressed block and end each stream
+    static const uint64_t BZ2_BLOCK_MAGIC = 0x314159265359ULL;
+    static const uint64_t BZ2_EOS_MAGIC   = 0x177245385090ULL;
+    static const uint64_t BZ2_MAGIC_MASK  = ((uint64_t(1) << 48) - 1);
+
+    // Appends bits MSB first, the bit order bzip2 uses.
+    class BIT_WRITER
+    {
+      private:
+        vector<uint8_t>* out;
+        int free_bits;   // unused low bits in out->back()
+
+      public:
+        explicit BIT_WRITER(vector<uint8_t>* out_arg) : out(out_arg), free_bits(0) { }
+
+        void put_byte(uint8_t value)
+        {
+            if (0 == free_bits) {
+                out->push_back(value);
+            } else {
+                out->back() |= (value >> (8 - free_bits));
+                out->push_back(static_cast<uint8_t>(value << free_bits));
+            }
+        }
+
+        void put_bits(uint64_t value, int num_bits)
+        {
+            while (num_bits-- > 0) {
+                if (0 == free_bits) {
+                    out->push_back(0);
+                    free_bits = 8;
+                }
+                --free_bits;
+                out->back() |= (((value >> num_bits) & 1) << free_bits);
+            }
+        }
+    };
+
+    BZ2_PARALLEL_SOURCE::BZ2_PARALLEL_SOURCE(const char* file_name, unsigned num_threads,
+                                             size_t first_block, size_t first_offset)
+        : compressed_bits(0),
+          window(2 * max(num_threads, 1U) + 2),
+          next_block(first_block),
+          current_block(first_block),
+          current_offset(first_offset),
+          skip_until(first_block),
+          current_ready(false),
+          stopping(false),
+          decompress_seconds(0.0),
+          output_bytes(0)
+    {
+        FILE* file = fopen(file_name, "rb");
+        if (!file)
+            CBP_FATAL("cannot open trace file %s", file_name);
+        uint8_t chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, sizeof(uint8_t), sizeof(chunk), file)) != 0)
+            compressed.insert(compressed.end(), chunk, chunk + n);
+        fclose(file);
+        if ((compressed.size() < 4) || (0 != memcmp(&compressed[0], "BZh", 3)))
+            CBP_FATAL("%s is not a bzip2 file", file_name);
+        compressed_bits = (uint64_t(compressed.size()) * 8);
+        compressed.resize(compressed.size() + 8, 0);   // lets reads run past the end
+
+        scan();
+        if ((first_block != 0) && (first_block >= blocks.size()))
+            CBP_FATAL("%s has no bzip2 block %zu", file_name, first_block);
+
+        for (unsigned i = 0; i < max(num_threads, 1U); ++i)
+            workers.push_back(thread(&BZ2_PARALLEL_SOURCE::worker, this));
+    }
+
+    BZ2_PARALLEL_SOURCE::~BZ2_PARALLEL_SOURCE(void)
+    {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        window_moved.notify_all();
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+    }
+
+    // Finds every block and end-of-stream magic number.
+    void
+    BZ2_PARALLEL_SOURCE::scan(void)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        uint64_t bits = 0;
+        for (uint64_t i = 0; i < (compressed_bits / 8); ++i) {
+            uint8_t byte = compressed[i];
+            for (int b = 7; b >= 0; --b) {
+                bits = ((bits << 1) | ((byte >> b) & 1));
+                uint64_t magic = (bits & BZ2_MAGIC_MASK);
+                if ((BZ2_BLOCK_MAGIC == magic) || (BZ2_EOS_MAGIC == magic)) {
+                    uint64_t mark = ((i * 8) + (7 - b) + 1 - 48);
+                    if (BZ2_BLOCK_MAGIC == magic) {
+                        blocks.push_back(BLOCK());
+                        blocks.back().start_mark = marks.size();
+                    }
+                    marks.push_back(mark);
+                }
+            }
+        }
+
+        decompress_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    uint64_t
+    BZ2_PARALLEL_SOURCE::get_mark(size_t index) const
+    {
+        return ((index < marks.size()) ? marks[index] : compressed_bits);
+    }
+
+    // Decodes the block(s) in bits [start_bit, end_bit) by wrapping them into a
+    // stream of their own.  A single-block stream's combined CRC is the
+    // block's CRC, which immediately follows the block magic.
+    bool
+    BZ2_PARALLEL_SOURCE::decode(uint64_t start_bit, uint64_t end_bit, vector<uint8_t>* out) const
+    {
+        vector<uint8_t> stream;
+        stream.reserve(((end_bit - start_bit) / 8) + 16);
+        BIT_WRITER writer(&stream);
+        writer.put_byte('B');
+        writer.put_byte('Z');
+        writer.put_byte('h');
+        writer.put_byte('9');   // the largest block size decodes any block
+        uint32_t crc = 0;
+        for (uint64_t bit = start_bit; bit < end_bit; bit += 8) {
+            size_t index = static_cast<size_t>(bit / 8);
+            int shift = static_cast<int>(bit % 8);
+            uint8_t byte = static_cast<uint8_t>((compressed[index] << shift)
+                | ((compressed[index + 1] >> (8 - shift)) & ((1 << shift) - 1)));
+            if ((end_bit - bit) >= 8)
+                writer.put_byte(byte);
+            else
+                writer.put_bits((byte >> (8 - (end_bit - bit))), static_cast<int>(end_bit - bit));
+            if ((bit - start_bit) >= 48 && (bit - start_bit) < 80)
+                crc = ((crc << 8) | byte);
+        }
+        writer.put_bits(BZ2_EOS_MAGIC, 48);
+        writer.put_bits(crc, 32);
+
+        bz_stream bz;
+        memset(&bz, 0, sizeof(bz));
+        if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK)
+            CBP_FATAL("BZ2_bzDecompressInit failed");
+        bz.next_in = reinterpret_cast<char*>(&stream[0]);
+        bz.avail_in = static_cast<unsigned int>(stream.size());
+        out->clear();
+        int status = BZ_OK;
+        while (BZ_OK == status) {
+            size_t used = out->size();
+            out->resize(max(used * 2, size_t(1) << 20));
+            bz.next_out = reinterpret_cast<char*>(&(*out)[used]);
+            bz.avail_out = static_cast<unsigned int>(out->size() - used);
+            status = BZ2_bzDecompress(&bz);
+            out->resize(out->size() - bz.avail_out);
+            if ((BZ_OK == status) && (0 == bz.avail_in) && (0 != bz.avail_out))
+                break;   // ran out of input before the end of the stream
+        }
+        BZ2_bzDecompressEnd(&bz);
+        return (BZ_STREAM_END == status);
+    }
+
+    void
+    BZ2_PARALLEL_SOURCE::worker(void)
+    {
+        unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            while (!stopping && (next_block != blocks.size())
+                   && (next_block >= (current_block + window)))
+                window_moved.wait(lock);
+            if (stopping || (next_block == blocks.size()))
+                return;
+            size_t index = next_block++;
+            uint64_t start_bit = get_mark(blocks[index].start_mark);
+            uint64_t end_bit = get_mark(blocks[index].start_mark + 1);
+            lock.unlock();
+
+            vector<uint8_t> data;
+            bool success = decode(start_bit, end_bit, &data);
+
+            lock.lock();
+            blocks[index].data.swap(data);
+            blocks[index].state = (success ? BLOCK::DONE : BLOCK::FAILED);
+            block_done.notify_all();
+        }
+    }
+
+    // Makes current_block a decoded block with bytes left to hand out, moving
+    // past exhausted and merged blocks.  Returns false at the end of the trace.
+    bool
+    BZ2_PARALLEL_SOURCE::advance(void)
+    {
+        for (;;) {
+            if (current_block == blocks.size())
+                return false;
+            BLOCK& block = blocks[current_block];
+            if (current_ready && (current_offset < block.data.size()))
+                return true;
+
+            if (!current_ready) {
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                unique_lock<std::mutex> lock(mutex);
+                while (BLOCK::PENDING == block.state)
+                    block_done.wait(lock);
+                lock.unlock();
+
+                if (current_block >= skip_until) {
+                    // a spurious magic number split this block; merge it with
+                    // its successors until it decodes, and skip the blocks that
+                    // were merged in
+                    if (BLOCK::FAILED == block.state) {
+                        size_t end_mark = (block.start_mark + 2);
+                        for (;; ++end_mark) {
+                            if (end_mark > marks.size())
+                                CBP_FATAL("corrupt bzip2 trace");
+                            if (decode(get_mark(block.start_mark), get_mark(end_mark), &block.data))
+                                break;
+                        }
+                        block.state = BLOCK::DONE;
+                        for (skip_until = (current_block + 1); skip_until < blocks.size(); ++skip_until)
+                            if (blocks[skip_until].start_mark >= end_mark)
+                                break;
+                    }
+                    current_ready = true;
+                    block_starts.push_back(make_pair(output_bytes - current_offset, current_block));
+                }
+                decompress_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                if (current_ready && (current_offset < block.data.size()))
+                    return true;
+            }
+
+            // done with this block: free it and let the workers move ahead
+            lock_guard<std::mutex> lock(mutex);
+            vector<uint8_t>().swap(block.data);
+            ++current_block;
+            current_offset = 0;
+            current_ready = false;
+            window_moved.notify_all();
+        }
+    }
+
+    size_t
+    BZ2_PARALLEL_SOURCE::read(uint8_t* buffer, size_t size)
+    {
+        size_t copied = 0;
+        while ((copied != size) && advance()) {
+            const BLOCK& block = blocks[current_block];
+            size_t n = min(size - copied, block.data.size() - current_offset);
+            memcpy(buffer + copied, &block.data[current_offset], n);
+            current_offset += n;
+            output_bytes += n;
+            copied += n;
+        }
+        return copied;
+    }
+
+    bool
+    BZ2_PARALLEL_SOURCE::locate(uint64_t offset, size_t* block, size_t* block_offset) const
+    {
+        if (block_starts.empty() || (offset > output_bytes))
+            return false;
+        // the last block that starts at or before offset
+        vector<pair<uint64_t, size_t> >::const_iterator start =
+            upper_bound(block_starts.begin(), block_starts.end(), make_pair(offset, blocks.size()));
+        if (start == block_starts.begin())
+            return false;
+        --start;
+        *block = start->second;
+        *block_offset = static_cast<size_t>(offset - start->first);
+        return true;
+    }
+} // namespace cbp
@@ -0,0 +1,160 @@
+/* Description: This file defines the sources that a CBP_INST_STREAM can read
+ * the raw (uncompressed) trace bytes from.  BZ2_SOURCE decompresses a bzip2
+ * trace in-process, so no "bzip2 -dc" subprocess or pipe is needed.
+ * BZ2_PARALLEL_SOURCE splits the trace at its bzip2 block boundaries and
+ * decompresses the blocks on a pool of worker threads.
+*/
+
+#ifndef TRACE_SOURCE_H_SEEN
+#define TRACE_SOURCE_H_SEEN
+
+#include <bzlib.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <inttypes.h>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cbp
+{
+    // A producer of uncompressed trace bytes.
+    class TRACE_SOURCE
+    {
+      private:
+        // not implemented
+        explicit TRACE_SOURCE(const TRACE_SOURCE&);
+        TRACE_SOURCE& operator=(const TRACE_SOURCE&);
+
+      public:
+        TRACE_SOURCE(void) { }
+        virtual ~TRACE_SOURCE(void) { }
+
+        // Copies up to 'size' bytes into 'buffer'.  Returns the number of
+        // bytes copied, which is less than 'size' only at the end of the trace.
+        virtual std::size_t read(uint8_t* buffer, std::size_t size) = 0;
+
+        // Wall-clock seconds the reader has spent waiting on decompression.
+        virtual double get_decompress_seconds(void) const { return 0.0; }
+    };
+
+    // Reads uncompressed trace bytes from an open std::FILE*.  The client
+    // keeps ownership of the std::FILE*.
+    class FILE_SOURCE : public TRACE_SOURCE
+    {
+      private:
+        std::FILE* stream;
+
+      public:
+        explicit FILE_SOURCE(std::FILE* stream_arg) : stream(stream_arg) { }
+        // uses compiler generated destructor
+
+        std::FILE* get_stream(void) { return stream; }
+        std::size_t read(uint8_t* buffer, std::size_t size);
+    };
+
+    // Decompresses a bzip2 file in-process into a large output buffer, or,
+    // for large reads, straight into the caller's buffer.  Concatenated bzip2 streams are decoded back to back.
+    class BZ2_SOURCE : public TRACE_SOURCE
+    {
+      private:
+        enum { INPUT_SIZE  = (1 << 20) };   // compressed bytes per fread
+        enum { OUTPUT_SIZE = (4 << 20) };   // decompressed bytes per refill
+        enum { DIRECT_SIZE = (64 << 10) };  // reads this large bypass output
+
+        std::FILE* file;
+        bz_stream bz;
+        bool bz_active;                     // bz has been initialized
+        bool input_eof;                     // file has been fully read
+        bool output_eof;                    // last stream has ended
+        char* input;
+        uint8_t* output;
+        uint8_t* output_head;               // next byte to hand out
+        uint8_t* output_tail;               // one past the last valid byte
+        double decompress_seconds;
+
+        std::size_t decompress(uint8_t* buffer, std::size_t size);
+
+      public:
+        explicit BZ2_SOURCE(const char* file_name);
+        ~BZ2_SOURCE(void);
+
+        std::size_t read(uint8_t* buffer, std::size_t size);
+        double get_decompress_seconds(void) const { return decompress_seconds; }
+    };
+
+    // Decompresses a bzip2 file block by block on 'num_threads' worker threads.
+    // bzip2 blocks are independent: each one is located by its 48-bit magic
+    // number, wrapped into a single-block stream, and decoded by libbz2, which
+    // also checks the block's CRC.  read() hands the blocks out in file order,
+    // so the output is identical to BZ2_SOURCE's.  A magic number that occurs
+    // by chance inside compressed data yields a block that fails to decode;
+    // such a block is merged with its successor and decoded again.
+    //
+    // The blocks are numbered in the order the magic numbers occur in the
+    // file, spurious ones included, so a block number and an offset into the
+    // block's decompressed bytes locate a point in the trace that a new
+    // source can start from (see trace_index.h).
+    class BZ2_PARALLEL_SOURCE : public TRACE_SOURCE
+    {
+      private:
+        struct BLOCK
+        {
+            enum STATE { PENDING, DONE, FAILED };
+            BLOCK(void) : start_mark(0), state(PENDING) { }
+            std::size_t start_mark;         // index into marks of the block magic
+            std::vector<uint8_t> data;      // decompressed bytes
+            STATE state;
+        };
+
+        std::vector<uint8_t> compressed;    // the whole file, zero padded
+        uint64_t compressed_bits;
+        std::vector<uint64_t> marks;        // bit offsets of all block and end-of-stream magics
+        std::vector<BLOCK> blocks;
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable block_done;
+        std::condition_variable window_moved;
+        std::size_t window;                 // max blocks decoded ahead of read()
+        std::size_t next_block;             // next block for a worker to claim
+        std::size_t current_block;          // block being handed out by read()
+        std::size_t current_offset;         // next byte of current_block's data
+        std::size_t skip_until;             // blocks before this were merged into an earlier one
+        bool current_ready;                 // current_block is decoded and owned by read()
+        bool stopping;
+        double decompress_seconds;
+        uint64_t output_bytes;              // bytes handed out by read()
+        std::vector<std::pair<uint64_t, std::size_t> > block_starts;   // (output_bytes, block) as each block is reached
+
+        void scan(void);
+        uint64_t get_mark(std::size_t index) const;
+        bool decode(uint64_t start_bit, uint64_t end_bit, std::vector<uint8_t>* out) const;
+        void worker(void);
+        bool advance(void);
+
+      public:
+        // Starts at block 'first_block', skipping the first 'first_offset'
+        // bytes it decompresses to.
+        BZ2_PARALLEL_SOURCE(const char* file_name, unsigned num_threads,
+                            std::size_t first_block = 0, std::size_t first_offset = 0);
+        ~BZ2_PARALLEL_SOURCE(void);
+
+        std::size_t read(uint8_t* buffer, std::size_t size);
+        double get_decompress_seconds(void) const { return decompress_seconds; }
+
+        // The number of blocks, and the bit offset of a block in the file.
+        std::size_t get_num_blocks(void) const { return blocks.size(); }
+        uint64_t get_block_bit(std::size_t block) const { return get_mark(blocks[block].start_mark); }
+
+        // Finds the block that byte 'offset' of the output read() has handed
+        // out is in, and its offset into the block's decompressed bytes.  The
+        // source must have started at the start of the file.  Returns false
+        // if read() hasn't reached the byte.
+        bool locate(uint64_t offset, std::size_t* block, std::size_t* block_offset) const;
+    };
+} // namespace cbp
+
+#endif // TRACE_SOURCE_H_SEEN
@@ -6,7 +6,12 @@
 #include "tread.h"
 #include <cassert>
 #include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "cbp_fatal.h"
 #include "op_state.h"
+#include "trace_index.h"
 
 using namespace cbp;
 using namespace std;
@@ -28,30 +33,110 @@ void branch_record_c::init(){
 void branch_record_c::debug_print(){
     //printf("jp-op(%2x)t(%1x)lip(%8x)tar(%8x)nlip(%8x)num(%8x)\n", jump_class, tkn, lip, tar, nlip, num_insts);
 }
+cbp_stats_c::cbp_stats_c(){
+    stat_num_branches         = 0;
+    stat_num_cc_branches      = 0;
+    stat_num_predicts         = 0;
+    stat_num_correct_predicts = 0;
+    stat_num_insts            = 0;
+    for(int i = 0; i < NUM_TARGET_CLASSES; i++){
+        stat_num_target_predicts[i]         = 0;
+        stat_num_correct_target_predicts[i] = 0;
+    }
+}
+const char *cbp_stats_c::get_target_class_name(int target_class){
+    static const char *const names[NUM_TARGET_CLASSES] = {"jump", "call", "return"};
+    return (target_class < NUM_TARGET_CLASSES) ? names[target_class] : "indirect";
+}
+void cbp_stats_c::add(const cbp_stats_c &other){
+    stat_num_branches         += other.stat_num_branches;
+    stat_num_insts            += other.stat_num_insts;
+    stat_num_cc_branches      += other.stat_num_cc_branches;
+    stat_num_predicts         += other.stat_num_predicts;
+    stat_num_correct_predicts += other.stat_num_correct_predicts;
+    for(int i = 0; i < NUM_TARGET_CLASSES; i++){
+        stat_num_target_predicts[i]         += other.stat_num_target_predicts[i];
+        stat_num_correct_target_predicts[i] += other.stat_num_correct_target_predicts[i];
+    }
+}
+float cbp_stats_c::get_mpki() const{
+    int   mis_preds     = (stat_num_cc_branches - stat_num_correct_predicts);
+    return float(mis_preds)/(float(stat_num_insts) / 1000);
+}
+bool cbp_stats_c::has_target_predicts() const{
+    for(int i = 0; i < NUM_TARGET_CLASSES; i++){
+        if(stat_num_target_predicts[i] != 0){
+            return true;
+        }
+    }
+    return false;
+}
+uint cbp_stats_c::get_target_mispredicts(int target_class) const{
+    uint mis_preds = 0;
+    for(int i = 0; i < NUM_TARGET_CLASSES; i++){
+        if((i == target_class) || (target_class == NUM_TARGET_CLASSES)){
+            mis_preds += stat_num_target_predicts[i] - stat_num_correct_target_predicts[i];
+        }
+    }
+    return mis_preds;
+}
+float cbp_stats_c::get_target_mpki(int target_class) const{
+    return float(get_target_mispredicts(target_class))/(float(stat_num_insts) / 1000);
+}
+void cbp_stats_c::print() const{
+    int   mis_preds     = (stat_num_cc_branches - stat_num_correct_predicts);
+    float mis_pred_rate = get_mpki();
+    printf("1000*wrong_cc_predicts/total insts: 1000 * %8d / %8d = %7.3f\n", mis_preds, stat_num_insts, mis_pred_rate);
+    printf("total branches:                  %8d\n", stat_num_branches);
+    printf("total cc branches:               %8d\n", stat_num_cc_branches);
+    printf("total predicts:                  %8d\n", stat_num_predicts);
+    if(has_target_predicts()){
+        for(int i = 0; i <= NUM_TARGET_CLASSES; i++){
+            string label = string("1000*wrong_") + get_target_class_name(i) + "_targets/total insts:";
+            printf("%-40s 1000 * %8d / %8d = %7.3f\n", label.c_str(), get_target_mispredicts(i), stat_num_insts,
+                   get_target_mpki(i));
+        }
+        for(int i = 0; i < NUM_TARGET_CLASSES; i++){
+            string label = string("total ") + get_target_class_name(i) + " target predicts:";
+            printf("%-32s %8d\n", label.c_str(), stat_num_target_predicts[i]);
+        }
+    }
+}
+branch_reader_c::branch_reader_c(){
+    osptr                     = 0;
+    is_branch_tkn             = false;
+    predict_branch_tkn_copy   = false;
+    predict_valid             = false;
+    branch_target             = 0;
+    predict_target_copy       = 0;
+    predict_target_valid      = false;
+    score_pending             = false;
+    position.branches         = 0;
+    position.insts            = 0;
+    report                    = true;
+    report_stats              = true;
+    op_state_use              = OP_STATE_ALL;
+}
+branch_reader_c::~branch_reader_c(){
+}
 //predictor apsi.cbp_inst.jz
-cbp_trace_reader_c::cbp_trace_reader_c(char *trace_name){
-    char trace_name_copy[256];
-    char trnm_cmdline[256];
-    memset((char *) trace_name_copy,  0, 256);
-    memset((char *) trnm_cmdline,  0, 256);
+cbp_trace_reader_c::cbp_trace_reader_c(char *trace_name, uint decompress_threads_arg, bool use_index){
     // we need the name the name of the trace 
     assert(trace_name);
-    strcpy(trace_name_copy, trace_name);
-    sprintf(trnm_cmdline, "bzip2 -dc %s.bz2", trace_name_copy);
-    from_cbp_trace_file = popen(trnm_cmdline, "r");
-    from_cbp_inst_stream = cbp_inst_open(from_cbp_trace_file);
+    trace_file_name    = string(trace_name) + ".bz2";
+    decompress_threads = decompress_threads_arg;
+    index              = (use_index && trace_index_c::exists(trace_name)) ? new trace_index_c(trace_name) : 0;
+    // the trace is decompressed in-process, straight into the source's buffer
+    if(decompress_threads > 0){
+        from_cbp_trace_source = new BZ2_PARALLEL_SOURCE(trace_file_name.c_str(), decompress_threads);
+    }
+    else{
+        from_cbp_trace_source = new BZ2_SOURCE(trace_file_name.c_str());
+    }
+    from_cbp_inst_stream = cbp_inst_open(from_cbp_trace_source);
     // initialize op_state
     osptr = new op_state_c();
     osptr->init(osptr);
-    // initialize some scalars 
-    is_branch_tkn             = false;
-    predict_branch_tkn_copy   = false;
-    predict_valid             = false;
-    stat_num_branches         = 0;
-    stat_num_cc_branches      = 0;
-    stat_num_predicts         = 0;
-    stat_num_correct_predicts = 0;
-    stat_num_insts            = 0;
 
     memset(&cbp_inst, 0, sizeof(cbp_inst));
     cbp_inst.instruction_next_addr = 0;
@@ -64,20 +149,85 @@ cbp_trace_reader_c::cbp_trace_reader_c(char *trace_name){
 }
 
 cbp_trace_reader_c::~cbp_trace_reader_c(){
-    printf("*********************************************************\n");
-    int   mis_preds     = (stat_num_cc_branches - stat_num_correct_predicts);
-    float mis_pred_rate = float(mis_preds)/(float(stat_num_insts) / 1000);
-    printf("1000*wrong_cc_predicts/total insts: 1000 * %8d / %8d = %7.3f\n", mis_preds, stat_num_insts, mis_pred_rate);
-    printf("total branches:                  %8d\n", stat_num_branches);
-    printf("total cc branches:               %8d\n", stat_num_cc_branches);
-    printf("total predicts:                  %8d\n", stat_num_predicts);
-    printf("*********************************************************\n");
+    if(report){
+        printf("*********************************************************\n");
+        if(report_stats){
+            stats.print();
+        }
+        printf("decompress seconds:              %8.3f\n", from_cbp_trace_source->get_decompress_seconds());
+        // the decoder counts its bytes from the start of the trace, even after a seek, so they are divided
+        // by the instructions from the start of the trace, not the ones the statistics count
+        printf("trace bytes per inst:            %8.3f\n",
+               position.insts ? double(cbp_inst_get_bytes(from_cbp_inst_stream)) / position.insts : 0.0);
+        printf("*********************************************************\n");
+    }
     cbp_inst_close(from_cbp_inst_stream);
-    pclose(from_cbp_trace_file);
+    delete from_cbp_trace_source;
+    delete index;
     delete osptr;
 }
 
-bool cbp_trace_reader_c::predict_branch(bool predict_branch_tkn){
+void cbp_trace_reader_c::seek_checkpoint(uint64_t branches, uint64_t insts){
+    const trace_index_entry_c *checkpoint = index ? index->find_checkpoint(branches, insts) : 0;
+    if(!checkpoint || (checkpoint->position.branches <= position.branches)){
+        return;
+    }
+    cbp_inst_close(from_cbp_inst_stream);
+    delete from_cbp_trace_source;
+    index->open_checkpoint(checkpoint, trace_file_name.c_str(), decompress_threads, &from_cbp_trace_source,
+                           &from_cbp_inst_stream, osptr);
+    position = checkpoint->position;
+}
+
+uint64_t cbp_trace_reader_c::get_trace_insts() const{
+    return index ? index->get_trace_insts() : 0;
+}
+
+void cbp_trace_reader_c::write_index(const char *file_name, uint64_t interval_insts){
+    BZ2_PARALLEL_SOURCE *source = dynamic_cast<BZ2_PARALLEL_SOURCE *>(from_cbp_trace_source);
+    struct stat file_stat;
+    // the checkpoints hold the whole op_state
+    if(!source || (op_state_use != OP_STATE_ALL) || (stat(trace_file_name.c_str(), &file_stat) != 0)){
+        CBP_FATAL("cannot index \"%s\"", trace_file_name.c_str());
+    }
+    trace_index_writer_c writer(file_name, file_stat.st_size, interval_insts);
+    trace_index_entry_c entry;
+    memset(&entry, 0, sizeof(entry));
+    vector<uint8_t> decoder_state;
+    vector<char> op_state(osptr->get_state_size());
+    uint64_t next_insts = position.insts + interval_insts;
+    branch_record_c branch_record;
+    bool taken;
+    uint num_insts = 0;
+    while(decode_branch_record(&branch_record, &taken, &num_insts)){
+        position.branches++;
+        position.insts += num_insts;
+        num_insts       = 0;
+        if(position.insts < next_insts){
+            continue;
+        }
+        entry.position     = position;
+        entry.trace_offset = cbp_inst_get_bytes(from_cbp_inst_stream);
+        size_t block, block_offset;
+        if(!source->locate(entry.trace_offset, &block, &block_offset)){
+            CBP_FATAL("cannot locate byte %llu of \"%s\"", (unsigned long long)entry.trace_offset,
+                      trace_file_name.c_str());
+        }
+        entry.block        = block;
+        entry.block_bit    = source->get_block_bit(block);
+        entry.block_offset = block_offset;
+        cbp_inst_save_state(from_cbp_inst_stream, &decoder_state);
+        osptr->save_state(&op_state[0]);
+        writer.write(entry, decoder_state, op_state);
+        while(next_insts <= position.insts){
+            next_insts += interval_insts;
+        }
+    }
+    // the trace's last instructions, after its last branch, are in num_insts
+    writer.close(position.insts + num_insts);
+}
+
+bool branch_reader_c::predict_branch(bool predict_branch_tkn){
     if(predict_valid){
         printf("*******Multiple predictions made, you've called predict_branch more than once for the same branch!*******\n");
     }
@@ -88,24 +238,94 @@ bool cbp_trace_reader_c::predict_branch(bool predict_branch_tkn){
     return is_branch_tkn;
 }
 
+uint branch_reader_c::predict_target(uint predicted_target){
+    if(predict_target_valid){
+        printf("*******Multiple target predictions made, you've called predict_target more than once for the same branch!*******\n");
+    }
+    else{
+        predict_target_valid = true;
+        predict_target_copy  = predicted_target;
+    }
+    return branch_target;
+}
+
 
-bool cbp_trace_reader_c::get_branch_record(branch_record_c *branch_record){
-    if(stat_num_branches != 0){
-        if(!predict_valid){
-            if(branch_record->is_conditional){
-                printf("*******No prediction made, you should at least try!*******\n");
-                stat_num_predicts++;
-            }
+void branch_reader_c::score_pending_prediction(const branch_record_c *branch_record){
+    if(score_pending){
+        stats.score_prediction(branch_record, predict_valid, predict_branch_tkn_copy, is_branch_tkn);
+        if(predict_target_valid){
+            stats.score_target(branch_record, predict_target_copy);
         }
-        else{
-            if(branch_record->is_conditional){
-                stat_num_predicts++;
-                if(predict_branch_tkn_copy == is_branch_tkn){ // correct prediction
-                    stat_num_correct_predicts++;
-                }
-            }
+        score_pending = false;
+    }
+}
+
+bool branch_reader_c::get_branch_record(branch_record_c *branch_record){
+    score_pending_prediction(branch_record);
+    uint num_insts = 0;
+    bool taken     = false;
+    bool found     = decode_branch_record(branch_record, &taken, &num_insts);
+    stats.stat_num_insts += num_insts;
+    if(!found){
+        return false;
+    }
+    position.branches++;
+    position.insts      += num_insts;
+    score_pending        = true;
+    is_branch_tkn        = taken;
+    predict_valid        = false;
+    branch_target        = branch_record->branch_target;
+    predict_target_valid = false;
+    stats.count_branch(branch_record);
+    return true;
+}
+
+bool branch_reader_c::set_position(const branch_reader_position_c &position_arg){
+    if(position_arg.branches < position.branches){
+        return false;
+    }
+    seek_checkpoint(position_arg.branches, position_arg.insts);
+    if(!skip_branches(position_arg.branches - position.branches)){
+        return false;
+    }
+    position             = position_arg;
+    score_pending        = false;
+    predict_valid        = false;
+    predict_target_valid = false;
+    return true;
+}
+
+bool branch_reader_c::skip_to_insts(uint64_t insts){
+    seek_checkpoint(~uint64_t(0), insts);
+    branch_record_c branch_record;
+    bool taken;
+    while(position.insts < insts){
+        uint num_insts = 0;
+        if(!decode_branch_record(&branch_record, &taken, &num_insts)){
+            return false;
+        }
+        position.branches++;
+        position.insts += num_insts;
+    }
+    score_pending        = false;
+    predict_valid        = false;
+    predict_target_valid = false;
+    return true;
+}
+
+bool branch_reader_c::skip_branches(uint64_t num_branches){
+    branch_record_c branch_record;
+    bool taken;
+    for(uint64_t i = 0; i < num_branches; i++){
+        uint num_insts = 0;
+        if(!decode_branch_record(&branch_record, &taken, &num_insts)){
+            return false;
         }
     }
+    return true;
+}
+
+bool cbp_trace_reader_c::decode_branch_record(branch_record_c *branch_record, bool *taken, uint *num_insts){
     // init cbp_inst
     memset(&cbp_inst, 0, sizeof(cbp_inst));
     cbp_inst.instruction_next_addr = 0;
@@ -116,58 +336,39 @@ bool cbp_trace_reader_c::get_branch_record(branch_record_c *branch_record){
     cbp_inst.branch_target = 0;
     cbp_inst.taken = false;
     // populate the cbp_inst record
-    op_record_c *op = 0;
     while(!cbp_inst.is_branch){
-        if(feof(from_cbp_trace_file)){
-            return false;
-        }
         if(!cbp_inst_read(from_cbp_inst_stream, &cbp_inst)){
             return false;
         }
-        osptr->inc_clock();
-        uint opl_ptr = osptr->op_list_ptr;
-        op = osptr->op_list + opl_ptr;
-        if(op->is_valid){
-            //commit op
-            if(op->dst != REG_NUL){
-                assert(op->dst < osptr->num_regs);
-                osptr->regs[op->dst]       = op->get_dst_val();
-                osptr->regs_valid[op->dst] = true;
-            }
-        }
-        op->init();
-        op->is_valid         = true;
-        op->op_class         = cbp_inst.op_class;
-        op->instruction_addr = cbp_inst.instruction_addr;
-        op->is_load          = cbp_inst.is_load;
-        op->is_store         = cbp_inst.is_store;
-        op->is_branch        = cbp_inst.is_branch;
-        op->is_op            = cbp_inst.is_op;
-        op->is_fp            = cbp_inst.is_fp;
-        op->read_flg         = cbp_inst.read_flg;
-        op->writ_flg         = cbp_inst.writ_flg;
-        op->src1             = cbp_inst.src1;
-        op->src2             = cbp_inst.src2;
-        op->dst              = cbp_inst.dst;
-        op->has_mem_src      = cbp_inst.has_mem_src;
-        op->has_mem_dst      = cbp_inst.has_mem_dst;
-        op->mem_src1         = cbp_inst.mem_src1;
-        op->mem_src2         = cbp_inst.mem_src2;
-        op->mem_src3         = cbp_inst.mem_src3;
-        op->set_src1_val(cbp_inst.src1_val);
-        op->set_src2_val(cbp_inst.src2_val);
-        op->set_dst_val(cbp_inst.dst_val);
-        op->set_src_vaddr(cbp_inst.src_vaddr);
-        op->set_dst_vaddr(cbp_inst.src_vaddr);
-        stat_num_insts++;
-        //op->debug_print();
+        (*num_insts)++;
+        if(op_state_use == OP_STATE_NONE){
+            continue;
+        }
+        // commit the oldest op, and record this one in its place
+        uint op = osptr->new_op(op_state_use & OP_STATE_REG_FILE);
+        if(op_state_use & OP_STATE_OPS){
+            osptr->set_op_class(op, cbp_inst.op_class, cbp_inst.instruction_addr,
+                                (cbp_inst.is_load ? OP_FLAG_LOAD : 0) | (cbp_inst.is_store ? OP_FLAG_STORE : 0) |
+                                (cbp_inst.is_branch ? OP_FLAG_BRANCH : 0) | (cbp_inst.is_op ? OP_FLAG_OP : 0) |
+                                (cbp_inst.is_fp ? OP_FLAG_FP : 0));
+        }
+        // the register file is written from the dst and dst_val of the ops it commits
+        if(op_state_use & (OP_STATE_OP_REGS | OP_STATE_REG_FILE)){
+            osptr->set_op_regs(op, cbp_inst.src1, cbp_inst.src2, cbp_inst.dst, cbp_inst.mem_src1, cbp_inst.mem_src2,
+                               cbp_inst.mem_src3,
+                               (cbp_inst.read_flg ? OP_FLAG_READ_FLG : 0) | (cbp_inst.writ_flg ? OP_FLAG_WRIT_FLG : 0) |
+                               (cbp_inst.has_mem_src ? OP_FLAG_HAS_MEM_SRC : 0) |
+                               (cbp_inst.has_mem_dst ? OP_FLAG_HAS_MEM_DST : 0));
+        }
+        if(op_state_use & (OP_STATE_OP_VALS | OP_STATE_REG_FILE)){
+            osptr->set_op_values(op, cbp_inst.src1_val, cbp_inst.src2_val, cbp_inst.dst_val, cbp_inst.src_vaddr,
+                                 cbp_inst.src_vaddr);
+        }
     }
     assert(cbp_inst.is_branch);
     // cbp_inst has been populated 
     // set branch record
     branch_record->init();
-    assert(op);
-    assert(op->instruction_addr == cbp_inst.instruction_addr);
     branch_record->instruction_addr      = cbp_inst.instruction_addr;
     branch_record->branch_target         = cbp_inst.branch_target;
     branch_record->instruction_next_addr = cbp_inst.instruction_next_addr;
@@ -175,12 +376,7 @@ bool cbp_trace_reader_c::get_branch_record(branch_record_c *branch_record){
     branch_record->is_conditional        = cbp_inst.is_conditional;
     branch_record->is_call               = cbp_inst.is_call;
     branch_record->is_return             = cbp_inst.is_return;
-    is_branch_tkn                        = cbp_inst.taken;
-    predict_valid                        = false;
-    stat_num_branches++;
-    if(branch_record->is_conditional){
-        stat_num_cc_branches++;
-    }
+    *taken                               = cbp_inst.taken;
     //printf("jp-op t(%1x)lip(%8x)tar(%8x)nlip(%8x)\n", cbp_inst.taken, cbp_inst.instruction_addr, cbp_inst.branch_target, cbp_inst.instruction_next_addr);
     return true;
 }
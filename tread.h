@@ -7,12 +7,16 @@
 #define TREAD_H_SEEN
 
 #include <cstdio>
+#include <inttypes.h>
+#include <string>
 #include "cbp_inst.h"
+#include "trace_source.h"
 
 typedef unsigned int uint;
 
 class op_record_c;
 class op_state_c;
+class trace_index_c;
 
 class branch_record_c
 {
@@ -30,39 +34,225 @@ public:
     bool   is_return;              // true if the branch is a return; false otherwise        
 };
 
-class cbp_trace_reader_c
+// the mispredict statistics the trace reader keeps for one predictor
+class cbp_stats_c
 {
-private:
-    bool is_branch_tkn;                             // the holy grail, this should never be used in a predictor algorithm 
-    bool predict_branch_tkn_copy;                   // the treader tucks away the prediction made by predictor    
-    bool predict_valid;                             // is the current prediction in predict_branch_tkn_copy valid
-
+public:
+    cbp_stats_c();
     // stats 
     uint stat_num_branches;                         // stat that tracks the number of branches observed during trace processing           
     uint stat_num_insts;                            // stat that tracks the number insts executed during a trace
     uint stat_num_cc_branches;                      // stat that tracks the number of cc (conditional) branches observed during trace processing           
     uint stat_num_predicts;                         // stat that tracks the number of branches predicted during trace processing          
     uint stat_num_correct_predicts;                 // stat that tracks the number of branches correctly predicted during trace processing
+    // the classes of the branches whose targets are scored: the indirect branches (see get_target_class())
+    enum { TARGET_JUMP, TARGET_CALL, TARGET_RETURN, NUM_TARGET_CLASSES };
+    uint stat_num_target_predicts[NUM_TARGET_CLASSES];         // indirect branches whose targets were predicted, per class
+    uint stat_num_correct_target_predicts[NUM_TARGET_CLASSES]; // the same, correctly predicted
+    // the target class of a branch: indirect calls, returns and the other indirect branches (jumps);
+    // -1 if the branch isn't indirect, so its target is known from its PC
+    static int get_target_class(const branch_record_c *branch_record){
+        if(!branch_record->is_indirect){
+            return -1;
+        }
+        if(branch_record->is_return){
+            return TARGET_RETURN;
+        }
+        return branch_record->is_call ? TARGET_CALL : TARGET_JUMP;
+    }
+    static const char *get_target_class_name(int target_class);
+    // counts one branch read from the trace
+    void count_branch(const branch_record_c *branch_record){
+        stat_num_branches++;
+        if(branch_record->is_conditional){
+            stat_num_cc_branches++;
+        }
+    }
+    // scores the prediction made for a branch already counted; predict_valid is false if the
+    // predictor never called predict_branch(), predicted_taken is ignored for non-conditional branches
+    void score_prediction(const branch_record_c *branch_record, bool predict_valid, bool predicted_taken, bool taken){
+        if(!predict_valid){
+            if(branch_record->is_conditional){
+                printf("*******No prediction made, you should at least try!*******\n");
+                stat_num_predicts++;
+            }
+        }
+        else{
+            if(branch_record->is_conditional){
+                stat_num_predicts++;
+                if(predicted_taken == taken){ // correct prediction
+                    stat_num_correct_predicts++;
+                }
+            }
+        }
+    }
+    // scores the target predicted for a branch already counted; branches that aren't indirect aren't scored
+    void score_target(const branch_record_c *branch_record, uint predicted_target){
+        int target_class = get_target_class(branch_record);
+        if(target_class >= 0){
+            stat_num_target_predicts[target_class]++;
+            if(predicted_target == branch_record->branch_target){
+                stat_num_correct_target_predicts[target_class]++;
+            }
+        }
+    }
+    // counts and scores one branch
+    void score_branch(const branch_record_c *branch_record, bool predicted_taken, bool taken){
+        count_branch(branch_record);
+        score_prediction(branch_record, true, predicted_taken, taken);
+    }
+    // adds the statistics of another run, e.g. of another segment of the trace
+    void add(const cbp_stats_c &other);
+    // mispredicts per 1000 instructions
+    float get_mpki() const;
+    // whether any target was predicted, and the target mispredicts per 1000 instructions of one class, or of
+    // all of them for NUM_TARGET_CLASSES
+    bool has_target_predicts() const;
+    uint get_target_mispredicts(int target_class) const;
+    float get_target_mpki(int target_class) const;
+    // print the mispredict rate and branch counts (the body of the report block), and the target mispredict
+    // rates if any target was predicted
+    void print() const;
+};
 
-    cbp::CBP_INST cbp_inst;
-    std::FILE* from_cbp_trace_file; 
-    cbp::CBP_INST_STREAM *from_cbp_inst_stream;
+// a reader's position in its trace: the branches get_branch_record() has returned, and the instructions
+// read up to and including the last of them
+struct branch_reader_position_c
+{
+    uint64_t branches;
+    uint64_t insts;
+};
+
+// The predictor-facing half of a trace reader: hands out branch records and scores the predictions
+// made for them.  Subclasses supply the branches through decode_branch_record().
+class branch_reader_c
+{
+protected:
+    bool is_branch_tkn;                             // the holy grail, this should never be used in a predictor algorithm 
+    bool predict_branch_tkn_copy;                   // the treader tucks away the prediction made by predictor    
+    bool predict_valid;                             // is the current prediction in predict_branch_tkn_copy valid
+    uint branch_target;                             // the current branch's target
+    uint predict_target_copy;                       // the treader tucks away the target predicted by predictor
+    bool predict_target_valid;                      // is the current prediction in predict_target_copy valid
+    bool score_pending;                             // the current branch's prediction is yet to be scored
+    branch_reader_position_c position;
+
+    cbp_stats_c stats;
+    bool report;                                    // print a report when the reader is destroyed
+    bool report_stats;                              // include the stats in the report
+    uint op_state_use;                              // what of op_state to keep up (OP_STATE_XXX, see op_state.h)
+
+    // skip num_branches branches, without scoring them; returns false at the end of the trace.  By default
+    // the branches are decoded; readers that can seek override this.
+    virtual bool skip_branches(uint64_t num_branches);
+    // readers that can jump to checkpoints in their trace (see trace_index.h) override this to move to the
+    // last one at or before both branches and insts, if it is ahead of position, and set position to it
+    virtual void seek_checkpoint(uint64_t branches, uint64_t insts){
+    }
 
 public:
     // op_state
     op_state_c *osptr;
-    // cbp_trace_reader_c is passed a string specifying the name of the trace file
-    cbp_trace_reader_c(char *trace_name);
-    ~cbp_trace_reader_c();
+
+    branch_reader_c();
+    virtual ~branch_reader_c();
     // call this to let the trace reader know what your prediction is; after it's called the prediction 
     // will get tucked away internally in predict_branch_tkn_copy and predict_valid is set; 
     // returns true if the branch is actually taken and false if the branch is actually not taken;
     // if the branch isn't conditional, this function behaves as a NOP and returns an undefined value
     // NOTE: you should only be able to call this once since the true branch direction is returned after it is called
     bool predict_branch(bool predict_branch_tkn);
+    // call this, optionally, to let the trace reader know the target you predict for an indirect branch; it's
+    // scored by the class of the branch (see cbp_stats_c::get_target_class()) and the actual target is
+    // returned.  Branches that aren't indirect aren't scored.
+    uint predict_target(uint predicted_target);
     // returns true if there is still another branch record in the trace.  false if the end of the branch trace 
     // has been reached.
     bool get_branch_record(branch_record_c *branch_record); 
+
+    // The two halves of get_branch_record()/predict_branch(), for drivers that decode and predict on
+    // different threads.  decode_branch_record() reads the next branch and its outcome (taken) without
+    // touching the statistics and adds the number of instructions it read to num_insts; at the end of the
+    // trace it returns false, having counted the trailing non-branch instructions.  score_branch() and
+    // count_insts() then feed the statistics, and may run on another thread than decode_branch_record().
+    virtual bool decode_branch_record(branch_record_c *branch_record, bool *taken, uint *num_insts) = 0;
+    void score_branch(const branch_record_c *branch_record, bool predicted_taken, bool taken){
+        stats.score_branch(branch_record, predicted_taken, taken);
+    }
+    void score_target(const branch_record_c *branch_record, uint predicted_target){
+        stats.score_target(branch_record, predicted_target);
+    }
+    void count_insts(uint num_insts){
+        stats.stat_num_insts += num_insts;
+    }
+    // Checkpoints: a driver that saves its predictor's state saves the reader's position and statistics
+    // with it, and restores them to resume from there (see predictor_snapshot.h).  score_pending_prediction()
+    // scores the prediction made for branch_record, the branch get_branch_record() returned last, now
+    // rather than when the next branch is read, so the statistics are complete at this position.
+    // set_position() skips ahead to a position the reader of the same trace was at, without scoring the
+    // branches skipped; it returns false if the position is behind the reader or past the end of the trace.
+    const branch_reader_position_c &get_position() const{
+        return position;
+    }
+    void score_pending_prediction(const branch_record_c *branch_record);
+    bool set_position(const branch_reader_position_c &position_arg);
+    // skips ahead, the same way, to just after the branch that reaches instruction insts; returns false if
+    // the trace ends first
+    bool skip_to_insts(uint64_t insts);
+    // the instructions in the whole trace, if the reader knows them without reading it (from its file's
+    // header, or its index), otherwise 0
+    virtual uint64_t get_trace_insts() const{
+        return 0;
+    }
+    const cbp_stats_c &get_stats() const{
+        return stats;
+    }
+    void set_stats(const cbp_stats_c &stats_arg){
+        stats = stats_arg;
+    }
+    // drivers that keep their own statistics (one cbp_stats_c per predictor) turn the reader's off
+    void set_report_stats(bool report_stats_arg){
+        report_stats = report_stats_arg;
+    }
+    // what of op_state the predictor reads (OP_STATE_XXX, see op_state.h), so the reader only keeps
+    // that up; set before the first branch is read.  By default, everything.
+    void set_op_state_use(uint op_state_use_arg){
+        op_state_use = op_state_use_arg;
+    }
+    // drivers that print their own reports turn the reader's off altogether
+    void set_report(bool report_arg){
+        report = report_arg;
+    }
+};
+
+// reads a bzip2 compressed CBP_INST trace, maintaining op_state as it goes
+class cbp_trace_reader_c : public branch_reader_c
+{
+private:
+    cbp::CBP_INST cbp_inst;
+    std::string trace_file_name;
+    uint decompress_threads;
+    cbp::TRACE_SOURCE *from_cbp_trace_source;       // in-process bzip2 decoder feeding from_cbp_inst_stream
+    cbp::CBP_INST_STREAM *from_cbp_inst_stream;
+    trace_index_c *index;                           // the trace's index, if it has one
+
+protected:
+    // with an index, the reader restarts its decoder at the checkpoint
+    void seek_checkpoint(uint64_t branches, uint64_t insts);
+
+public:
+    // cbp_trace_reader_c is passed a string specifying the name of the trace file;
+    // with decompress_threads > 0 the trace's bzip2 blocks are decompressed in
+    // parallel on that many threads, otherwise serially on the calling thread.
+    // If the trace has an index (<trace>.idx), the reader seeks with it, unless use_index is false.
+    cbp_trace_reader_c(char *trace_name, uint decompress_threads = 0, bool use_index = true);
+    ~cbp_trace_reader_c();
+    bool decode_branch_record(branch_record_c *branch_record, bool *taken, uint *num_insts);
+    // known only with an index
+    uint64_t get_trace_insts() const;
+    // read the rest of the trace, writing its index, with a checkpoint at the branch that reaches every
+    // interval_insts instructions, to file_name; the reader must decompress on at least one thread
+    void write_index(const char *file_name, uint64_t interval_insts);
 };
 
 #endif // TREAD_H_SEEN
@@ -0,0 +1,102 @@
+/* Description: This file defines a small work-stealing thread pool.  Tasks are
+ * dealt out round-robin, in the order they were added, to per-worker queues;
+ * a worker runs its own queue from the front and, when it runs dry, steals
+ * from the back of another worker's queue.  Adding the tasks biggest first
+ * therefore starts the long tasks first and leaves the short ones to fill in
+ * at the end.
+*/
+
+#ifndef WORK_POOL_H_SEEN
+#define WORK_POOL_H_SEEN
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cbp
+{
+    class WORK_POOL
+    {
+      public:
+        typedef std::function<void(void)> TASK;
+
+      private:
+        struct QUEUE
+        {
+            std::mutex mutex;
+            std::deque<TASK> tasks;
+        };
+
+        std::vector<TASK> pending;          // tasks added but not yet run
+
+        // not implemented
+        explicit WORK_POOL(const WORK_POOL&);
+        WORK_POOL& operator=(const WORK_POOL&);
+
+        static bool pop_front(QUEUE* queue, TASK* task)
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            if (queue->tasks.empty())
+                return false;
+            *task = queue->tasks.front();
+            queue->tasks.pop_front();
+            return true;
+        }
+
+        static bool pop_back(QUEUE* queue, TASK* task)
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            if (queue->tasks.empty())
+                return false;
+            *task = queue->tasks.back();
+            queue->tasks.pop_back();
+            return true;
+        }
+
+        static void worker(std::vector<QUEUE>* queues, std::size_t self)
+        {
+            TASK task;
+            for (;;) {
+                bool found = pop_front(&(*queues)[self], &task);
+                // nothing of our own left: steal, starting with our neighbor
+                for (std::size_t i = 1; !found && (i < queues->size()); ++i)
+                    found = pop_back(&(*queues)[(self + i) % queues->size()], &task);
+                // no task is ever added while the pool runs, so empty queues
+                // everywhere means we are done
+                if (!found)
+                    return;
+                task();
+            }
+        }
+
+      public:
+        WORK_POOL(void) { }
+        // uses compiler generated destructor
+
+        void add(const TASK& task) { pending.push_back(task); }
+
+        // Runs all the added tasks on 'num_threads' threads (the calling
+        // thread plus num_threads - 1 more) and returns when they are done.
+        void run(unsigned num_threads)
+        {
+            if (num_threads == 0)
+                num_threads = 1;
+            std::vector<QUEUE> queues(num_threads);
+            for (std::size_t i = 0; i < pending.size(); ++i)
+                queues[i % num_threads].tasks.push_back(pending[i]);
+            pending.clear();
+
+            std::vector<std::thread> threads;
+            for (unsigned i = 1; i < num_threads; ++i)
+                threads.push_back(std::thread(worker, &queues, std::size_t(i)));
+            worker(&queues, 0);
+            for (std::size_t i = 0; i < threads.size(); ++i)
+                threads[i].join();
+        }
+    };
+} // namespace cbp
+
+#endif // WORK_POOL_H_SEEN